@@ -0,0 +1,68 @@
+// Lockstep batch engine against the same number of independent cpu
+// instances, each lane with its own random stream. Build with `make bench`.
+#include "batch.h"
+#include "devices.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// INX / TXA / CLC / ADC #3 / TAY / DEY / BNE / JMP $0600: registers only.
+const std::vector<Byte> registerLoop = {
+    0xE8, 0x8A, 0x18, 0x69, 0x03, 0xA8, 0x88, 0xD0, 0xF7, 0x4C, 0x00, 0x06
+};
+
+// LDA $FE / AND #1 / BEQ / INC $10 / BNE / INC $11 / TXA / CLC / ADC $12 /
+// STA $12 / INX / BNE / JMP $0600: lanes split on a random bit every pass
+// and reconverge after it.
+const std::vector<Byte> branchyLoop = {
+    0xA2, 0x00, 0xA5, 0xFE, 0x29, 0x01, 0xF0, 0x04, 0xE6, 0x10, 0xD0, 0x02, 0xE6, 0x11,
+    0x8A, 0x18, 0x65, 0x12, 0x85, 0x12, 0xE8, 0xD0, 0xEB, 0x4C, 0x00, 0x06
+};
+
+const uint64_t BUDGET = 500000; // cycles per lane
+
+void compare(const char* name, const std::vector<Byte>& program, size_t lanes) {
+    BatchCpu batch(lanes);
+    batch.loadAt0600AndSetReset(program);
+    batch.reset();
+    for (size_t l = 0; l < lanes; ++l) batch.seedRandom(l, (uint32_t)(l * 2654435761u + 1));
+    double t0 = now();
+    batch.run(BUDGET);
+    double tBatch = now() - t0;
+
+    std::vector<std::unique_ptr<RandomDevice> > randoms;
+    std::vector<std::unique_ptr<cpu> > cpus;
+    for (size_t l = 0; l < lanes; ++l) {
+        randoms.emplace_back(new RandomDevice());
+        cpus.emplace_back(new cpu());
+        cpus.back()->attachDevice(randoms.back()->device());
+        cpus.back()->loadAt0600AndSetReset(program);
+        cpus.back()->reset();
+    }
+    t0 = now();
+    for (size_t l = 0; l < lanes; ++l) cpus[l]->run(BUDGET);
+    double tCpu = now() - t0;
+
+    double cycles = (double)BUDGET * lanes;
+    std::printf("%-14s %6zu lanes  batch %8.1f Mcycles/s (%6.1f lanes/step, %5zu private pages)  cpu %8.1f Mcycles/s\n",
+                name, lanes, cycles / tBatch / 1e6, (double)batch.laneInstructions() / batch.steps(),
+                batch.privatePages(), cycles / tCpu / 1e6);
+}
+
+} // namespace
+
+int main() {
+    const size_t sizes[] = { 64, 1024, 4096 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        compare("register loop", registerLoop, sizes[i]);
+        compare("branchy loop", branchyLoop, sizes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Memory bus benchmark: cpu::read()/write() through the page table against
+// plain indexing into a 64 KiB array, plus a RAM-heavy guest loop with and
+// without devices mapped. Build with `make bench`.
+#include "cpu.h"
+#include "devices.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+
+const int ROUNDS = 5;
+const int SWEEPS = 2000; // passes over the 64 KiB address space
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Best-of-ROUNDS wall time of fn().
+template <typename F>
+double best(F fn) {
+    double result = 1e30;
+    for (int i = 0; i < ROUNDS; ++i) {
+        double t0 = now();
+        fn();
+        double t = now() - t0;
+        if (t < result) result = t;
+    }
+    return result;
+}
+
+volatile unsigned sink;
+
+void report(const char* name, double seconds, double accesses) {
+    std::printf("%-28s %7.3f ns/access\n", name, seconds * 1e9 / accesses);
+}
+
+// Sums memory while writing a running value back, so the accesses cannot be
+// vectorised away.
+template <typename Read, typename Write>
+void sweep(Read read, Write write) {
+    unsigned sum = 0;
+    for (int s = 0; s < SWEEPS; ++s) {
+        for (unsigned a = 0; a < 0x10000; ++a) {
+            sum += read((Word)a);
+            write((Word)(a ^ 0x5555), (Byte)sum);
+        }
+    }
+    sink = sum;
+}
+
+// LDX #0 / LDY #0 / CLC / LDA $10,X / ADC #3 / STA $10,X / STA $0300,Y /
+// INX / INY / BNE / JMP $0600: zero-page and absolute traffic only.
+const std::vector<Byte> ramLoop = {
+    0xA2, 0x00, 0xA0, 0x00, 0x18, 0xB5, 0x10, 0x69, 0x03, 0x95, 0x10, 0x99,
+    0x00, 0x03, 0xE8, 0xC8, 0xD0, 0xF2, 0x4C, 0x00, 0x06
+};
+
+double guest(bool devices, bool blocks) {
+    const uint64_t budget = 50000000;
+    RandomDevice random;
+    KeyboardDevice keys;
+    return best([&]() {
+        std::unique_ptr<cpu> c(new cpu);
+        if (devices) {
+            c->attachDevice(random.device());
+            c->attachDevice(keys.device());
+        }
+        c->loadAt0600AndSetReset(ramLoop);
+        if (devices) c->mapRom(0xFF, 0xFF);
+        c->reset();
+        if (blocks) {
+            c->run(budget);
+        } else {
+            while (c->cycles < budget) c->execute();
+        }
+    }) / budget;
+}
+
+} // namespace
+
+int main() {
+    const double accesses = 2.0 * SWEEPS * 0x10000;
+
+    std::unique_ptr<Byte[]> raw(new Byte[0x10000]());
+    double tRaw = best([&]() {
+        sweep([&](Word a) { return raw[a]; }, [&](Word a, Byte v) { raw[a] = v; });
+    });
+
+    std::unique_ptr<cpu> c(new cpu);
+    double tBus = best([&]() {
+        sweep([&](Word a) { return c->read(a); }, [&](Word a, Byte v) { c->write(a, v); });
+    });
+
+    report("raw array", tRaw, accesses);
+    report("page table (all RAM)", tBus, accesses);
+
+    std::printf("\nguest RAM loop, ns per emulated cycle\n");
+    std::printf("%-28s %7.3f\n", "execute(), RAM only", guest(false, false) * 1e9);
+    std::printf("%-28s %7.3f\n", "execute(), with devices", guest(true, false) * 1e9);
+    std::printf("%-28s %7.3f\n", "run(), RAM only", guest(false, true) * 1e9);
+    std::printf("%-28s %7.3f\n", "run(), with devices", guest(true, true) * 1e9);
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Parallel exploration of the snake game: every combination of the four
+// direction keys and two random seeds, eight forks deep from the start of
+// the game, scored by the snake's length at $03. Runs with 1, 2, 4, ...
+// threads up to the hardware's; the states found and the best score and path
+// must not depend on the thread count. Build with `make bench`.
+#include "devices.h"
+#include "explore.h"
+#include "snake.h"
+#include <cstdio>
+#include <string>
+#include <thread>
+
+namespace {
+
+const unsigned DEPTH = 8;
+const uint64_t CYCLES = 5000; // between forks, two or three moves
+const uint64_t WARMUP = 1000; // cycles of setup before the root state
+const uint32_t ROOT_SEED = 22; // puts the first apple three cells behind the head
+
+ExploreOptions options(unsigned threads) {
+    ExploreOptions o;
+    o.cycles = CYCLES;
+    o.depth = DEPTH;
+    o.keys = { 'w', 'a', 's', 'd' };
+    o.seeds = { 1, 2 };
+    o.threads = threads;
+    o.score = [](const cpu& c) { return (double)c.peek(0x03); };
+    // Game over is a BRK into zeroed memory: stop forking once PC leaves the program.
+    o.expand = [](const cpu& c) { return c.PC >= 0x0600 && c.PC < 0x0735; };
+    return o;
+}
+
+} // namespace
+
+int main() {
+    cpu c;
+    RandomDevice random(0x00FE, ROOT_SEED);
+    c.attachDevice(random.device());
+    c.loadAt0600AndSetReset(snakeGame());
+    c.reset();
+    c.run(WARMUP);
+    Snapshot root;
+    c.saveState(root);
+
+    unsigned hardware = std::thread::hardware_concurrency();
+    if (!hardware) hardware = 1;
+    double single = 0;
+    for (unsigned threads = 1;; threads *= 2) {
+        if (threads > hardware) threads = hardware;
+        ExploreResult r = explore(root, options(threads));
+        const double rate = r.states / r.seconds;
+        if (threads == 1) single = rate;
+        std::string path;
+        for (size_t i = 0; i < r.bestPath.size(); ++i) path += std::string(1, (char)r.bestPath[i].key) + std::to_string(r.bestPath[i].seed);
+        std::printf("%3u threads  %7llu states  %6llu duplicates  %7.0f states/s  %7.1f Mcycles/s  x%.2f  "
+                    "%5llu steals  best %.0f by %s\n",
+                    threads, (unsigned long long)r.states, (unsigned long long)r.duplicates, rate,
+                    r.cycles / r.seconds / 1e6, rate / single, (unsigned long long)r.steals, r.bestScore,
+                    path.c_str());
+        if (threads == hardware) break;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Flag-heavy guest loops: multi-byte arithmetic, shifts and rotates, and
+// compare-and-branch chains, in Mcycles/s through execute(), the run()
+// interpreter and the block cache. Nearly every instruction here sets N and
+// Z, so this is where lazy flag evaluation shows. Build with `make bench`.
+#include "cpu.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const int ROUNDS = 5;
+const uint64_t BUDGET = 100000000; // cycles per measurement
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Program {
+    const char* name;
+    std::vector<Byte> code;
+};
+
+const Program programs[] = {
+    // LDX #0 / CLC / LDA $10 / ADC #$37 / STA $10 / LDA $11 / ADC #0 /
+    // STA $11 / SEC / LDA $12 / SBC $10 / STA $12 / DEX / BNE / JMP $0600
+    { "16-bit add/subtract", {
+        0xA2, 0x00, 0x18, 0xA5, 0x10, 0x69, 0x37, 0x85, 0x10, 0xA5, 0x11, 0x69, 0x00, 0x85,
+        0x11, 0x38, 0xA5, 0x12, 0xE5, 0x10, 0x85, 0x12, 0xCA, 0xD0, 0xE9, 0x4C, 0x00, 0x06 } },
+    // LDY #0 / LDA $20 / ASL A / ROL $21 / LSR A / ROR $22 / EOR #$A5 /
+    // STA $20 / AND #$0F / ORA $23 / STA $23 / DEY / BNE / JMP $0600
+    { "shift/rotate/logic", {
+        0xA0, 0x00, 0xA5, 0x20, 0x0A, 0x26, 0x21, 0x4A, 0x66, 0x22, 0x49, 0xA5, 0x85, 0x20,
+        0x29, 0x0F, 0x05, 0x23, 0x85, 0x23, 0x88, 0xD0, 0xEB, 0x4C, 0x00, 0x06 } },
+    // LDX #0 / TXA / CMP #$80 / BCS +2 / INC $30 / CPX #$40 / BNE +2 /
+    // INC $31 / BIT $30 / BPL +2 / INC $32 / INX / BNE / JMP $0600
+    { "compare/branch", {
+        0xA2, 0x00, 0x8A, 0xC9, 0x80, 0xB0, 0x02, 0xE6, 0x30, 0xE0, 0x40, 0xD0, 0x02, 0xE6,
+        0x31, 0x24, 0x30, 0x10, 0x02, 0xE6, 0x32, 0xE8, 0xD0, 0xEA, 0x4C, 0x00, 0x06 } },
+};
+
+enum Mode { Execute, Interpreter, Blocks };
+
+// Best-of-ROUNDS throughput in Mcycles/s.
+double measure(const Program& program, Mode mode) {
+    double result = 0;
+    for (int i = 0; i < ROUNDS; ++i) {
+        cpu c;
+        c.loadAt0600AndSetReset(program.code);
+        c.reset();
+        c.setBlockCacheEnabled(mode == Blocks);
+        double t0 = now();
+        if (mode == Execute) {
+            while (c.cycles < BUDGET) c.execute();
+        } else {
+            c.run(BUDGET);
+        }
+        double rate = c.cycles / (now() - t0) / 1e6;
+        if (rate > result) result = rate;
+    }
+    return result;
+}
+
+} // namespace
+
+int main() {
+    std::printf("%-22s %12s %12s %12s\n", "Mcycles/s", "execute()", "interpreter", "blocks");
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); ++i) {
+        const Program& p = programs[i];
+        std::printf("%-22s %12.1f %12.1f %12.1f\n", p.name, measure(p, Execute), measure(p, Interpreter),
+                    measure(p, Blocks));
+    }
+    return 0;
+}
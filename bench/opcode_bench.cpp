@@ -0,0 +1,283 @@
+// Per-opcode throughput: every documented opcode, run as a loop of 64
+// copies of itself, through the plain interpreter, the block cache and the
+// JIT, in ns per instruction; then MIPS and the geometric mean over all of
+// them. RTS and RTI are only measured paired with JSR and BRK.
+//
+//   opcode_bench [--baseline FILE] [--save FILE] [--tolerance FRACTION]
+//
+// --baseline compares against a saved run and exits with status 1 when the
+// geometric mean of an engine is more than FRACTION (default 0.25) slower,
+// or any single opcode is still three times as slow when measured again:
+// one opcode alone is too noisy to hold to FRACTION, and JIT branches swing
+// by more than 2x from one process to the next. Baselines only mean something on the host and DISPATCH
+// mode they were saved with.
+// `make bench` runs it against bench/baseline.txt; `make bench-baseline`
+// saves a new one.
+#include "cpu.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int ROUNDS = 5;
+const int RETRIES = 2;        // re-measurements of an opcode that looks SLOWDOWN times as slow
+const double SLOWDOWN = 3;
+const int COPIES = 64;
+const uint64_t BUDGET = 2000000; // cycles per measurement
+const Word CODE = 0x1000;
+const Word DATA = 0x3000;    // absolute operands; every zero page pointer points here too
+const Word POINTERS = 0x4000; // JMP (ind) targets
+const Word SUBROUTINE = 0x5000;
+const Word HANDLER = 0x5100;
+
+#if CPU_DISPATCH == CPU_DISPATCH_TABLE
+const char* const DISPATCH = "TABLE";
+#elif CPU_DISPATCH == CPU_DISPATCH_SWITCH
+const char* const DISPATCH = "SWITCH";
+#else
+const char* const DISPATCH = "THREADED";
+#endif
+
+enum Engine { Interpreter, Blocks, Compiled, ENGINES };
+const char* const ENGINE_NAMES[ENGINES] = { "interpreter", "blocks", "jit" };
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "LDA abs,X"
+std::string form(Byte opcode) {
+    std::string text = cpu::mnemonic(opcode);
+    switch (cpu::addressingMode(opcode)) {
+        case cpu::Immediate:   return text + " #imm";
+        case cpu::ZeroPage:    return text + " zp";
+        case cpu::ZeroPageX:   return text + " zp,X";
+        case cpu::ZeroPageY:   return text + " zp,Y";
+        case cpu::Absolute:    return text + " abs";
+        case cpu::AbsoluteX:   return text + " abs,X";
+        case cpu::AbsoluteY:   return text + " abs,Y";
+        case cpu::Indirect:    return text + " (ind)";
+        case cpu::IndirectX:   return text + " (zp,X)";
+        case cpu::IndirectY:   return text + " (zp),Y";
+        case cpu::Accumulator: return text + " A";
+        case cpu::Relative:    return text + " rel";
+        default:               return text;
+    }
+}
+
+// A machine looping over COPIES of `opcode` followed by JMP back. Operands
+// stay off the code and stack pages and branches fall through either way,
+// so every copy runs on every pass.
+void setUp(cpu& c, Byte opcode) {
+    for (int zp = 0; zp < 0x80; ++zp) c.poke((Word)zp, (DATA >> ((zp & 1) * 8)) & 0xFF);
+    c.poke(0xFFFE, HANDLER & 0xFF);
+    c.poke(0xFFFF, HANDLER >> 8);
+    c.poke(SUBROUTINE, 0x60);  // RTS
+    c.poke(HANDLER, 0x40);     // RTI
+
+    Word pc = CODE;
+    for (int i = 0; i < COPIES; ++i) {
+        const Word next = pc + (opcode == 0x00 ? 2 : cpu::instructionLength(opcode)); // BRK skips a byte
+        Word operand = 0;
+        switch (cpu::addressingMode(opcode)) {
+            case cpu::Immediate:   operand = 0x55; break;
+            case cpu::ZeroPage:
+            case cpu::ZeroPageX:
+            case cpu::ZeroPageY:   operand = 0x80; break;
+            case cpu::IndirectX:
+            case cpu::IndirectY:   operand = 0x40; break;
+            case cpu::Relative:    operand = 0; break;
+            case cpu::Indirect:
+                operand = POINTERS + 2 * i;
+                c.poke(operand, next & 0xFF);
+                c.poke(operand + 1, next >> 8);
+                break;
+            default:
+                operand = opcode == 0x4C ? next : opcode == 0x20 ? SUBROUTINE : DATA;
+                break;
+        }
+        c.poke(pc, opcode);
+        if (next - pc > 1) c.poke(pc + 1, operand & 0xFF);
+        if (next - pc > 2) c.poke(pc + 2, operand >> 8);
+        pc = next;
+    }
+    c.poke(pc, 0x4C);
+    c.poke(pc + 1, CODE & 0xFF);
+    c.poke(pc + 2, CODE >> 8);
+    c.PC = CODE;
+    c.SP = 0xFF;
+    c.X = c.Y = 1;
+    c.P = 0x20;
+}
+
+// Best-of-ROUNDS ns per instruction, the closing JMP included. The first
+// pass warms the block cache and the JIT.
+double measure(Byte opcode, Engine engine, uint64_t& instructions, double& seconds) {
+    double best = 1e30;
+    for (int r = 0; r <= ROUNDS; ++r) {
+        cpu c;
+        setUp(c, opcode);
+        c.setBlockCacheEnabled(engine != Interpreter);
+        c.setJitEnabled(engine == Compiled);
+        c.run(BUDGET / 10);
+        const uint64_t before = c.instructions;
+        const double t0 = now();
+        c.run(BUDGET);
+        const double t = now() - t0;
+        if (r == 0) continue;
+        const double ns = t * 1e9 / (c.instructions - before);
+        if (ns < best) {
+            best = ns;
+            instructions = c.instructions - before;
+            seconds = t;
+        }
+    }
+    return best;
+}
+
+struct Row {
+    Byte opcode;
+    double ns[ENGINES]; // 0 where not measured
+};
+
+bool readBaseline(const char* path, std::map<int, Row>& rows) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string code;
+        Row row;
+        fields >> code;
+        row.opcode = (Byte)std::strtoul(code.c_str(), nullptr, 16);
+        for (int e = 0; e < ENGINES; ++e) {
+            if (!(fields >> row.ns[e])) row.ns[e] = 0;
+        }
+        rows[row.opcode] = row;
+    }
+    return true;
+}
+
+void writeBaseline(const char* path, const std::vector<Row>& rows) {
+    std::ofstream out(path);
+    out << "# opcode_bench baseline (DISPATCH=" << DISPATCH << "): ns per instruction, 0 = not measured\n";
+    out << "# opcode interpreter blocks jit\n";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        char line[64];
+        std::snprintf(line, sizeof(line), "%02X %.3f %.3f %.3f\n", rows[i].opcode, rows[i].ns[0], rows[i].ns[1],
+                      rows[i].ns[2]);
+        out << line;
+    }
+}
+
+double geometricMean(const std::vector<Row>& rows, int engine, const std::map<int, Row>* only = nullptr) {
+    double sum = 0;
+    int count = 0;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (!rows[i].ns[engine]) continue;
+        if (only) {
+            std::map<int, Row>::const_iterator it = only->find(rows[i].opcode);
+            if (it == only->end() || !it->second.ns[engine]) continue;
+        }
+        sum += std::log(rows[i].ns[engine]);
+        ++count;
+    }
+    return count ? std::exp(sum / count) : 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const char* baselinePath = nullptr;
+    const char* savePath = nullptr;
+    double tolerance = 0.25;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--baseline") && i + 1 < argc) baselinePath = argv[++i];
+        else if (!std::strcmp(argv[i], "--save") && i + 1 < argc) savePath = argv[++i];
+        else if (!std::strcmp(argv[i], "--tolerance") && i + 1 < argc) tolerance = std::atof(argv[++i]);
+        else {
+            std::fprintf(stderr, "usage: %s [--baseline FILE] [--save FILE] [--tolerance FRACTION]\n", argv[0]);
+            return 2;
+        }
+    }
+    const int engines = cpu::jitSupported() ? ENGINES : Compiled;
+
+    std::printf("DISPATCH=%s, ns per instruction\n", DISPATCH);
+    std::printf("%-3s %-14s %12s %12s %12s\n", "op", "instruction", "interpreter", "blocks", "jit");
+    std::vector<Row> rows;
+    uint64_t instructions[ENGINES] = {};
+    double seconds[ENGINES] = {};
+    for (int opcode = 0; opcode < 256; ++opcode) {
+        if (!std::strcmp(cpu::mnemonic((Byte)opcode), "UNK") || opcode == 0x40 || opcode == 0x60) continue;
+        Row row = { (Byte)opcode, { 0, 0, 0 } };
+        for (int e = 0; e < engines; ++e) {
+            uint64_t n = 0;
+            double t = 0;
+            row.ns[e] = measure((Byte)opcode, (Engine)e, n, t);
+            instructions[e] += n;
+            seconds[e] += t;
+        }
+        rows.push_back(row);
+        const std::string name = opcode == 0x20 ? "JSR abs + RTS" : opcode == 0x00 ? "BRK + RTI" : form((Byte)opcode);
+        std::printf("%02X  %-14s %12.2f %12.2f", opcode, name.c_str(), row.ns[0], row.ns[1]);
+        if (engines > Compiled) std::printf(" %12.2f", row.ns[2]);
+        std::printf("\n");
+    }
+    for (int e = 0; e < engines; ++e) {
+        std::printf("%-12s %8.1f MIPS  geometric mean %.2f ns/instruction\n", ENGINE_NAMES[e],
+                    instructions[e] / seconds[e] / 1e6, geometricMean(rows, e));
+    }
+
+    int status = 0;
+    if (baselinePath) {
+        std::map<int, Row> base;
+        if (!readBaseline(baselinePath, base)) {
+            std::printf("no baseline at %s; save one with --save\n", baselinePath);
+        } else {
+            std::vector<Row> saved;
+            for (std::map<int, Row>::const_iterator it = base.begin(); it != base.end(); ++it) saved.push_back(it->second);
+            std::map<int, Row> current;
+            for (size_t i = 0; i < rows.size(); ++i) current[rows[i].opcode] = rows[i];
+            for (int e = 0; e < engines; ++e) {
+                // An opcode only counts as a regression if it still is when measured again.
+                for (size_t i = 0; i < rows.size(); ++i) {
+                    std::map<int, Row>::const_iterator it = base.find(rows[i].opcode);
+                    if (it == base.end() || !it->second.ns[e] || !rows[i].ns[e]) continue;
+                    for (int retry = 0; retry < RETRIES && rows[i].ns[e] > it->second.ns[e] * SLOWDOWN; ++retry) {
+                        uint64_t n = 0;
+                        double t = 0;
+                        rows[i].ns[e] = std::min(rows[i].ns[e], measure(rows[i].opcode, (Engine)e, n, t));
+                    }
+                    if (rows[i].ns[e] > it->second.ns[e] * SLOWDOWN) {
+                        std::printf("%-12s %02X %-14s %.2f ns against %.2f  REGRESSION\n", ENGINE_NAMES[e],
+                                    rows[i].opcode, form(rows[i].opcode).c_str(), rows[i].ns[e], it->second.ns[e]);
+                        status = 1;
+                    }
+                }
+                // Over the opcodes both runs measured.
+                const double before = geometricMean(saved, e, &current);
+                const double after = geometricMean(rows, e, &base);
+                if (!before) continue;
+                const bool regressed = after > before * (1 + tolerance);
+                std::printf("%-12s %.2f ns/instruction against %.2f in the baseline (%+.1f%%)%s\n", ENGINE_NAMES[e],
+                            after, before, (after / before - 1) * 100, regressed ? "  REGRESSION" : "");
+                if (regressed) status = 1;
+            }
+        }
+    }
+    if (savePath) {
+        writeBaseline(savePath, rows);
+        std::printf("baseline saved to %s\n", savePath);
+    }
+    return status;
+}
@@ -0,0 +1,154 @@
+// Cost of standing up many machines: construction plus program load, the
+// pages each one ends up owning after a short run, reuse through CpuPool,
+// and loading a ROM file with and without the parsed image cache. Build
+// with `make bench`.
+#include "cpu.h"
+#include "loader.h"
+#include "pool.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const size_t MACHINES = 10000;
+const uint64_t BUDGET = 2000; // cycles each machine runs after loading
+
+// LDX #0 / TXA / STA $10,X / STA $0300,X / INX / CPX #$20 / BNE / JMP $0600:
+// writes the zero page and page 3, leaving the rest of memory shared.
+const std::vector<Byte> program = {
+    0xA2, 0x00, 0x8A, 0x95, 0x10, 0x9D, 0x00, 0x03, 0xE8, 0xE0, 0x20, 0xD0, 0xF5, 0x4C, 0x00, 0x06
+};
+
+void boot(cpu& c) {
+    c.loadAt0600AndSetReset(program);
+    c.mapRom(0xFF, 0xFF);
+    c.reset();
+}
+
+void report(const char* name, double seconds) {
+    std::printf("%-32s %8.2f ms  (%.2f us/machine)\n", name, seconds * 1e3, seconds * 1e6 / MACHINES);
+}
+
+// The program at $0600 plus an 8 KiB ROM of filler at $E000, as Intel HEX
+// with 32-byte records or as a raw 64 KiB image.
+std::vector<Byte> romImage() {
+    std::vector<Byte> memory(0x10000);
+    std::copy(program.begin(), program.end(), memory.begin() + 0x0600);
+    for (size_t a = 0xE000; a < 0x10000; ++a) memory[a] = (Byte)(a * 7);
+    memory[0xFFFC] = 0x00;
+    memory[0xFFFD] = 0x06;
+    return memory;
+}
+
+void writeHex(const std::string& path, const std::vector<Byte>& memory) {
+    std::ofstream out(path);
+    for (size_t a = 0; a < memory.size(); a += 32) {
+        if (a >= 0x0600 + program.size() && a < 0xE000) continue;
+        char line[128];
+        int n = std::snprintf(line, sizeof(line), ":20%04X00", (unsigned)a);
+        Byte sum = 0x20 + (a >> 8) + (a & 0xFF);
+        for (size_t i = 0; i < 32; ++i) {
+            n += std::snprintf(line + n, sizeof(line) - n, "%02X", memory[a + i]);
+            sum += memory[a + i];
+        }
+        std::snprintf(line + n, sizeof(line) - n, "%02X\n", (Byte)-sum);
+        out << line;
+    }
+    out << ":00000001FF\n";
+}
+
+void openMachines(CpuPool& pool, const char* name, const std::string& path, bool cached) {
+    std::vector<CpuPool::Handle> handles;
+    std::string error;
+    clearRomCache();
+    const double t0 = now();
+    for (size_t i = 0; i < MACHINES; ++i) {
+        if (!cached) clearRomCache();
+        std::shared_ptr<const RomImage> rom = openRom(path, RomOptions(), error);
+        if (!rom) {
+            std::printf("%s\n", error.c_str());
+            return;
+        }
+        handles.push_back(pool.acquire());
+        handles.back()->loadImage(*rom);
+        handles.back()->reset();
+    }
+    report(name, now() - t0);
+}
+
+size_t privatePages(const std::vector<cpu*>& machines) {
+    size_t pages = 0;
+    for (size_t i = 0; i < machines.size(); ++i) pages += machines[i]->privatePages();
+    return pages;
+}
+
+} // namespace
+
+int main() {
+    std::printf("%zu machines, sizeof(cpu) = %zu bytes\n\n", MACHINES, sizeof(cpu));
+
+    // Baseline: what a private 64 KiB image per machine costs to set up.
+    double t0 = now();
+    std::vector<std::unique_ptr<Byte[]> > images;
+    for (size_t i = 0; i < MACHINES; ++i) images.emplace_back(new Byte[0x10000]());
+    report("64 KiB image per machine", now() - t0);
+    images.clear();
+
+    std::vector<std::unique_ptr<cpu> > owned;
+    std::vector<cpu*> machines;
+    t0 = now();
+    for (size_t i = 0; i < MACHINES; ++i) {
+        owned.emplace_back(new cpu);
+        boot(*owned.back());
+        machines.push_back(owned.back().get());
+    }
+    report("new cpu + load", now() - t0);
+    std::printf("%-32s %8zu pages after load\n", "", privatePages(machines));
+    t0 = now();
+    for (size_t i = 0; i < MACHINES; ++i) machines[i]->run(BUDGET);
+    report("run", now() - t0);
+    std::printf("%-32s %8zu pages after run (%.1f per machine)\n", "", privatePages(machines),
+                (double)privatePages(machines) / MACHINES);
+    owned.clear();
+    machines.clear();
+
+    CpuPool pool;
+    std::vector<CpuPool::Handle> handles;
+    for (int round = 0; round < 2; ++round) {
+        t0 = now();
+        for (size_t i = 0; i < MACHINES; ++i) {
+            handles.push_back(pool.acquire());
+            boot(*handles.back());
+        }
+        report(round ? "pool acquire + load (reused)" : "pool acquire + load (fresh)", now() - t0);
+        for (size_t i = 0; i < MACHINES; ++i) handles[i]->run(BUDGET);
+        t0 = now();
+        handles.clear();
+        report("pool release", now() - t0);
+    }
+    std::printf("%-32s %8zu machines allocated\n", "", pool.allocated());
+
+    const std::string base = "/tmp/startup_bench." + std::to_string(getpid());
+    const std::vector<Byte> memory = romImage();
+    writeHex(base + ".hex", memory);
+    std::ofstream(base + ".bin", std::ios::binary).write(reinterpret_cast<const char*>(memory.data()), memory.size());
+    std::string error;
+    std::shared_ptr<const RomImage> raw = openRom(base + ".bin", RomOptions(), error);
+    openMachines(pool, "HEX file, parsed each time", base + ".hex", false);
+    openMachines(pool, "HEX file, cached", base + ".hex", true);
+    openMachines(pool, "raw file, mapped each time", base + ".bin", false);
+    openMachines(pool, "raw file, cached", base + ".bin", true);
+    if (raw) std::printf("%-32s %8zu of 256 pages mapped from the raw file\n", "", raw->mappedPages);
+    std::remove((base + ".hex").c_str());
+    std::remove((base + ".bin").c_str());
+    return 0;
+}
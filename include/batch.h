@@ -0,0 +1,246 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cpu.h"
+#include "snapshot.h"
+#include <deque>
+#include <vector>
+
+// Key press scheduled for one lane: from `cycle` on, reads of the keyboard
+// address return `key` (until the guest or a later input overwrites it).
+struct BatchInput {
+    uint64_t cycle;
+    Byte key;
+};
+
+// Runs many copies of one program in lockstep. Registers live in one array
+// per register (struct of arrays) and every step executes one instruction
+// for all lanes sitting at the same PC, so register-only instructions
+// compile to vector loops. Lanes that diverge are regrouped by PC: each
+// step runs the lanes queued at the lowest PC, which lets branches that
+// skip ahead wait for the others and reconverge at the join.
+//
+// Memory is a shared image plus per-lane copy-on-write pages, so a lane
+// costs its page table and the pages it has written. Each lane has its own
+// random source at $00FE and keyboard latch at $00FF, matching
+// RandomDevice and KeyboardDevice; nothing else is memory-mapped.
+class BatchCpu {
+public:
+    static const Word RANDOM_ADDRESS = 0x00FE;
+    static const Word KEY_ADDRESS = 0x00FF;
+
+    explicit BatchCpu(size_t lanes);
+
+    size_t lanes() const { return count; }
+
+    // Shared image, as in cpu. Call reset() afterwards to pick it up.
+    void loadAt0600AndSetReset(const std::vector<Byte>& program);
+    void loadImage(const RomImage& image); // loader.h; maps its ROM segments
+    void mapRom(Byte firstPage, Byte lastPage);
+
+    // Every lane back to the shared image with registers from the reset
+    // vector and zero cycles. Random seeds are kept; input schedules restart.
+    void reset();
+
+    void seedRandom(size_t lane, uint32_t seed);
+    void setInputs(size_t lane, const std::vector<BatchInput>& inputs); // sorted by cycle
+
+    // Every lane executes whole instructions until it has spent at least
+    // cycleBudget more cycles. Returns the number of lane-instructions.
+    uint64_t run(uint64_t cycleBudget);
+
+    struct LaneState {
+        Word PC;
+        Byte SP, A, X, Y, P;
+        uint64_t cycles;
+    };
+    LaneState lane(size_t lane) const;
+    Byte peek(size_t lane, Word address) const; // backing memory, no devices
+    size_t privatePages() const { return pool.size(); }
+
+    // Lockstep efficiency: lane-instructions per step, at most lanes().
+    uint64_t steps() const { return stepCount; }
+    uint64_t laneInstructions() const { return laneCount; }
+
+    // The lane random source: xorshift32 mapped to 1..15 like RandomDevice.
+    static Byte random(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (Byte)(1 + state % 15);
+    }
+
+private:
+    // Register arrays, taken into locals once per step so the kernels see
+    // unaliased pointers and the compiler can vectorise them.
+    struct Regs {
+        Word* __restrict PC;
+        Byte* __restrict A;
+        Byte* __restrict X;
+        Byte* __restrict Y;
+        Byte* __restrict SP;
+        Byte* __restrict P;
+        uint64_t* __restrict cycles;
+    };
+
+    // The lanes taking part in a step: every lane, or a list of indices.
+    struct AllLanes {
+        size_t n;
+        size_t operator[](size_t i) const { return i; }
+    };
+    struct SomeLanes {
+        const uint32_t* index;
+        size_t n;
+        size_t operator[](size_t i) const { return index[i]; }
+    };
+
+    size_t count;
+    std::vector<Word> PC;
+    std::vector<Byte> A, X, Y, SP, P;
+    std::vector<uint64_t> cycles;
+    std::vector<uint64_t> target;
+
+    std::vector<uint32_t> rng;
+    std::vector<Byte> key;
+    std::vector<std::vector<BatchInput> > inputs;
+    std::vector<size_t> nextInput;
+
+    // pages[page * count + lane]; a lane shares image[page] until it writes.
+    MemoryPage image[256];
+    bool rom[256];
+    std::vector<Byte*> pages;
+    std::deque<MemoryPage> pool;
+    uint32_t ownedLanes[256]; // lanes holding a private copy of each page
+
+    // Every lane sees the image's bytes for an instruction starting at pc.
+    bool codeShared(Word pc) const { return !ownedLanes[pc >> 8] && !ownedLanes[(Word)(pc + 2) >> 8]; }
+
+    // Unfinished lanes queued by PC: one linked list per address, plus a
+    // two-level bitmap of the non-empty lists to find the lowest PC fast.
+    std::vector<uint32_t> head;
+    std::vector<uint32_t> link;
+    uint64_t queued[1024];
+    uint64_t queuedWords[16];
+    std::vector<uint32_t> group;
+    uint64_t stepCount;
+    uint64_t laneCount;
+
+    Regs regs();
+    void enqueue(uint32_t lane, Word pc);
+    int lowestQueued() const;
+    bool step(Regs r);
+    void runConverged(Regs r, Word pc);
+    uint64_t remainingBudget(const Regs& r) const;
+    Word decodeOperand(size_t lane, Word pc, Byte opcode) const;
+    template <typename Lanes> void execute(Regs r, const Lanes& g, Byte opcode, Word operand, Word next);
+
+    Byte fetchCode(size_t lane, Word address) const { return pages[(address >> 8) * count + lane][address & 0xFF]; }
+    void pollInput(size_t lane);
+    Byte loadDevice(size_t lane, Word address);
+    void storeSlow(size_t lane, Word address, Byte value);
+
+    CPU_ALWAYS_INLINE Byte load(size_t lane, Word address) {
+        if (address == RANDOM_ADDRESS || address == KEY_ADDRESS) return loadDevice(lane, address);
+        return fetchCode(lane, address);
+    }
+
+    // Pages the lane shares with the image (including ROM) and the device
+    // addresses take the slow path.
+    CPU_ALWAYS_INLINE void store(size_t lane, Word address, Byte value) {
+        Byte* data = pages[(address >> 8) * count + lane];
+        if (data != image[address >> 8].bytes && address != RANDOM_ADDRESS && address != KEY_ADDRESS) {
+            data[address & 0xFF] = value;
+        } else {
+            storeSlow(lane, address, value);
+        }
+    }
+
+    template <cpu::AddressingMode mode, bool pagePenalty = false> Word address(const Regs& r, size_t l, Word operand);
+    template <cpu::AddressingMode mode> Byte fetch(const Regs& r, size_t l, Word operand);
+
+    static void setZN(const Regs& r, size_t l, Byte value);
+    static void op_ADC(const Regs& r, size_t l, Byte value);
+    static void op_SBC(const Regs& r, size_t l, Byte value);
+    static void op_AND(const Regs& r, size_t l, Byte value);
+    static void op_EOR(const Regs& r, size_t l, Byte value);
+    static void op_ORA(const Regs& r, size_t l, Byte value);
+    static void op_CMP(const Regs& r, size_t l, Byte value);
+    static void op_CPX(const Regs& r, size_t l, Byte value);
+    static void op_CPY(const Regs& r, size_t l, Byte value);
+    static void op_BIT(const Regs& r, size_t l, Byte value);
+    static Byte op_ASL(const Regs& r, size_t l, Byte value);
+    static Byte op_LSR(const Regs& r, size_t l, Byte value);
+    static Byte op_ROL(const Regs& r, size_t l, Byte value);
+    static Byte op_ROR(const Regs& r, size_t l, Byte value);
+    static Byte op_INC(const Regs& r, size_t l, Byte value);
+    static Byte op_DEC(const Regs& r, size_t l, Byte value);
+
+    typedef void (*ReadOp)(const Regs&, size_t, Byte);
+    typedef Byte (*ModifyOp)(const Regs&, size_t, Byte);
+    template <ReadOp op, cpu::AddressingMode mode, typename Lanes> void ins_read(const Regs& r, const Lanes& g, Word operand);
+    template <ModifyOp op, cpu::AddressingMode mode, typename Lanes> void ins_rmw(const Regs& r, const Lanes& g, Word operand);
+    template <Byte flag, bool set, typename Lanes> void ins_branch(const Regs& r, const Lanes& g, Word target);
+    template <Byte flag, bool set, typename Lanes> void ins_flag(const Regs& r, const Lanes& g);
+
+    // One kernel per mnemonic, as in cpu; the operand is uniform across the
+    // group, effective addresses are per lane.
+    template <cpu::AddressingMode mode, typename Lanes> void ins_LDA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_LDX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_LDY(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_STA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_STX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_STY(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_TAX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_TAY(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_TSX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_TXA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_TXS(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_TYA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_PHA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_PHP(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_PLA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_PLP(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_ADC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_SBC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CMP(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CPX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CPY(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_AND(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_EOR(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_ORA(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BIT(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_INC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_INX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_INY(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_DEC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_DEX(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_DEY(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_ASL(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_LSR(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_ROL(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_ROR(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_JMP(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_JSR(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_RTS(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BCC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BCS(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BEQ(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BMI(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BNE(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BPL(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BVC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BVS(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CLC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CLD(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CLI(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_CLV(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_SEC(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_SED(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_SEI(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_BRK(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_NOP(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_RTI(const Regs& r, const Lanes& g, Word operand);
+    template <cpu::AddressingMode mode, typename Lanes> void ins_UNK(const Regs& r, const Lanes& g, Word operand);
+};
+
+#endif // BATCH_H
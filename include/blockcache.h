@@ -0,0 +1,80 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "cpu.h"
+#include <vector>
+#include <memory>
+
+// One predecoded instruction: the opcode's handler, its operand already read
+// (and for branches already resolved to the target), the address of the next
+// instruction and the base cycle cost. `fused` names the superinstruction
+// (cpu::fusedForms) that runs this op and the next in one handler, 0 if none.
+struct DecodedOp {
+    void (*handler)(cpu&, Word);
+    Word operand;
+    Word next;
+    Byte opcode;
+    Byte cycles;
+    Byte fused;
+};
+
+// Self-loops run() can fast-forward: a countdown of X or Y to zero with
+// nothing else in the body but NOPs and flag sets, or a poll of one address
+// that nothing inside the loop can change.
+enum SpinKind { SpinNone, SpinCountdown, SpinWait };
+
+// A straight-line run of instructions ending at the first branch, jump,
+// call, return or unknown opcode.
+struct Block {
+    Word start;
+    Word end; // address of the last byte of the block
+    bool valid; // cleared when a write invalidates the block
+    std::vector<DecodedOp> ops;
+
+    // Native translation, see jit.h. maxCycles bounds what one native call
+    // can spend so run() only enters it when the whole block fits the budget.
+    void (*native)(cpu*);
+    uint32_t maxCycles;
+    uint32_t hits;
+    bool jitFailed;
+
+    Byte spin;           // SpinKind
+    uint32_t spinCycles; // one iteration that branches back to start
+};
+
+// Translation cache keyed by the block's start PC. Blocks are registered
+// against every page they occupy so a write into a page can drop the code
+// decoded from it.
+class BlockCache {
+public:
+    BlockCache();
+
+    Block* lookup(Word pc) const {
+        const BlockPage* page = blocks[pc >> 8].get();
+        return page ? page->at[pc & 0xFF].get() : nullptr;
+    }
+    Block* insert(std::unique_ptr<Block> block);
+
+    // Drops every block that occupies the given page. Blocks are kept alive
+    // until releaseRetired() so a block that overwrites itself can finish
+    // its current instruction.
+    void invalidatePage(Byte page);
+    void releaseRetired() { retired.clear(); }
+
+    // Non-zero for pages that currently hold decoded code.
+    const Byte* codePages() const { return pageHasCode; }
+
+private:
+    struct BlockPage {
+        std::unique_ptr<Block> at[256];
+    };
+    std::unique_ptr<BlockPage> blocks[256];     // by start PC, one page at a time
+    std::vector<Word> pageBlocks[256];          // block starts per page
+    Byte pageHasCode[256];
+    std::vector<std::unique_ptr<Block>> retired;
+
+    std::unique_ptr<Block>& slot(Word start);
+    void unlinkPage(Byte page, Word start);
+};
+
+#endif // BLOCKCACHE_H
@@ -3,6 +3,33 @@
 
 #include <vector>
 #include <functional>
+#include <memory>
+#include <cstdint>
+#include <string>
+
+// Instruction dispatch strategy, chosen at build time (make DISPATCH=...).
+//   TABLE    - shared std::function table, one lambda per opcode
+//   SWITCH   - one switch over the opcode byte
+//   THREADED - computed goto through a table of label addresses (GCC/Clang)
+#define CPU_DISPATCH_TABLE    0
+#define CPU_DISPATCH_SWITCH   1
+#define CPU_DISPATCH_THREADED 2
+
+#ifndef CPU_DISPATCH
+#if defined(__GNUC__)
+#define CPU_DISPATCH CPU_DISPATCH_THREADED
+#else
+#define CPU_DISPATCH CPU_DISPATCH_SWITCH
+#endif
+#endif
+
+// Forces the bus fast paths and operand decoding inline; the dispatch loops
+// are large enough that GCC otherwise stops inlining them.
+#if defined(__GNUC__)
+#define CPU_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define CPU_ALWAYS_INLINE inline
+#endif
 
 using Word = unsigned short; // 16-bit word type
 using Byte = unsigned char;  // 8-bit byte type
@@ -18,37 +45,320 @@ enum StatusFlags {
     N = 1 << 7  // Negative Flag
 };
 
+class BlockCache;
+struct Block;
+struct DecodedOp;
+class Jit;
+struct Snapshot;
+struct MemoryPage;
+struct RomImage;
+class Tracer;
+class Profiler;
+class Debugger;
+class Scheduler;
+
+// Memory-mapped device claiming [first, last]. The rest of a page that holds
+// a device still behaves as RAM. A device without a read callback only
+// watches writes; its reads stay on the RAM fast path. A pollable device's
+// reads have no side effects and its value only changes through the host or
+// a guest write, so run() may skip a guest loop that does nothing but poll it.
+struct Device {
+    Word first;
+    Word last;
+    std::function<Byte(Word)> read;        // null: reads see RAM
+    std::function<void(Word, Byte)> write; // null: writes are dropped
+    bool pollable = false;
+};
+
 class cpu {
 public:
+    enum AddressingMode {
+        Immediate, ZeroPage, ZeroPageX, ZeroPageY, Absolute, AbsoluteX, AbsoluteY, Indirect, IndirectX, IndirectY, Implied, Accumulator, Relative
+    };
+
     cpu();
+    ~cpu();
+
+    // Returns the machine to its just-constructed state: registers and cycles
+    // zeroed, memory all zero, no ROM, devices, events, pending interrupts,
+    // tracer or profiler. Private page buffers are kept for reuse (see
+    // CpuPool).
+    void clear();
 
     void reset();
+    // Pages written by the loader are shared with every other fresh machine
+    // that loads the same program, and copied only when one of them writes.
     void loadAt0600AndSetReset(const std::vector<Byte>& program);
-    void execute();
+    // A parsed ROM image (loader.h), shared the same way; where a page it
+    // touches has already been written, only the image's own bytes are
+    // copied in. Maps its ROM segments read-only. Call reset() afterwards.
+    void loadImage(const RomImage& image);
+    void execute(); // one instruction; ignores scheduled events and interrupts
+    uint64_t run(uint64_t cycleBudget);
+
+    // True when the last run() ended in a loop that polls memory nothing but
+    // the host can change: no events are pending and the guest is spinning
+    // on RAM or a pollable device. A frontend may sleep until it has input
+    // for the guest instead of running more cycles.
+    bool waitingForHost() const;
+
+    // Cycle-timed events (scheduler.h). run() executes straight up to the
+    // earliest deadline and calls the callback at the first instruction
+    // boundary at or after `cycle`. Callbacks may schedule further events
+    // and raise interrupts. Returns an id for cancelEvent().
+    uint64_t schedule(uint64_t cycle, const std::function<void()>& callback);
+    bool cancelEvent(uint64_t id);
+
+    // Interrupt lines. IRQ is level-triggered: a device holds its line
+    // (0-31) asserted until the guest acknowledges it, and run() enters the
+    // handler at $FFFE whenever a line is asserted and I is clear. NMI is
+    // edge-triggered and enters the handler at $FFFA regardless of I. Raise
+    // them from scheduled events, device callbacks or between run() calls;
+    // inside translated code a line raised by a device read is only seen at
+    // the end of the block.
+    void setIrq(unsigned line, bool asserted);
+    void nmi();
+
+    // run() executes predecoded basic blocks when enabled (the default) and
+    // falls back to the plain interpreter loop otherwise.
+    void setBlockCacheEnabled(bool enabled);
+
+    // Hot blocks are translated to native code when enabled and supported on
+    // this host (x86-64); everything else keeps running in the block cache.
+    void setJitEnabled(bool enabled);
+    static bool jitSupported();
+
+    // The block cache runs common adjacent pairs (LDA # + STA zp, compare +
+    // BNE/BEQ, DEX/DEY + BNE, CLC + ADC, SEC + SBC) as one fused handler.
+    // Counts how often each fused form has run since clear().
+    struct FusionCount {
+        std::string name; // e.g. "CMP #imm; BNE"
+        uint64_t hits;
+    };
+    std::vector<FusionCount> fusionCounts() const;
+
+    // Static description of an opcode byte, taken from opcodes.def.
+    static const char* mnemonic(Byte opcode);
+    static AddressingMode addressingMode(Byte opcode);
+    static Byte baseCycles(Byte opcode);
+    static Byte instructionLength(Byte opcode); // opcode plus operand bytes
+    static std::string disassemble(Word pc, Byte opcode, Byte lo, Byte hi); // e.g. "LDA $0200,X"
+
+    // Streams every instruction run() executes to the tracer (trace.h), or
+    // stops tracing when null. Tracing bypasses the block cache and JIT.
+    void setTracer(Tracer* tracer);
+
+    // Feeds every instruction run() executes to the profiler (profiler.h), or
+    // stops profiling when null. Like tracing, profiling bypasses the block
+    // cache and JIT; with neither attached run() pays nothing for them.
+    void setProfiler(Profiler* profiler);
+
+    // Breakpoints, watchpoints and per-instruction callbacks (debugger.h), or
+    // none when null. Like tracing it bypasses the block cache and JIT. May
+    // be switched while running, e.g. from an event or device callback; the
+    // machine moves between the bare and the instrumented interpreter at the
+    // next instruction boundary with its state untouched.
+    void setDebugger(Debugger* debugger);
+
+    // Memory map. Every page starts as RAM. ROM pages ignore guest writes;
+    // devices are consulted only for the addresses they claim.
+    void mapRom(Byte firstPage, Byte lastPage);
+    bool isRom(Byte page) const { return pageRom[page]; }
+    void attachDevice(const Device& device);
+
+    CPU_ALWAYS_INLINE Byte read(Word address) const {
+        Byte page = address >> 8;
+        Byte offset = address & 0xFF;
+        if (offset < pageReadLimit[page]) return pageData[page][offset];
+        return readSlow(address);
+    }
+
+    CPU_ALWAYS_INLINE void write(Word address, Byte value) {
+        Byte page = address >> 8;
+        Byte offset = address & 0xFF;
+        if (offset < pageWriteLimit[page]) pageData[page][offset] = value;
+        else writeSlow(address, value);
+    }
+
+    // Backing memory, ignoring ROM protection and devices; used by loaders,
+    // debuggers and devices that mirror RAM. Pages start out shared with
+    // other machines, so memory is only reachable through these.
+    Byte peek(Word address) const { return pageData[address >> 8][address & 0xFF]; }
+    void poke(Word address, Byte value);
 
-    Byte read(Word address) const;
-    void write(Word address, Byte value);
+    // Pages this machine holds its own copy of; all others are shared.
+    size_t privatePages() const;
+
+    // Savestates, see snapshot.h. A save shares every page left unchanged
+    // since the previous save or restore; a restore points the pages that
+    // differ from the current memory at the saved copies, copying nothing.
+    // Scheduled events and interrupt lines belong to the devices and are not
+    // part of a savestate.
+    void saveState(Snapshot& state);
+    void loadState(const Snapshot& state);
 
     void setFlag(StatusFlags flag, bool value);
     bool getFlag(StatusFlags flag) const;
 
-    Byte memory[256 * 256]{};
     Word PC;
     Byte SP;
     Byte A, X, Y;
-    Byte P;
+    Byte P; // N and Z are brought up to date when run() hands control back (see zResult)
+
+    uint64_t cycles; // total cycles executed since construction
+
+    // For telemetry, also since construction: instructions run() executed
+    // (counted per block or per slice, never by execute()), and opcodes with
+    // no defined instruction.
+    uint64_t instructions;
+    uint64_t unknownOpcodes;
 
 private:
-    enum AddressingMode {
-        Immediate, ZeroPage, ZeroPageX, ZeroPageY, Absolute, AbsoluteX, AbsoluteY, Indirect, IndirectX, IndirectY, Implied, Accumulator, Relative
+    friend class Jit;
+    friend class Debugger;
+
+    typedef void (*Handler)(cpu&, Word);
+
+    // Static per-opcode description shared by every dispatch path.
+    struct OpInfo {
+        Handler handler;
+        Word (*decode)(cpu&); // reads the operand at PC and advances PC
+        Byte cycles;
+    };
+    static const OpInfo opTable[256];
+
+#if CPU_DISPATCH == CPU_DISPATCH_TABLE
+    static const std::function<void(cpu&)> instructionTable[256];
+#endif
+
+    // Page table. An access whose in-page offset is below the page's limit
+    // goes straight to pageData; everything else (devices, ROM writes, pages
+    // holding decoded code) takes the slow path. Pages with a device keep the
+    // fast path for offsets below the device's first address.
+    Byte* pageData[256];
+    uint16_t pageReadLimit[256];
+    uint16_t pageWriteLimit[256];
+    bool pageRom[256];
+    std::vector<Device> devices;
+
+    // Opcode and operand bytes come straight from the page's backing store;
+    // code is never fetched through a device.
+    Byte fetchCode(Word address) const { return pageData[address >> 8][address & 0xFF]; }
+
+    // Page contents as of the last saveState()/loadState() or load. A clean
+    // page still equals its statePages entry and is write-protected in the
+    // page table, so its first write lands in writeSlow() and marks it dirty.
+    // A shared page has no private copy yet: pageData points into the
+    // immutable statePages entry, and marking it dirty copies it into
+    // ownPages. Private buffers outlive clear() and loadState() for reuse.
+    // A null statePages entry is the all-zero page.
+    std::shared_ptr<const MemoryPage> statePages[256];
+    std::unique_ptr<MemoryPage> ownPages[256];
+    bool pageClean[256];
+    bool pageShared[256];
+
+    void markDirty(Byte page) {
+        if (pageClean[page]) makePrivate(page);
+    }
+    void makePrivate(Byte page);
+    const Byte* stateBytes(Byte page) const;
+    bool loadShared(const std::vector<Byte>& program);
+    bool sharePages(const std::shared_ptr<const MemoryPage>* pages);
+
+    Byte readSlow(Word address) const;
+    void writeSlow(Word address, Byte value);
+    const Device* deviceAt(Word address) const;
+    void refreshPage(Byte page);
+    void flushCode();
+
+    Tracer* tracer;
+    Profiler* profiler;
+    Debugger* debugger;
+    void refreshWatchedPages();
+
+    // The run loops stop at the first instruction boundary at or after
+    // sliceEnd: the budget, the next event, or now when an interrupt has
+    // become takeable.
+    uint64_t sliceEnd;
+    std::unique_ptr<Scheduler> events; // created by the first schedule(), kept by clear()
+    uint32_t irqLines;
+    bool nmiPending;
+
+    // Set by the last run() when it fast-forwarded a wait loop spanning
+    // [waitFirst, waitLast].
+    bool waited;
+    Word waitFirst, waitLast;
+
+    // Lazy N and Z. Inside the run loops nearly every instruction sets both
+    // from its result, so they are kept as the last result rather than
+    // folded into P: Z is set while zResult is zero and N is bit 7 of
+    // nResult (BIT and PLP set them apart). packFlags() folds them into P
+    // whenever a loop returns and before anything reads P as a whole (PHP,
+    // BRK, the JIT, the tracer); unpackFlags() takes them back. C and V
+    // are set eagerly, without branching: carry chains read C straight away.
+    Byte zResult;
+    Byte nResult;
+    void packFlags() { P = (P & ~(N | Z)) | (nResult & N) | (zResult ? 0 : Z); }
+    void unpackFlags() {
+        nResult = P & N;
+        zResult = (P & Z) ? 0 : 1;
+    }
+    bool zero() const { return zResult == 0; }
+    bool negative() const { return (nResult & N) != 0; }
+
+    bool interruptReady() const { return nmiPending || (irqLines && !(P & I)); }
+    // After an instruction that may have cleared I.
+    void pollIrq() {
+        if (irqLines && !(P & I)) sliceEnd = 0;
+    }
+    void interrupt();
+
+    bool blockCacheEnabled;
+    std::unique_ptr<BlockCache> blockCache;
+    const Byte* codePages; // pages holding decoded blocks; writes there are slow
+    std::unique_ptr<Jit> jit;
+
+    void step(); // execute() without the flag handover
+
+    // The interpreter loop is compiled once per hooks policy: BareHooks
+    // folds every hook away, InstrumentedHooks drives the tracer, profiler
+    // and debugger around each instruction.
+    struct BareHooks;
+    struct InstrumentedHooks;
+    template <class Hooks> void interpret();
+    void runBlocks();
+    Block* decodeBlock(Word pc);
+    void findSpin(Block& block) const;
+    void skipSpin(const Block& block);
+    void invalidateCode(Word address);
+
+    template <void (cpu::*fn)(Word)>
+    static void thunk(cpu& c, Word operand) { (c.*fn)(operand); }
+
+    // Superinstructions. Every first half has a fixed cycle cost and no side
+    // effect that could end the slice, so runBlocks() only has to check the
+    // budget before the pair and after it. Entry 0 is unused.
+    struct FusedForm {
+        Byte first;
+        Byte second;
+        void (*run)(cpu&, const DecodedOp*);
     };
+    static const int FUSED_FORMS = 32;
+    static const FusedForm fusedForms[FUSED_FORMS];
+    uint64_t fusedHits[FUSED_FORMS];
+
+    template <void (cpu::*first)(Word), void (cpu::*second)(Word)>
+    static void fuse(cpu& c, const DecodedOp* op);
+    void fusePairs(Block& block) const;
+    template <AddressingMode mode>
+    static Word decode(cpu& c) { return c.operand<mode>(); }
 
-    std::function<void()> instructionTable[256];
+    template <AddressingMode mode> Word operand();
+    template <AddressingMode mode, bool pagePenalty = false> Word getAddress(Word operand);
+    template <AddressingMode mode> Byte fetch(Word operand);
 
-    Word getAddress(AddressingMode mode);
-    Byte fetch(AddressingMode mode);
-    
     void setZN(Byte value);
+    void branch(bool condition, Word target);
 
     void op_ADC(Byte value);
     void op_SBC(Byte value);
@@ -66,13 +376,74 @@ private:
     void op_CPY(Byte value);
     void op_BIT(Byte value);
 
-    template <void (cpu::*op)(Byte)> 
-    void ins_read(AddressingMode mode);
+    template <void (cpu::*op)(Byte), AddressingMode mode>
+    void ins_read(Word operand);
+
+    template <void (cpu::*op)(Byte&), AddressingMode mode>
+    void ins_rmw(Word operand);
 
-    template <void (cpu::*op)(Byte&)>
-    void ins_rmw(AddressingMode mode);
+    // One handler per mnemonic; the addressing mode is fixed per opcode in
+    // opcodes.def, so each instantiation resolves its operand inline. The
+    // operand is the raw immediate/address, or the target for branches, and
+    // PC already points at the next instruction when a handler runs.
+    template <AddressingMode mode> void ins_LDA(Word operand);
+    template <AddressingMode mode> void ins_LDX(Word operand);
+    template <AddressingMode mode> void ins_LDY(Word operand);
+    template <AddressingMode mode> void ins_STA(Word operand);
+    template <AddressingMode mode> void ins_STX(Word operand);
+    template <AddressingMode mode> void ins_STY(Word operand);
+    template <AddressingMode mode> void ins_TAX(Word operand);
+    template <AddressingMode mode> void ins_TAY(Word operand);
+    template <AddressingMode mode> void ins_TSX(Word operand);
+    template <AddressingMode mode> void ins_TXA(Word operand);
+    template <AddressingMode mode> void ins_TXS(Word operand);
+    template <AddressingMode mode> void ins_TYA(Word operand);
+    template <AddressingMode mode> void ins_PHA(Word operand);
+    template <AddressingMode mode> void ins_PHP(Word operand);
+    template <AddressingMode mode> void ins_PLA(Word operand);
+    template <AddressingMode mode> void ins_PLP(Word operand);
+    template <AddressingMode mode> void ins_ADC(Word operand);
+    template <AddressingMode mode> void ins_SBC(Word operand);
+    template <AddressingMode mode> void ins_CMP(Word operand);
+    template <AddressingMode mode> void ins_CPX(Word operand);
+    template <AddressingMode mode> void ins_CPY(Word operand);
+    template <AddressingMode mode> void ins_AND(Word operand);
+    template <AddressingMode mode> void ins_EOR(Word operand);
+    template <AddressingMode mode> void ins_ORA(Word operand);
+    template <AddressingMode mode> void ins_BIT(Word operand);
+    template <AddressingMode mode> void ins_INC(Word operand);
+    template <AddressingMode mode> void ins_INX(Word operand);
+    template <AddressingMode mode> void ins_INY(Word operand);
+    template <AddressingMode mode> void ins_DEC(Word operand);
+    template <AddressingMode mode> void ins_DEX(Word operand);
+    template <AddressingMode mode> void ins_DEY(Word operand);
+    template <AddressingMode mode> void ins_ASL(Word operand);
+    template <AddressingMode mode> void ins_LSR(Word operand);
+    template <AddressingMode mode> void ins_ROL(Word operand);
+    template <AddressingMode mode> void ins_ROR(Word operand);
+    template <AddressingMode mode> void ins_JMP(Word operand);
+    template <AddressingMode mode> void ins_JSR(Word operand);
+    template <AddressingMode mode> void ins_RTS(Word operand);
+    template <AddressingMode mode> void ins_BCC(Word operand);
+    template <AddressingMode mode> void ins_BCS(Word operand);
+    template <AddressingMode mode> void ins_BEQ(Word operand);
+    template <AddressingMode mode> void ins_BMI(Word operand);
+    template <AddressingMode mode> void ins_BNE(Word operand);
+    template <AddressingMode mode> void ins_BPL(Word operand);
+    template <AddressingMode mode> void ins_BVC(Word operand);
+    template <AddressingMode mode> void ins_BVS(Word operand);
+    template <AddressingMode mode> void ins_CLC(Word operand);
+    template <AddressingMode mode> void ins_CLD(Word operand);
+    template <AddressingMode mode> void ins_CLI(Word operand);
+    template <AddressingMode mode> void ins_CLV(Word operand);
+    template <AddressingMode mode> void ins_SEC(Word operand);
+    template <AddressingMode mode> void ins_SED(Word operand);
+    template <AddressingMode mode> void ins_SEI(Word operand);
+    template <AddressingMode mode> void ins_BRK(Word operand);
+    template <AddressingMode mode> void ins_NOP(Word operand);
+    template <AddressingMode mode> void ins_RTI(Word operand);
+    template <AddressingMode mode> void ins_UNK(Word operand);
 
-    void initInstructionTable();
     void opcodeUnknown();
 };
 
@@ -0,0 +1,69 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "cpu.h"
+#include <functional>
+#include <vector>
+
+// Breakpoints, memory watchpoints and a per-instruction callback. Attach with
+// cpu::setDebugger(); run() then uses the instrumented interpreter and
+// returns early, at an instruction boundary, as soon as one of them fires.
+// Detached, it costs run() nothing: the bare interpreter is compiled without
+// hooks, and watched pages only leave the bus fast path while attached.
+class Debugger {
+public:
+    enum Reason { None, Breakpoint, ReadWatch, WriteWatch, Callback };
+
+    // Why the last run() returned early. Breakpoints and the callback stop
+    // before the instruction at `pc`; watchpoints stop after the instruction
+    // at `pc` that touched `address`.
+    struct Stop {
+        Reason reason;
+        Word pc;
+        Word address;
+    };
+
+    Debugger();
+
+    void addBreakpoint(Word pc) { breakpoints[pc] = true; }
+    void removeBreakpoint(Word pc) { breakpoints[pc] = false; }
+
+    // Watches guest reads and/or writes of [first, last].
+    void watch(Word first, Word last, bool reads, bool writes);
+    void clearWatches();
+
+    // Called before every instruction with PC at it; return true to stop.
+    void onInstruction(const std::function<bool(const cpu&)>& callback) { this->callback = callback; }
+
+    bool stopped() const { return last.reason != None; }
+    const Stop& stop() const { return last; }
+
+private:
+    friend class cpu;
+
+    struct Watch {
+        Word first;
+        Word last;
+        bool reads;
+        bool writes;
+    };
+
+    std::vector<bool> breakpoints;
+    std::vector<Watch> watches;
+    std::function<bool(const cpu&)> callback;
+    cpu* machine; // the cpu this is attached to, for refreshing watched pages
+    Stop last;
+    Word current;  // instruction being executed
+    Word resumePC; // a breakpoint or callback stop here is not taken again on resume
+    bool resuming;
+
+    // Page has a watchpoint of that kind, so its accesses take the slow path.
+    bool watchesReads(Byte page) const;
+    bool watchesWrites(Byte page) const;
+
+    void resume(const cpu& c);
+    bool before(const cpu& c);
+    void access(Word address, bool write);
+};
+
+#endif // DEBUGGER_H
@@ -0,0 +1,92 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "cpu.h"
+#include <random>
+
+// Random number source. Every guest read draws a fresh value, so nothing has
+// to be pushed into memory from the host loop. Writes are ignored. The
+// sequence depends only on the seed, on every standard library, so a
+// recorded seed replays it (see replay.h).
+class RandomDevice {
+public:
+    explicit RandomDevice(Word address = 0x00FE); // seeded from std::random_device
+    RandomDevice(Word address, uint32_t seed);
+
+    Device device();
+    Byte next();
+    uint32_t seed() const { return initialSeed; }
+    void reseed(uint32_t seed); // restarts the sequence as if constructed with `seed`
+
+private:
+    Word address;
+    uint32_t initialSeed;
+    std::mt19937 rng;
+};
+
+// Last key pressed, as an ASCII code. The guest may overwrite the latch,
+// e.g. to acknowledge a key. Pollable, so a guest spinning on it costs the
+// host nothing until a key arrives.
+class KeyboardDevice {
+public:
+    explicit KeyboardDevice(Word address = 0x00FF);
+
+    Device device();
+    void press(Byte key) { latch = key; }
+    Byte last() const { return latch; }
+
+private:
+    Word address;
+    Byte latch;
+};
+
+// Interval timer. Every `period` cycles it counts a tick and asserts its IRQ
+// line; a guest read returns the ticks since the previous read (saturating
+// at 255) and acknowledges the interrupt. Writes are ignored. Ticks are
+// scheduled on the cpu's cycle counter, so nothing polls the timer.
+class TimerDevice {
+public:
+    TimerDevice(cpu& c, uint32_t period, Word address = 0x00FD, unsigned line = 0);
+    ~TimerDevice() { stop(); }
+
+    Device device();
+    void start(); // first tick `period` cycles from now
+    void stop();
+
+private:
+    cpu& c;
+    uint32_t period;
+    Word address;
+    unsigned line;
+    Byte ticks;
+    uint64_t event; // 0 while stopped
+
+    void tick(uint64_t due);
+};
+
+// 32x32 screen, one byte per pixel. Watches guest writes to the video region
+// and records which rows changed; reads go straight to RAM.
+class ScreenDevice {
+public:
+    static const int W = 32;
+    static const int H = 32;
+
+    explicit ScreenDevice(cpu& c, Word base = 0x0200);
+
+    Device device();
+
+    // Rows written with a new value since the last call, one bit per row.
+    uint32_t takeDirtyRows();
+    void markAllDirty() { dirtyRows = 0xFFFFFFFFu; } // e.g. after a savestate restore
+    void copyPixels(Byte* out) const; // W * H bytes
+
+    // Display colour of a pixel value as RGB: 0 black, 1 white, else grey.
+    static void color(Byte value, Byte* rgb);
+
+private:
+    cpu& c;
+    Word base;
+    uint32_t dirtyRows;
+};
+
+#endif // DEVICES_H
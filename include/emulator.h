@@ -0,0 +1,125 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include "cpu.h"
+#include "devices.h"
+#include "spsc.h"
+#include "triplebuffer.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct InputLog;
+
+// A completed screen image. dirtyRows covers every row that changed since
+// the last frame the reader actually picked up.
+struct Frame {
+    Byte pixels[ScreenDevice::W * ScreenDevice::H];
+    uint32_t dirtyRows;
+    uint64_t cycles; // cpu cycle count when the frame was taken
+    uint64_t publishedNanos; // Telemetry::nanos() when it was published
+};
+
+// Something the UI thread asks the emulation thread to do.
+struct Input {
+    enum Kind { Key, Rewind };
+    Kind kind;
+    Byte key; // for Key
+};
+
+// Runs the cpu on its own thread in slices of one frame's worth of cycles,
+// paced to the emulated clock unless throttling is off. Keys come in through
+// a lock-free queue and frames go out through a triple buffer, so a slow
+// present on the UI thread never stalls emulation. While the guest spins
+// waiting for input (cpu::waitingForHost) the thread sleeps until a key
+// arrives or stop() is called.
+class Emulator {
+public:
+    // The lock-free queue plus a wakeup for a sleeping emulation thread. The
+    // mutex is only taken to signal and to sleep, never to move an input.
+    class InputQueue {
+    public:
+        // UI thread. Returns false when the queue is full.
+        bool push(const Input& in);
+
+        // Emulation thread.
+        bool pop(Input& in) { return queue.pop(in); }
+        bool empty() const { return queue.empty(); }
+        void wait(const std::atomic<bool>& running); // until an input is queued or running is false
+        void wake();                                 // after clearing running
+
+    private:
+        SpscQueue<Input, 64> queue;
+        std::mutex mutex;
+        std::condition_variable pushed;
+    };
+
+    Emulator(cpu& c, ScreenDevice& screen, KeyboardDevice& keys, uint64_t clockHz = 1000000, unsigned frameRate = 60);
+    ~Emulator();
+
+    void start();
+    void stop();
+
+    // Off: run as fast as the host allows.
+    void setThrottled(bool throttled) { this->throttled.store(throttled, std::memory_order_relaxed); }
+
+    // Keeps `slots` savestates, one every `interval` frames, for Input::Rewind.
+    // Call before start().
+    void enableRewind(size_t slots, unsigned interval);
+
+    // Publishes per-frame counters to `telemetry` (may be null). Call before
+    // start().
+    void setTelemetry(Telemetry* telemetry) { this->telemetry = telemetry; }
+
+    // Appends every input the emulation thread applies to `log`, and fills in
+    // its pacing, frame count and final state hash; the caller sets the seed.
+    // Call before start(); the log is complete once stop() returns.
+    void record(InputLog* log);
+
+    // Runs a recorded session on the calling thread, unpaced, from the state
+    // the recording started in. Returns false if an input came due at a
+    // different cycle count than recorded, i.e. the run diverged.
+    bool replay(const InputLog& log);
+
+    // UI thread side.
+    InputQueue& input() { return inputs; }
+    const Frame* takeFrame(); // newest frame since the last call, or nullptr
+    uint64_t cycles() const { return frameCycles.load(std::memory_order_acquire); } // at the last frame boundary
+
+private:
+    cpu& c;
+    ScreenDevice& screen;
+    KeyboardDevice& keyboard;
+    const uint64_t clockHz;
+    const unsigned frameRate;
+
+    InputQueue inputs;
+    TripleBuffer<Frame> frames;
+    std::unique_ptr<RewindBuffer> rewind;
+    size_t rewindSlots;
+    unsigned rewindInterval;
+    Telemetry* telemetry;
+    InputLog* recording;
+    uint32_t droppedRows; // dirty rows of frames the reader skipped
+
+    // Emulation thread: frames run so far and where the current one ends.
+    uint64_t frameCount;
+    uint64_t frameEnd;
+
+    std::atomic<bool> running;
+    std::atomic<bool> throttled;
+    std::atomic<uint64_t> frameCycles;
+    std::thread thread;
+
+    void loop();
+    void apply(const Input& in);
+    void runFrame();
+    void publishFrame();
+    void report(uint64_t frameStart, uint64_t frameCycles);
+};
+
+#endif // EMULATOR_H
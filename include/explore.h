@@ -0,0 +1,69 @@
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include "snapshot.h"
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// One choice at a fork: the key latched at the keyboard address and the
+// seed of the stream the random address returns until the next fork.
+struct ExploreInput {
+    Byte key;
+    uint32_t seed;
+};
+
+struct ExploreOptions {
+    uint64_t cycles = 1000000 / 60; // run between forks
+    unsigned depth = 4;             // forks along every path from the root
+    std::vector<Byte> keys;         // tried at every fork...
+    std::vector<uint32_t> seeds;    // ...each with every seed
+    Word keyAddress = 0x00FF;
+    Word randomAddress = 0x00FE;
+    unsigned threads = 0;           // 0: one per hardware thread
+    size_t maxStates = 0;           // stop after this many distinct states; 0: no limit
+    // Snapshots leave out the memory map, so branches run on machines with
+    // only the key and random devices and with these pages mapped as ROM;
+    // copy them from the machine the root was saved on (cpu::isRom), or
+    // guest stores to its ROM succeed in every branch.
+    std::vector<Byte> romPages;
+
+    // Scores a state; higher is better, e.g. the snake's length at $03.
+    // Called from worker threads, so it must not touch shared state.
+    std::function<double(const cpu&)> score;
+    // A state is only forked further while this holds (null: always),
+    // e.g. while the game is still running.
+    std::function<bool(const cpu&)> expand;
+};
+
+struct ExploreResult {
+    double bestScore;
+    std::vector<ExploreInput> bestPath; // inputs from the root to the best state, below
+    uint64_t states;                    // distinct states run and scored
+    uint64_t duplicates;                // branches that reached a state already seen
+    uint64_t cycles;                    // emulated over all branches
+    uint64_t steals;                    // tasks taken from another worker's queue
+    double seconds;
+};
+
+// Runs every combination of inputs up to a fixed depth from a saved state,
+// in parallel. Each worker thread owns one machine and a deque of states
+// still to fork; it takes the newest from its own deque, so the tree is
+// explored depth first and the frontier stays small, and steals the oldest
+// from another worker when it runs dry, sleeping until the next fork if
+// every deque is empty. A fork is a loadState(), which only repoints pages,
+// and a branch shares every page it does not write with its parent. States
+// are hashed over their registers and memory (cycle counts aside) and a
+// state reached twice at the same depth is only forked once; page hashes
+// are carried from parent to child, so only written pages are rehashed.
+//
+// Every branch into a state is remembered, so the result does not depend on
+// thread timing unless maxStates cuts the search short: bestPath leads to
+// the shallowest of the highest-scoring states, and of the paths there it is
+// the first in the order inputs are tried (keys, then seeds, as listed).
+ExploreResult explore(const Snapshot& root, const ExploreOptions& options);
+
+// Hash of a state's registers and memory, as explore() deduplicates them.
+uint64_t exploreHash(const Snapshot& state);
+
+#endif // EXPLORE_H
@@ -2,6 +2,7 @@
 #define FRONTEND_H
 
 #include "cpu.h"
+#include "emulator.h"
 #include <SDL.h>
 #include <vector>
 
@@ -12,8 +13,11 @@ public:
 
     bool init();
     void shutdown();
-    void draw_if_changed(const Byte* screen);
-    bool handle_events(cpu& cpu);
+    void draw_if_changed(const Frame& frame);
+    bool handle_events(Emulator::InputQueue& input);
+
+    // Counts presented frames and their latency in `telemetry` (may be null).
+    void setTelemetry(Telemetry* telemetry) { this->telemetry = telemetry; }
 
 private:
     static constexpr int W = 32;
@@ -23,10 +27,10 @@ private:
     SDL_Window* window;
     SDL_Renderer* renderer;
     SDL_Texture* texture;
+    Telemetry* telemetry;
 
-    std::vector<Byte> last_frame;
-
-    static inline void map_to_rgb(Byte v, Byte& r, Byte& g, Byte& b);
+    Byte palette[256][3];      // RGB24 per pixel value
+    std::vector<Byte> staging; // converted rows for SDL_UpdateTexture
 };
 
 #endif // FRONTEND_H
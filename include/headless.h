@@ -0,0 +1,80 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "emulator.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frontend without a display, for servers. Takes frames through the same
+// calls as Frontend and records them as a video stream: Y4M (4:4:4) when the
+// path ends in ".y4m", raw RGB24 otherwise, each pixel upscaled to
+// scale x scale. The stream has one image per emulated frame; frames the
+// emulator skipped because nothing changed are repeated from the previous
+// image.
+//
+// draw_if_changed() only copies the frame into a free slot; a background
+// thread converts and writes it in large blocks. When every slot is queued
+// the frame replaces the newest queued one rather than waiting on the disk:
+// the frame in between is dropped, the latest image is kept.
+class HeadlessFrontend {
+public:
+    HeadlessFrontend(const std::string& path, int scale, uint64_t cyclesPerFrame, unsigned frameRate);
+    ~HeadlessFrontend();
+
+    bool init(); // opens the output and starts the encoder
+    // Pads the stream with the last image up to `cycles` (see
+    // Emulator::cycles()), writes everything queued and closes the output.
+    // Returns false if any write or the close failed, e.g. on a full disk or
+    // a closed pipe; nothing more is written after the first failure.
+    bool finish(uint64_t cycles);
+    void draw_if_changed(const Frame& frame);
+    // No input; returns false once SIGINT or SIGTERM arrived.
+    bool handle_events(Emulator::InputQueue& input);
+
+    uint64_t droppedFrames() const { return dropped; }
+
+private:
+    struct Capture {
+        uint64_t index; // emulated frame number
+        Byte pixels[ScreenDevice::W * ScreenDevice::H];
+    };
+    static const size_t SLOTS = 32;
+    static const size_t WRITE_BLOCK = 4 << 20;
+
+    std::string path;
+    const int scale;
+    const uint64_t cyclesPerFrame;
+    const unsigned frameRate;
+    bool y4m;
+    std::FILE* file;
+    uint64_t dropped;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<Capture*> queued;
+    std::vector<Capture*> free;
+    std::vector<Capture> slots;
+    uint64_t endIndex; // pad to this frame when stopping
+    bool stopping;
+    std::thread encoder;
+
+    // Encoder thread state.
+    Byte planes[3][256];     // per pixel value: Y, U, V or R, G, B
+    Byte image[ScreenDevice::W * ScreenDevice::H]; // last image written
+    uint64_t written;        // frames in the stream so far
+    bool writeFailed;
+    std::vector<Byte> frameBytes; // one converted, upscaled frame
+    std::vector<Byte> out;        // pending output
+
+    void encoderLoop();
+    void convert();
+    void emit(uint64_t upTo);
+    void flush();
+};
+
+#endif // HEADLESS_H
@@ -0,0 +1,41 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "cpu.h"
+#include <cstddef>
+
+struct Block;
+
+// x86-64 translator for hot basic blocks. A/X/Y/P live in callee-saved host
+// registers for the duration of a block; memory goes through the cpu's page
+// table. Blocks containing an opcode the translator does not handle
+// (JMP indirect, BRK, RTI, unknown opcodes) stay in the interpreter.
+//
+// Accesses the page table does not allow directly (devices, ROM, pages
+// holding decoded code) call cpu::read()/write(); after a slow-path store the
+// native block returns at the next instruction boundary.
+class Jit {
+public:
+    Jit();
+    ~Jit();
+
+    // False when the host is not x86-64 or executable memory is unavailable.
+    bool available() const { return arena != nullptr; }
+
+    // Translates block and stores the entry point in block.native. Returns
+    // false if the block cannot be translated or the code arena is full.
+    bool compile(cpu& c, Block& block);
+
+    // The arena filled up; the caller must drop every block holding native
+    // code and then call flush().
+    bool exhausted() const { return full; }
+    void flush();
+
+private:
+    Byte* arena;
+    size_t arenaSize;
+    size_t used;
+    bool full;
+};
+
+#endif // JIT_H
@@ -0,0 +1,70 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "snapshot.h"
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum RomFormat {
+    RomAuto,     // by content: segment magic, then ':' for Intel HEX, else raw
+    RomRaw,      // bytes placed at one load address
+    RomIntelHex, // record types 00-05, checksums verified, 64 KiB address space
+    RomSegments  // "6502SEGS", below
+};
+
+struct RomOptions {
+    RomFormat format = RomAuto;
+    int loadAddress = -1; // raw images; -1: $0000 for a 64 KiB image, else $0600
+};
+
+// A run of bytes the image defines. ROM segments are mapped read-only when
+// the image is loaded, a page at a time, so they must start and end on page
+// boundaries: segment files with any other ROM segment are rejected, and
+// loadImage() leaves a page a hand-built one only partly covers writable.
+struct RomSegment {
+    Word address;
+    uint32_t length;
+    bool rom;
+};
+
+// A parsed image: the memory pages it touches, zero wherever no segment
+// reaches, with the vectors already in place. Immutable, and shared by every
+// machine that loads it. Whole pages of a raw or segment file point straight
+// into the file's read-only mapping, which lives as long as any page does;
+// replace ROM files by renaming a new one over them rather than rewriting
+// them in place.
+struct RomImage {
+    std::shared_ptr<const MemoryPage> pages[256]; // null: not touched
+    std::vector<RomSegment> segments;             // in file order, vectors included
+    RomFormat format;
+    size_t mappedPages;                           // pages that are views of the file
+};
+
+// Vectors come from the file: a segment file's header or a HEX start address
+// record overrides the data, otherwise the image's own bytes at $FFFA-$FFFF
+// are used, and an image that leaves the reset vector out starts at its
+// lowest address.
+//
+// openRom() parses each file once per process: later calls with the same
+// path and options get the cached image while the file's size, inode and
+// modification time are unchanged. Thread-safe. Returns null and sets
+// `error` on failure.
+std::shared_ptr<const RomImage> openRom(const std::string& path, const RomOptions& options, std::string& error);
+std::shared_ptr<const RomImage> parseRom(const Byte* data, size_t size, const RomOptions& options, std::string& error);
+void clearRomCache();
+size_t romCacheSize();
+
+// Segment image format, all integers little-endian:
+//   "6502SEGS"  magic
+//   u16         format version (ROM_SEGMENTS_VERSION)
+//   u16 reset, u16 irq, u16 nmi vectors (0: not given), u16 segment count
+//   segment*    u16 address, u8 flags (1: ROM), u8 reserved, u32 length, u32 file offset
+// followed by the data. Pages a segment covers whole are viewed in place.
+const uint16_t ROM_SEGMENTS_VERSION = 1;
+
+// Returns false, writing nothing, for a ROM segment off page boundaries.
+bool writeSegments(std::ostream& out, const RomImage& image, Word reset = 0, Word irq = 0, Word nmi = 0);
+
+#endif // LOADER_H
@@ -0,0 +1,39 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "cpu.h"
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Arena of cpu objects for workloads that create and drop many machines.
+// Machines are allocated in chunks and never freed before the pool; a
+// released machine is cleared and handed out again, keeping the private page
+// buffers it already had. Not thread-safe; use one pool per thread. Handles
+// must be released before the pool is destroyed.
+class CpuPool {
+public:
+    struct Release {
+        CpuPool* pool;
+        void operator()(cpu* c) const { pool->release(c); }
+    };
+    typedef std::unique_ptr<cpu, Release> Handle;
+
+    CpuPool() {}
+    CpuPool(const CpuPool&) = delete;
+    CpuPool& operator=(const CpuPool&) = delete;
+
+    // A machine in its just-constructed state (see cpu::clear()).
+    Handle acquire();
+    void release(cpu* c);
+
+    size_t allocated() const { return machines.size(); }
+    size_t idle() const { return freeList.size(); }
+
+private:
+    std::deque<cpu> machines; // stable addresses, allocated in chunks
+    std::vector<cpu*> freeList;
+};
+
+#endif // POOL_H
@@ -0,0 +1,75 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "cpu.h"
+#include <iosfwd>
+#include <unordered_map>
+#include <vector>
+
+// Guest profiler. Attach with cpu::setProfiler(); run() then feeds it every
+// instruction it executes. Collects per-address hit and cycle counts, an
+// opcode histogram, and cycles per call path from a shadow stack maintained
+// on JSR/RTS.
+class Profiler {
+public:
+    Profiler();
+
+    void clear();
+
+    // Called by cpu after each profiled instruction with the address it
+    // started at and the cycles it took; registers are already updated.
+    void step(const cpu& c, Word pc, Byte opcode, Byte cycles) {
+        hits[pc]++;
+        cycleCounts[pc] += cycles;
+        opcodeHits[opcode]++;
+        opcodeCycles[opcode] += cycles;
+        nodes[node].cycles += cycles;
+        totalCycles += cycles;
+        if (opcode == 0x20) call(c);
+        else if (opcode == 0x60) unwind(c.SP);
+    }
+
+    uint64_t instructions() const;
+    uint64_t cycles() const { return totalCycles; }
+    uint64_t hitsAt(Word pc) const { return hits[pc]; }
+    uint64_t cyclesAt(Word pc) const { return cycleCounts[pc]; }
+
+    // Every executed address in order with its counts and disassembly,
+    // taken from the cpu's current memory.
+    void writeListing(std::ostream& out, const cpu& c) const;
+    // Counts and cycles per opcode and per addressing mode, busiest first.
+    void writeHistogram(std::ostream& out) const;
+    // One "root;$0700;$0750 cycles" line per call path, the input format of
+    // flamegraph.pl and similar tools. Cycles are self time.
+    void writeFoldedStacks(std::ostream& out) const;
+
+private:
+    // Call tree: one node per distinct path of subroutine entries.
+    struct Node {
+        uint32_t parent;
+        Word entry;
+        uint64_t cycles;
+    };
+    // A subroutine the guest is currently in. sp is the stack pointer before
+    // its JSR; the frame is gone once SP climbs back to it.
+    struct Frame {
+        uint32_t node;
+        Byte sp;
+    };
+
+    std::vector<uint64_t> hits;
+    std::vector<uint64_t> cycleCounts;
+    uint64_t opcodeHits[256];
+    uint64_t opcodeCycles[256];
+    uint64_t totalCycles;
+
+    std::vector<Node> nodes;
+    std::unordered_map<uint64_t, uint32_t> children; // (parent << 16 | entry) -> node
+    std::vector<Frame> stack;
+    uint32_t node;
+
+    void call(const cpu& c);
+    void unwind(Byte sp);
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,39 @@
+#ifndef RECOMPILED_H
+#define RECOMPILED_H
+
+#include "cpu.h"
+
+// A ROM image translated ahead of time into C++ by tools/recompile. The
+// generated code runs against the ordinary cpu: registers are loaded from it
+// on entry and stored back on exit, and memory goes through cpu::read() and
+// cpu::write(), so devices behave as in the interpreter.
+struct RecompiledRom {
+    enum Exit {
+        Budget,   // the next block might not fit before `end`
+        Leave,    // PC is not translated code, or the instruction there is
+                  // left to the interpreter (JMP indirect, BRK, RTI, PLP, CLI)
+        Modified  // the guest wrote into [origin, origin + size)
+    };
+
+    const char* name;
+    Word origin;
+    Word size;
+    const Byte* image; // the bytes that were translated
+
+    // Runs from c.PC while every block fits before cycle `end`; at exit the
+    // cpu is at an instruction boundary with P exact.
+    Exit (*run)(cpu& c, uint64_t end);
+
+    // The machine's memory still holds the translated bytes.
+    bool matches(const cpu& c) const;
+};
+
+// Like cpu::run(), but executes translated code wherever it can and the
+// interpreter everywhere else: code outside the image, the instructions the
+// translation leaves out, and the last partial block before the budget runs
+// out, so it stops exactly where run() would. Once the guest has changed the
+// image, everything runs in the interpreter. Scheduled events and interrupts
+// are only taken between stretches of translated code.
+uint64_t runRecompiled(const RecompiledRom& rom, cpu& c, uint64_t cycleBudget);
+
+#endif // RECOMPILED_H
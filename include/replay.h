@@ -0,0 +1,45 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "emulator.h"
+#include <iosfwd>
+#include <vector>
+
+// Everything a session's outcome depends on besides the program: the random
+// seed, the frame pacing and every input, stamped with the emulator frame it
+// was applied before and the cycle count at that point. Emulator::replay()
+// runs the same frames on the calling thread with no pacing, so the result
+// does not depend on wall-clock timing.
+struct InputLog {
+    struct Event {
+        uint64_t frame;
+        uint64_t cycles; // checked on replay
+        Input input;
+    };
+
+    uint32_t seed;
+    uint64_t clockHz;
+    unsigned frameRate;
+    uint32_t rewindSlots; // see Emulator::enableRewind
+    uint32_t rewindInterval;
+    std::vector<Event> events;
+    uint64_t frames;    // frames run when recording stopped
+    uint64_t finalHash; // stateHash() when recording stopped
+};
+
+// Binary format, all integers little-endian:
+//   "6502INPT"  magic
+//   u16         format version (INPUT_LOG_VERSION)
+//   u32 seed, u64 clockHz, u32 frameRate, u32 rewindSlots, u32 rewindInterval,
+//   u64 frames, u64 finalHash, u32 event count
+//   event*      u64 frame, u64 cycles, u8 kind, u8 key
+const uint16_t INPUT_LOG_VERSION = 1;
+
+bool writeInputLog(std::ostream& out, const InputLog& log);
+bool readInputLog(std::istream& in, InputLog& log); // false on bad magic, version or short read
+
+// FNV-1a over registers, cycle count and all 64K of memory, for comparing
+// the end of a run against a recording.
+uint64_t stateHash(const cpu& c);
+
+#endif // REPLAY_H
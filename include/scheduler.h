@@ -0,0 +1,46 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Min-heap of callbacks keyed on the cpu cycle counter. Events due on the
+// same cycle fire in the order they were added.
+class Scheduler {
+public:
+    Scheduler();
+
+    // Returns an id for cancel().
+    uint64_t add(uint64_t cycle, const std::function<void()>& callback);
+    bool cancel(uint64_t id); // false if it already fired or was cancelled
+
+    void clear(); // drops every event; ids keep counting
+    bool empty() const { return heap.empty(); }
+    // Deadline of the earliest pending event, UINT64_MAX when there is none.
+    uint64_t next() const { return heap.empty() ? UINT64_MAX : heap.front().cycle; }
+
+    // Runs every event due at or before `now`, earliest first, including any
+    // that the callbacks add for cycles already reached.
+    void fire(uint64_t now);
+
+private:
+    struct Event {
+        uint64_t cycle;
+        uint64_t id;
+        std::function<void()> callback; // empty once cancelled
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const {
+            return a.cycle != b.cycle ? a.cycle > b.cycle : a.id > b.id;
+        }
+    };
+
+    std::vector<Event> heap;
+    uint64_t nextId;
+
+    void pop();
+    void dropCancelled();
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,62 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cpu.h"
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+struct MemoryPage {
+    Byte bytes[256];
+};
+
+// Complete machine state: registers, cycle count and all 256 memory pages.
+// Pages are immutable and shared between snapshots that did not change them,
+// so a snapshot costs one pointer per page plus a copy of each dirtied page.
+// Device state (keyboard latch, RNG) is not part of it.
+struct Snapshot {
+    std::shared_ptr<const MemoryPage> pages[256];
+    Word PC;
+    Byte SP;
+    Byte A, X, Y;
+    Byte P;
+    uint64_t cycles;
+};
+
+// Binary format, all integers little-endian:
+//   "6502SNAP"  magic
+//   u16         format version (SNAPSHOT_VERSION)
+//   u16 PC, u8 SP, A, X, Y, P, u64 cycles
+//   65536 bytes of memory
+const uint16_t SNAPSHOT_VERSION = 1;
+
+bool writeSnapshot(std::ostream& out, const Snapshot& state);
+bool readSnapshot(std::istream& in, Snapshot& state); // false on bad magic, version or short read
+
+// Fixed-size ring of savestates taken every `interval` frames. Memory is
+// bounded by the slot count; each slot only owns the pages dirtied since the
+// slot before it.
+class RewindBuffer {
+public:
+    RewindBuffer(size_t slots, unsigned interval);
+
+    // Call once per emulated frame.
+    void onFrame(cpu& c);
+
+    // Restores the newest saved state and drops it, so repeated calls step
+    // further back. Returns false when the ring is empty.
+    bool rewind(cpu& c);
+
+    size_t size() const { return count; }
+    size_t distinctPages() const; // pages held across all slots
+
+private:
+    std::vector<Snapshot> ring;
+    size_t newest;
+    size_t count;
+    unsigned interval;
+    unsigned frame;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,66 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+const uint32_t TELEMETRY_MAGIC = 0x54454D36; // "6MET"
+const uint32_t TELEMETRY_VERSION = 1;
+
+// Counters in a POSIX shared-memory segment (/dev/shm/NAME on Linux) that
+// another process can map and sample while the emulator runs; see
+// tools/emustat.cpp. Every counter has one writing thread and is only ever
+// stored or added to, so no locks are involved and a reader sees each value
+// whole. Totals only grow; rates are the reader's differences over time.
+struct TelemetryCounters {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t pid;
+
+    // Emulation thread, once per frame.
+    std::atomic<uint64_t> instructions;   // see cpu::instructions
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> unknownOpcodes;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> lastFrameCycles;
+    std::atomic<uint64_t> frameNanos;     // host time spent emulating frames
+    std::atomic<uint64_t> lastFrameNanos;
+    std::atomic<uint64_t> droppedFrames;  // published but replaced before the UI took them
+
+    // UI thread, once per presented frame.
+    std::atomic<uint64_t> presented;
+    std::atomic<uint64_t> presentNanos;   // frame published to frame on screen
+    std::atomic<uint64_t> lastPresentNanos;
+};
+
+// One mapping of a telemetry segment. The emulator creates it and removes
+// the name again on destruction; emustat attaches to it read-only.
+class Telemetry {
+public:
+    enum Mode { Create, Attach };
+
+    Telemetry(const std::string& name, Mode mode);
+    ~Telemetry();
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+    bool ok() const { return counters != nullptr; }
+    TelemetryCounters& get() { return *counters; }
+    const TelemetryCounters& get() const { return *counters; }
+
+    static uint64_t nanos(); // steady clock
+
+    // Bumps a counter owned by the calling thread; the plain load and store
+    // avoid a locked read-modify-write.
+    static void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+private:
+    std::string name;
+    Mode mode;
+    TelemetryCounters* counters;
+};
+
+#endif // TELEMETRY_H
@@ -0,0 +1,140 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "cpu.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Execution trace file, all integers little-endian:
+//
+//   file header   "6502TRC" '\0', u16 version
+//   chunk*        u32 CHUNK_MAGIC, u32 payload bytes, u32 record count,
+//                 u64 first instruction index, u64 cycles,
+//                 u16 PC, u8 A, X, Y, SP, P, payload
+//
+// A chunk's header is a keyframe with the state before its first instruction,
+// so every chunk decodes on its own. The payload is a sequence of records:
+//
+//   u8 flags, u8 opcode, operand bytes (0-2, by addressing mode), u8 cycles,
+//   [u16 PC]        if TRACE_JUMP: PC differs from the previous fall-through
+//   [u8 A][u8 X][u8 Y][u8 SP][u8 P]   each only if its flag is set (new value)
+//   [u8 n, n * (u16 address, u8 value)]   if TRACE_WRITES
+const uint16_t TRACE_VERSION = 1;
+const uint32_t TRACE_CHUNK_MAGIC = 0x4B435254; // "TRCK"
+const size_t TRACE_FILE_HEADER = 10;
+const size_t TRACE_CHUNK_HEADER = 35;
+
+enum TraceFlags {
+    TRACE_JUMP = 1 << 0,
+    TRACE_A = 1 << 1,
+    TRACE_X = 1 << 2,
+    TRACE_Y = 1 << 3,
+    TRACE_SP = 1 << 4,
+    TRACE_P = 1 << 5,
+    TRACE_WRITES = 1 << 6
+};
+
+// Streams every instruction run() executes to a trace file. Attach with
+// cpu::setTracer(). Records are built on the emulation thread into
+// fixed-size buffers; full buffers go to a writer thread, and the cpu only
+// waits when all buffers are in flight.
+class Tracer {
+public:
+    explicit Tracer(const std::string& path, size_t bufferSize = 1 << 20, size_t bufferCount = 4);
+    ~Tracer(); // flushes the current chunk and closes the file
+
+    bool ok() const { return file != nullptr; }
+    uint64_t instructions() const { return index; }
+
+    // Called by cpu around each traced instruction.
+    void begin(const cpu& c, Word pc, Byte opcode, Byte lo, Byte hi);
+    void write(Word address, Byte value) {
+        if (writeCount < MAX_WRITES) writes[writeCount++] = Write{address, value};
+    }
+    void end(const cpu& c, Byte cycles);
+    // Called when the cpu changed state outside an instruction (interrupt
+    // entry): the next instruction starts a chunk with a fresh keyframe.
+    // The stack writes of the interrupt entry are not recorded.
+    void resync() {
+        if (current) finishChunk();
+    }
+
+private:
+    struct Write { Word address; Byte value; };
+    static const int MAX_WRITES = 8;
+    static const size_t MAX_RECORD = 1 + 1 + 2 + 1 + 2 + 5 + 1 + MAX_WRITES * 3;
+
+    std::FILE* file;
+    size_t bufferSize;
+
+    // Chunk being filled by the emulation thread.
+    std::vector<Byte>* current;
+    size_t used;
+    uint32_t records;
+
+    // Per-instruction staging.
+    Word pc;
+    Byte opcode, lo, hi;
+    Write writes[MAX_WRITES];
+    int writeCount;
+
+    // State after the previous record, for the deltas.
+    Word nextPC;
+    Byte A, X, Y, SP, P;
+    uint64_t index;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<Byte>*> full;
+    std::vector<std::vector<Byte>*> free;
+    std::vector<std::vector<Byte> > buffers;
+    bool stopping;
+    std::thread writer;
+
+    void startChunk(const cpu& c);
+    void finishChunk();
+    void writerLoop();
+};
+
+// One decoded record. Registers are the values after the instruction;
+// cycle is the count before it.
+struct TraceStep {
+    uint64_t index;
+    uint64_t cycle;
+    Word pc;
+    Byte opcode;
+    Byte operand[2];
+    Byte cycles;
+    Byte A, X, Y, SP, P;
+    Byte writeCount;
+    Word writeAddress[8];
+    Byte writeValue[8];
+};
+
+// Read-only view of a trace file through mmap. Only chunk headers are touched
+// when opening; chunks are decoded on demand.
+class TraceReader {
+public:
+    TraceReader();
+    ~TraceReader();
+
+    bool open(const std::string& path);
+
+    size_t chunkCount() const { return chunks.size(); }
+    uint64_t instructionCount() const;
+
+    // Decodes chunk i; false if it is truncated or corrupt.
+    bool decode(size_t i, std::vector<TraceStep>& steps) const;
+
+private:
+    const Byte* data;
+    size_t size;
+    std::vector<size_t> chunks; // offsets of chunk headers
+};
+
+#endif // TRACE_H
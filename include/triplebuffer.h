@@ -0,0 +1,47 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Lock-free handoff of the latest value from one writer thread to one reader
+// thread. The writer fills writeBuffer() and publishes it; the reader picks up
+// the most recent published buffer. Neither side ever waits for the other.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : back(0), middle(1), front(2) {}
+
+    // Writer side.
+    T& writeBuffer() { return buffers[back]; }
+
+    // Hands the write buffer to the reader. Returns true if the previously
+    // published buffer was never picked up; it becomes the new write buffer,
+    // so the writer can still see what it contained.
+    bool publish() {
+        unsigned old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = old & INDEX;
+        return (old & FRESH) != 0;
+    }
+
+    // Reader side. Returns true and switches readBuffer() to the newest
+    // published buffer if there is one.
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        unsigned old = middle.exchange(front, std::memory_order_acq_rel);
+        front = old & INDEX;
+        return true;
+    }
+
+    const T& readBuffer() const { return buffers[front]; }
+
+private:
+    static const unsigned INDEX = 3;
+    static const unsigned FRESH = 4; // set while middle holds an unread buffer
+
+    T buffers[3];
+    unsigned back;               // owned by the writer
+    std::atomic<unsigned> middle;
+    unsigned front;              // owned by the reader
+};
+
+#endif // TRIPLEBUFFER_H
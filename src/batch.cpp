@@ -0,0 +1,528 @@
+#include "batch.h"
+#include "loader.h"
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t NO_LANE = 0xFFFFFFFF;
+
+static inline int lowestBit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) { word >>= 1; ++bit; }
+    return bit;
+#endif
+}
+
+BatchCpu::BatchCpu(size_t lanes)
+    : count(lanes), PC(lanes), A(lanes), X(lanes), Y(lanes), SP(lanes), P(lanes), cycles(lanes), target(lanes),
+      rng(lanes), key(lanes), inputs(lanes), nextInput(lanes), pages(256 * lanes), head(0x10000, NO_LANE), link(lanes), group(lanes),
+      stepCount(0), laneCount(0) {
+    std::memset(image, 0, sizeof(image));
+    std::fill(rom, rom + 256, false);
+    std::fill(queued, queued + 1024, 0);
+    std::fill(queuedWords, queuedWords + 16, 0);
+    for (size_t l = 0; l < count; ++l) seedRandom(l, (uint32_t)l + 1);
+    reset();
+}
+
+void BatchCpu::loadAt0600AndSetReset(const std::vector<Byte>& program) {
+    for (size_t i = 0; i < program.size(); ++i) {
+        Word address = 0x0600 + i;
+        image[address >> 8].bytes[address & 0xFF] = program[i];
+    }
+    image[0xFF].bytes[0xFC] = 0x00;
+    image[0xFF].bytes[0xFD] = 0x06;
+}
+
+void BatchCpu::loadImage(const RomImage& rom) {
+    for (size_t i = 0; i < rom.segments.size(); ++i) {
+        const RomSegment& segment = rom.segments[i];
+        for (uint32_t a = segment.address; a < segment.address + segment.length; ++a) {
+            image[a >> 8].bytes[a & 0xFF] = rom.pages[a >> 8]->bytes[a & 0xFF];
+        }
+        const uint32_t first = (segment.address + 0xFF) >> 8, end = (segment.address + segment.length) >> 8;
+        if (segment.rom && first < end) mapRom(first, end - 1); // whole pages only, as cpu::loadImage
+    }
+}
+
+void BatchCpu::mapRom(Byte firstPage, Byte lastPage) {
+    for (int page = firstPage; page <= lastPage; ++page) rom[page] = true;
+}
+
+void BatchCpu::reset() {
+    for (int page = 0; page < 256; ++page) {
+        Byte* shared = image[page].bytes;
+        std::fill(pages.begin() + page * count, pages.begin() + (page + 1) * count, shared);
+    }
+    pool.clear();
+    std::fill(ownedLanes, ownedLanes + 256, 0);
+    Word start = image[0xFF].bytes[0xFC] | (image[0xFF].bytes[0xFD] << 8);
+    std::fill(PC.begin(), PC.end(), start);
+    std::fill(SP.begin(), SP.end(), 0xFD);
+    std::fill(A.begin(), A.end(), 0);
+    std::fill(X.begin(), X.end(), 0);
+    std::fill(Y.begin(), Y.end(), 0);
+    std::fill(P.begin(), P.end(), 0x34);
+    std::fill(cycles.begin(), cycles.end(), 0);
+    std::fill(key.begin(), key.end(), 0);
+    std::fill(nextInput.begin(), nextInput.end(), 0);
+}
+
+void BatchCpu::seedRandom(size_t lane, uint32_t seed) {
+    rng[lane] = seed ? seed : 1; // xorshift never leaves zero
+}
+
+void BatchCpu::setInputs(size_t lane, const std::vector<BatchInput>& inputs) {
+    this->inputs[lane] = inputs;
+    nextInput[lane] = 0;
+}
+
+BatchCpu::LaneState BatchCpu::lane(size_t l) const {
+    LaneState state;
+    state.PC = PC[l];
+    state.SP = SP[l];
+    state.A = A[l];
+    state.X = X[l];
+    state.Y = Y[l];
+    state.P = P[l];
+    state.cycles = cycles[l];
+    return state;
+}
+
+Byte BatchCpu::peek(size_t lane, Word address) const {
+    return fetchCode(lane, address);
+}
+
+BatchCpu::Regs BatchCpu::regs() {
+    Regs r = { PC.data(), A.data(), X.data(), Y.data(), SP.data(), P.data(), cycles.data() };
+    return r;
+}
+
+void BatchCpu::pollInput(size_t l) {
+    const std::vector<BatchInput>& in = inputs[l];
+    while (nextInput[l] < in.size() && in[nextInput[l]].cycle <= cycles[l]) key[l] = in[nextInput[l]++].key;
+}
+
+Byte BatchCpu::loadDevice(size_t l, Word address) {
+    if (address == RANDOM_ADDRESS) return random(rng[l]);
+    pollInput(l);
+    return key[l];
+}
+
+// Device writes, ROM, and the first write to a page the lane still shares.
+void BatchCpu::storeSlow(size_t l, Word address, Byte value) {
+    if (address == RANDOM_ADDRESS) return;
+    if (address == KEY_ADDRESS) {
+        pollInput(l);
+        key[l] = value;
+        return;
+    }
+    Byte page = address >> 8;
+    if (rom[page]) return;
+    Byte*& data = pages[page * count + l];
+    if (data == image[page].bytes) {
+        pool.push_back(image[page]);
+        data = pool.back().bytes;
+        ownedLanes[page]++;
+    }
+    data[address & 0xFF] = value;
+}
+
+template <cpu::AddressingMode mode, bool pagePenalty>
+CPU_ALWAYS_INLINE Word BatchCpu::address(const Regs& r, size_t l, Word operand) {
+    switch (mode) {
+        case cpu::ZeroPage:
+        case cpu::Absolute:
+            return operand;
+        case cpu::ZeroPageX:
+            return (operand + r.X[l]) & 0xFF;
+        case cpu::ZeroPageY:
+            return (operand + r.Y[l]) & 0xFF;
+        case cpu::AbsoluteX:
+            if (pagePenalty && (operand & 0xFF) + r.X[l] > 0xFF) r.cycles[l]++;
+            return operand + r.X[l];
+        case cpu::AbsoluteY:
+            if (pagePenalty && (operand & 0xFF) + r.Y[l] > 0xFF) r.cycles[l]++;
+            return operand + r.Y[l];
+        case cpu::Indirect: {
+            if ((operand & 0x00FF) == 0x00FF) { // 6502 page boundary bug
+                return load(l, operand) | (load(l, operand & 0xFF00) << 8);
+            }
+            return load(l, operand) | (load(l, operand + 1) << 8);
+        }
+        case cpu::IndirectX: {
+            Byte lo = load(l, (operand + r.X[l]) & 0xFF);
+            Byte hi = load(l, (operand + r.X[l] + 1) & 0xFF);
+            return lo | (hi << 8);
+        }
+        case cpu::IndirectY: {
+            Byte lo = load(l, operand);
+            Byte hi = load(l, (operand + 1) & 0xFF);
+            if (pagePenalty && lo + r.Y[l] > 0xFF) r.cycles[l]++;
+            return ((hi << 8) | lo) + r.Y[l];
+        }
+        default:
+            return 0;
+    }
+}
+
+template <cpu::AddressingMode mode>
+CPU_ALWAYS_INLINE Byte BatchCpu::fetch(const Regs& r, size_t l, Word operand) {
+    if (mode == cpu::Accumulator) return r.A[l];
+    if (mode == cpu::Immediate) return operand & 0xFF;
+    return load(l, address<mode, true>(r, l, operand));
+}
+
+// Flag updates are written without branches so that the register-only
+// kernels vectorise.
+static CPU_ALWAYS_INLINE Byte zn(Byte value) {
+    return (value & N) | (value ? 0 : Z);
+}
+
+CPU_ALWAYS_INLINE void BatchCpu::setZN(const Regs& r, size_t l, Byte value) {
+    r.P[l] = (r.P[l] & ~(N | Z)) | zn(value);
+}
+
+CPU_ALWAYS_INLINE void BatchCpu::op_ADC(const Regs& r, size_t l, Byte value) {
+    Byte a = r.A[l];
+    Word sum = a + value + (r.P[l] & C);
+    Byte result = sum & 0xFF;
+    Byte overflow = (~(a ^ value) & (a ^ result) & 0x80) ? V : 0;
+    r.P[l] = (r.P[l] & ~(C | V | N | Z)) | (sum >> 8) | overflow | zn(result);
+    r.A[l] = result;
+}
+
+CPU_ALWAYS_INLINE void BatchCpu::op_SBC(const Regs& r, size_t l, Byte value) { op_ADC(r, l, ~value); }
+CPU_ALWAYS_INLINE void BatchCpu::op_AND(const Regs& r, size_t l, Byte value) { r.A[l] &= value; setZN(r, l, r.A[l]); }
+CPU_ALWAYS_INLINE void BatchCpu::op_EOR(const Regs& r, size_t l, Byte value) { r.A[l] ^= value; setZN(r, l, r.A[l]); }
+CPU_ALWAYS_INLINE void BatchCpu::op_ORA(const Regs& r, size_t l, Byte value) { r.A[l] |= value; setZN(r, l, r.A[l]); }
+
+static CPU_ALWAYS_INLINE Byte compare(Byte p, Byte reg, Byte value) {
+    return (p & ~(C | N | Z)) | (reg >= value ? C : 0) | zn(reg - value);
+}
+
+CPU_ALWAYS_INLINE void BatchCpu::op_CMP(const Regs& r, size_t l, Byte value) { r.P[l] = compare(r.P[l], r.A[l], value); }
+CPU_ALWAYS_INLINE void BatchCpu::op_CPX(const Regs& r, size_t l, Byte value) { r.P[l] = compare(r.P[l], r.X[l], value); }
+CPU_ALWAYS_INLINE void BatchCpu::op_CPY(const Regs& r, size_t l, Byte value) { r.P[l] = compare(r.P[l], r.Y[l], value); }
+
+CPU_ALWAYS_INLINE void BatchCpu::op_BIT(const Regs& r, size_t l, Byte value) {
+    r.P[l] = (r.P[l] & ~(Z | N | V)) | ((r.A[l] & value) ? 0 : Z) | (value & (N | V));
+}
+
+CPU_ALWAYS_INLINE Byte BatchCpu::op_ASL(const Regs& r, size_t l, Byte value) {
+    Byte result = value << 1;
+    r.P[l] = (r.P[l] & ~(C | N | Z)) | (value >> 7) | zn(result);
+    return result;
+}
+
+CPU_ALWAYS_INLINE Byte BatchCpu::op_LSR(const Regs& r, size_t l, Byte value) {
+    Byte result = value >> 1;
+    r.P[l] = (r.P[l] & ~(C | N | Z)) | (value & C) | zn(result);
+    return result;
+}
+
+CPU_ALWAYS_INLINE Byte BatchCpu::op_ROL(const Regs& r, size_t l, Byte value) {
+    Byte result = (value << 1) | (r.P[l] & C);
+    r.P[l] = (r.P[l] & ~(C | N | Z)) | (value >> 7) | zn(result);
+    return result;
+}
+
+CPU_ALWAYS_INLINE Byte BatchCpu::op_ROR(const Regs& r, size_t l, Byte value) {
+    Byte result = (value >> 1) | ((r.P[l] & C) << 7);
+    r.P[l] = (r.P[l] & ~(C | N | Z)) | (value & C) | zn(result);
+    return result;
+}
+
+CPU_ALWAYS_INLINE Byte BatchCpu::op_INC(const Regs& r, size_t l, Byte value) { value++; setZN(r, l, value); return value; }
+CPU_ALWAYS_INLINE Byte BatchCpu::op_DEC(const Regs& r, size_t l, Byte value) { value--; setZN(r, l, value); return value; }
+
+template <BatchCpu::ReadOp op, cpu::AddressingMode mode, typename Lanes>
+CPU_ALWAYS_INLINE void BatchCpu::ins_read(const Regs& r, const Lanes& g, Word operand) {
+    for (size_t i = 0; i < g.n; ++i) {
+        size_t l = g[i];
+        op(r, l, fetch<mode>(r, l, operand));
+    }
+}
+
+template <BatchCpu::ModifyOp op, cpu::AddressingMode mode, typename Lanes>
+CPU_ALWAYS_INLINE void BatchCpu::ins_rmw(const Regs& r, const Lanes& g, Word operand) {
+    for (size_t i = 0; i < g.n; ++i) {
+        size_t l = g[i];
+        if (mode == cpu::Accumulator) {
+            r.A[l] = op(r, l, r.A[l]);
+        } else {
+            Word addr = address<mode>(r, l, operand);
+            store(l, addr, op(r, l, load(l, addr)));
+        }
+    }
+}
+
+template <Byte flag, bool set, typename Lanes>
+CPU_ALWAYS_INLINE void BatchCpu::ins_branch(const Regs& r, const Lanes& g, Word target) {
+    for (size_t i = 0; i < g.n; ++i) {
+        size_t l = g[i];
+        bool taken = ((r.P[l] & flag) != 0) == set;
+        Byte penalty = ((target ^ r.PC[l]) & 0xFF00) ? 2 : 1;
+        r.cycles[l] += taken ? penalty : 0;
+        r.PC[l] = taken ? target : r.PC[l];
+    }
+}
+
+template <Byte flag, bool set, typename Lanes>
+CPU_ALWAYS_INLINE void BatchCpu::ins_flag(const Regs& r, const Lanes& g) {
+    for (size_t i = 0; i < g.n; ++i) {
+        size_t l = g[i];
+        r.P[l] = set ? (r.P[l] | flag) : (r.P[l] & ~flag);
+    }
+}
+
+#define LANES(body) for (size_t i = 0; i < g.n; ++i) { size_t l = g[i]; body; }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_LDA(const Regs& r, const Lanes& g, Word operand) { LANES(r.A[l] = fetch<mode>(r, l, operand); setZN(r, l, r.A[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_LDX(const Regs& r, const Lanes& g, Word operand) { LANES(r.X[l] = fetch<mode>(r, l, operand); setZN(r, l, r.X[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_LDY(const Regs& r, const Lanes& g, Word operand) { LANES(r.Y[l] = fetch<mode>(r, l, operand); setZN(r, l, r.Y[l])) }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_STA(const Regs& r, const Lanes& g, Word operand) { LANES(store(l, address<mode>(r, l, operand), r.A[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_STX(const Regs& r, const Lanes& g, Word operand) { LANES(store(l, address<mode>(r, l, operand), r.X[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_STY(const Regs& r, const Lanes& g, Word operand) { LANES(store(l, address<mode>(r, l, operand), r.Y[l])) }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_TAX(const Regs& r, const Lanes& g, Word operand) { LANES(r.X[l] = r.A[l]; setZN(r, l, r.X[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_TAY(const Regs& r, const Lanes& g, Word operand) { LANES(r.Y[l] = r.A[l]; setZN(r, l, r.Y[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_TSX(const Regs& r, const Lanes& g, Word operand) { LANES(r.X[l] = r.SP[l]; setZN(r, l, r.X[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_TXA(const Regs& r, const Lanes& g, Word operand) { LANES(r.A[l] = r.X[l]; setZN(r, l, r.A[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_TXS(const Regs& r, const Lanes& g, Word operand) { LANES(r.SP[l] = r.X[l]) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_TYA(const Regs& r, const Lanes& g, Word operand) { LANES(r.A[l] = r.Y[l]; setZN(r, l, r.A[l])) }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_PHA(const Regs& r, const Lanes& g, Word operand) { LANES(store(l, 0x0100 + r.SP[l]--, r.A[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_PHP(const Regs& r, const Lanes& g, Word operand) { LANES(store(l, 0x0100 + r.SP[l]--, r.P[l] | B | U)) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_PLA(const Regs& r, const Lanes& g, Word operand) { LANES(r.A[l] = load(l, 0x0100 + ++r.SP[l]); setZN(r, l, r.A[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_PLP(const Regs& r, const Lanes& g, Word operand) { LANES(r.P[l] = (load(l, 0x0100 + ++r.SP[l]) & ~B) | U) }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_ADC(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_ADC, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_SBC(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_SBC, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CMP(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_CMP, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CPX(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_CPX, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CPY(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_CPY, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_AND(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_AND, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_EOR(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_EOR, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_ORA(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_ORA, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BIT(const Regs& r, const Lanes& g, Word operand) { ins_read<&BatchCpu::op_BIT, mode>(r, g, operand); }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_INC(const Regs& r, const Lanes& g, Word operand) { ins_rmw<&BatchCpu::op_INC, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_INX(const Regs& r, const Lanes& g, Word operand) { LANES(r.X[l]++; setZN(r, l, r.X[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_INY(const Regs& r, const Lanes& g, Word operand) { LANES(r.Y[l]++; setZN(r, l, r.Y[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_DEC(const Regs& r, const Lanes& g, Word operand) { ins_rmw<&BatchCpu::op_DEC, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_DEX(const Regs& r, const Lanes& g, Word operand) { LANES(r.X[l]--; setZN(r, l, r.X[l])) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_DEY(const Regs& r, const Lanes& g, Word operand) { LANES(r.Y[l]--; setZN(r, l, r.Y[l])) }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_ASL(const Regs& r, const Lanes& g, Word operand) { ins_rmw<&BatchCpu::op_ASL, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_LSR(const Regs& r, const Lanes& g, Word operand) { ins_rmw<&BatchCpu::op_LSR, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_ROL(const Regs& r, const Lanes& g, Word operand) { ins_rmw<&BatchCpu::op_ROL, mode>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_ROR(const Regs& r, const Lanes& g, Word operand) { ins_rmw<&BatchCpu::op_ROR, mode>(r, g, operand); }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_JMP(const Regs& r, const Lanes& g, Word operand) { LANES(r.PC[l] = address<mode>(r, l, operand)) }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_JSR(const Regs& r, const Lanes& g, Word operand) {
+    LANES(Word ret = r.PC[l] - 1; store(l, 0x0100 + r.SP[l]--, ret >> 8); store(l, 0x0100 + r.SP[l]--, ret & 0xFF); r.PC[l] = operand)
+}
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_RTS(const Regs& r, const Lanes& g, Word operand) {
+    LANES(Byte lo = load(l, 0x0100 + ++r.SP[l]); Byte hi = load(l, 0x0100 + ++r.SP[l]); r.PC[l] = (lo | (hi << 8)) + 1)
+}
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BCC(const Regs& r, const Lanes& g, Word operand) { ins_branch<C, false>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BCS(const Regs& r, const Lanes& g, Word operand) { ins_branch<C, true>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BEQ(const Regs& r, const Lanes& g, Word operand) { ins_branch<Z, true>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BMI(const Regs& r, const Lanes& g, Word operand) { ins_branch<N, true>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BNE(const Regs& r, const Lanes& g, Word operand) { ins_branch<Z, false>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BPL(const Regs& r, const Lanes& g, Word operand) { ins_branch<N, false>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BVC(const Regs& r, const Lanes& g, Word operand) { ins_branch<V, false>(r, g, operand); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BVS(const Regs& r, const Lanes& g, Word operand) { ins_branch<V, true>(r, g, operand); }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CLC(const Regs& r, const Lanes& g, Word operand) { ins_flag<C, false>(r, g); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CLD(const Regs& r, const Lanes& g, Word operand) { ins_flag<D, false>(r, g); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CLI(const Regs& r, const Lanes& g, Word operand) { ins_flag<I, false>(r, g); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_CLV(const Regs& r, const Lanes& g, Word operand) { ins_flag<V, false>(r, g); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_SEC(const Regs& r, const Lanes& g, Word operand) { ins_flag<C, true>(r, g); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_SED(const Regs& r, const Lanes& g, Word operand) { ins_flag<D, true>(r, g); }
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_SEI(const Regs& r, const Lanes& g, Word operand) { ins_flag<I, true>(r, g); }
+
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_BRK(const Regs& r, const Lanes& g, Word operand) {
+    LANES(Word ret = r.PC[l] + 1;
+          store(l, 0x0100 + r.SP[l]--, ret >> 8);
+          store(l, 0x0100 + r.SP[l]--, ret & 0xFF);
+          store(l, 0x0100 + r.SP[l]--, r.P[l] | B | U);
+          r.P[l] |= I;
+          r.PC[l] = load(l, 0xFFFE) | (load(l, 0xFFFF) << 8))
+}
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_NOP(const Regs& r, const Lanes& g, Word operand) {}
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_RTI(const Regs& r, const Lanes& g, Word operand) {
+    LANES(r.P[l] = (load(l, 0x0100 + ++r.SP[l]) & ~B) | U;
+          Byte lo = load(l, 0x0100 + ++r.SP[l]);
+          Byte hi = load(l, 0x0100 + ++r.SP[l]);
+          r.PC[l] = lo | (hi << 8))
+}
+// Undocumented opcodes run as two-cycle no-ops, as in cpu, without the
+// per-lane diagnostic.
+template <cpu::AddressingMode mode, typename Lanes> void BatchCpu::ins_UNK(const Regs& r, const Lanes& g, Word operand) {}
+
+#undef LANES
+
+CPU_ALWAYS_INLINE void BatchCpu::enqueue(uint32_t lane, Word pc) {
+    link[lane] = head[pc];
+    head[pc] = lane;
+    queued[pc >> 6] |= 1ull << (pc & 63);
+    queuedWords[pc >> 12] |= 1ull << ((pc >> 6) & 63);
+}
+
+int BatchCpu::lowestQueued() const {
+    for (int i = 0; i < 16; ++i) {
+        if (!queuedWords[i]) continue;
+        int word = i * 64 + lowestBit(queuedWords[i]);
+        return word * 64 + lowestBit(queued[word]);
+    }
+    return -1;
+}
+
+uint64_t BatchCpu::run(uint64_t cycleBudget) {
+    uint64_t before = laneCount;
+    if (!cycleBudget) return 0;
+    Regs r = regs();
+    for (size_t l = 0; l < count; ++l) {
+        target[l] = r.cycles[l] + cycleBudget;
+        enqueue((uint32_t)l, r.PC[l]);
+    }
+    while (step(r)) {}
+    return laneCount - before;
+}
+
+Word BatchCpu::decodeOperand(size_t lane, Word pc, Byte opcode) const {
+    Byte lo = fetchCode(lane, pc + 1);
+    Byte hi = fetchCode(lane, pc + 2);
+    switch (cpu::addressingMode(opcode)) {
+        case cpu::Immediate:
+        case cpu::ZeroPage:
+        case cpu::ZeroPageX:
+        case cpu::ZeroPageY:
+        case cpu::IndirectX:
+        case cpu::IndirectY:
+            return lo;
+        case cpu::Absolute:
+        case cpu::AbsoluteX:
+        case cpu::AbsoluteY:
+        case cpu::Indirect:
+            return lo | (hi << 8);
+        case cpu::Relative:
+            return pc + 2 + (int8_t)lo;
+        default:
+            return 0;
+    }
+}
+
+// Runs one instruction for every lane queued at the lowest PC, then queues
+// them again at their new PCs unless their budget is spent. Returns false
+// once no lane is left.
+bool BatchCpu::step(Regs r) {
+    int lowest = lowestQueued();
+    if (lowest < 0) return false;
+    Word pc = (Word)lowest;
+
+    size_t n = 0;
+    for (uint32_t l = head[pc]; l != NO_LANE; l = link[l]) group[n++] = l;
+    head[pc] = NO_LANE;
+    queued[pc >> 6] &= ~(1ull << (pc & 63));
+    if (!queued[pc >> 6]) queuedWords[pc >> 12] &= ~(1ull << ((pc >> 6) & 63));
+
+    if (n == count && codeShared(pc)) {
+        runConverged(r, pc);
+        return true;
+    }
+
+    // Lanes sharing the leader's code pages run the same instruction; any
+    // other lane compares bytes and, if its code was modified, is queued
+    // again to run in a later step with itself as leader.
+    size_t leader = group[0];
+    Byte opcode = fetchCode(leader, pc);
+    Byte length = cpu::instructionLength(opcode);
+    Word last = pc + length - 1;
+    const Byte* firstPage = pages[(pc >> 8) * count + leader];
+    const Byte* lastPage = pages[(last >> 8) * count + leader];
+    size_t kept = codeShared(pc) ? n : 0;
+    for (size_t i = kept; i < n; ++i) {
+        uint32_t l = group[i];
+        bool same = pages[(pc >> 8) * count + l] == firstPage && pages[(last >> 8) * count + l] == lastPage;
+        if (!same) {
+            same = true;
+            for (Byte k = 0; k < length; ++k) {
+                if (fetchCode(l, pc + k) != fetchCode(leader, pc + k)) same = false;
+            }
+        }
+        if (same) group[kept++] = l;
+        else enqueue(l, pc);
+    }
+
+    SomeLanes g = { group.data(), kept };
+    execute(r, g, opcode, decodeOperand(leader, pc, opcode), pc + length);
+    for (size_t i = 0; i < kept; ++i) {
+        uint32_t l = group[i];
+        if (r.cycles[l] < target[l]) enqueue(l, r.PC[l]);
+    }
+    ++stepCount;
+    laneCount += kept;
+    return true;
+}
+
+// Every lane is at pc: run them as one dense group, without the queues,
+// until they split up or one of them reaches its budget. The budget check
+// works on the smallest remaining budget across lanes, lowered by each
+// instruction's worst case, so only the PCs are compared every step.
+void BatchCpu::runConverged(Regs r, Word pc) {
+    AllLanes g = { count };
+    const Word* __restrict lanePC = r.PC;
+    uint64_t slack = remainingBudget(r);
+    for (;;) {
+        Byte opcode = fetchCode(0, pc);
+        execute(r, g, opcode, decodeOperand(0, pc, opcode), pc + cpu::instructionLength(opcode));
+        ++stepCount;
+        laneCount += count;
+
+        uint64_t worst = cpu::baseCycles(opcode) + 2; // page-cross and branch penalties
+        if (slack <= worst) {
+            slack = remainingBudget(r);
+            if (!slack) break;
+        } else {
+            slack -= worst;
+        }
+        pc = lanePC[0];
+        Word split = 0;
+        for (size_t l = 0; l < count; ++l) split |= lanePC[l] ^ pc;
+        if (split || !codeShared(pc)) break;
+    }
+    for (size_t l = 0; l < count; ++l) {
+        if (r.cycles[l] < target[l]) enqueue((uint32_t)l, r.PC[l]);
+    }
+}
+
+// Smallest number of cycles any lane has left, zero if one is done.
+uint64_t BatchCpu::remainingBudget(const Regs& r) const {
+    uint64_t least = ~0ull;
+    for (size_t l = 0; l < count; ++l) {
+        uint64_t left = r.cycles[l] < target[l] ? target[l] - r.cycles[l] : 0;
+        least = std::min(least, left);
+    }
+    return least;
+}
+
+template <typename Lanes>
+void BatchCpu::execute(Regs r, const Lanes& g, Byte opcode, Word operand, Word next) {
+    Word* __restrict lanePC = r.PC;
+    uint64_t* __restrict laneCycles = r.cycles;
+    for (size_t i = 0; i < g.n; ++i) lanePC[g[i]] = next;
+    switch (opcode) {
+#define OPCODE(code, name, mode, cyc) case code: ins_##name<cpu::mode>(r, g, operand); break;
+#include "opcodes.def"
+#undef OPCODE
+    }
+    Byte base = cpu::baseCycles(opcode);
+    for (size_t i = 0; i < g.n; ++i) laneCycles[g[i]] += base;
+}
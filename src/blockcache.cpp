@@ -0,0 +1,51 @@
+#include "blockcache.h"
+#include <algorithm>
+#include <cstring>
+
+BlockCache::BlockCache() {
+    std::memset(pageHasCode, 0, sizeof(pageHasCode));
+}
+
+// Lookup tables are allocated for the pages code actually starts in.
+std::unique_ptr<Block>& BlockCache::slot(Word start) {
+    std::unique_ptr<BlockPage>& page = blocks[start >> 8];
+    if (!page) page.reset(new BlockPage());
+    return page->at[start & 0xFF];
+}
+
+Block* BlockCache::insert(std::unique_ptr<Block> block) {
+    Word start = block->start;
+    Byte first = start >> 8;
+    Byte last = block->end >> 8;
+    pageBlocks[first].push_back(start);
+    pageHasCode[first] = 1;
+    if (last != first) {
+        pageBlocks[last].push_back(start);
+        pageHasCode[last] = 1;
+    }
+    std::unique_ptr<Block>& entry = slot(start);
+    entry = std::move(block);
+    return entry.get();
+}
+
+void BlockCache::invalidatePage(Byte page) {
+    std::vector<Word> starts;
+    starts.swap(pageBlocks[page]);
+    pageHasCode[page] = 0;
+    for (Word start : starts) {
+        std::unique_ptr<Block>& block = slot(start);
+        if (!block) continue;
+        Byte first = start >> 8;
+        Byte last = block->end >> 8;
+        if (first != page) unlinkPage(first, start);
+        if (last != page && last != first) unlinkPage(last, start);
+        block->valid = false;
+        retired.push_back(std::move(block));
+    }
+}
+
+void BlockCache::unlinkPage(Byte page, Word start) {
+    std::vector<Word>& list = pageBlocks[page];
+    list.erase(std::remove(list.begin(), list.end(), start), list.end());
+    if (list.empty()) pageHasCode[page] = 0;
+}
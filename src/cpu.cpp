@@ -1,8 +1,79 @@
 #include "cpu.h"
-#include <iostream>
+#include "blockcache.h"
+#include "jit.h"
+#include "loader.h"
+#include "snapshot.h"
+#include "profiler.h"
+#include "debugger.h"
+#include "scheduler.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
 
-cpu::cpu() : PC(0x0000) {
-    initInstructionTable();
+static const Byte noCodePages[256] = {};
+
+// Longest run of instructions decoded into one block.
+static const size_t MAX_BLOCK_OPS = 64;
+
+// Executions of a block before it is handed to the JIT.
+static const uint32_t JIT_THRESHOLD = 32;
+
+static const char* const mnemonics[256] = {
+#define OPCODE(code, name, mode, cyc) #name,
+#include "opcodes.def"
+#undef OPCODE
+};
+
+// All-zero memory, which a null statePages entry stands for so that setting
+// up a machine touches no reference counts.
+static const std::shared_ptr<const MemoryPage>& zeroPage() {
+    static const std::shared_ptr<const MemoryPage> page = std::make_shared<MemoryPage>();
+    return page;
+}
+
+// The most recent program given to loadAt0600AndSetReset() and the pages it
+// produced on top of zeroed memory, shared by every machine that loads it.
+static std::mutex imageLock;
+static std::vector<Byte> imageProgram;
+static std::shared_ptr<const MemoryPage> imagePages[256];
+
+cpu::cpu() : tracer(nullptr), profiler(nullptr), debugger(nullptr), blockCacheEnabled(true), codePages(noCodePages) {
+    clear();
+}
+
+cpu::~cpu() {}
+
+void cpu::clear() {
+    PC = 0x0000;
+    SP = A = X = Y = P = 0;
+    unpackFlags();
+    cycles = 0;
+    instructions = 0;
+    unknownOpcodes = 0;
+    tracer = nullptr;
+    profiler = nullptr;
+    if (debugger) debugger->machine = nullptr;
+    debugger = nullptr;
+    sliceEnd = 0;
+    if (events) events->clear();
+    irqLines = 0;
+    nmiPending = false;
+    waited = false;
+    std::fill(fusedHits, fusedHits + FUSED_FORMS, 0);
+    devices.clear();
+    blockCacheEnabled = true;
+    jit.reset();
+    blockCache.reset();
+    codePages = noCodePages;
+    for (int page = 0; page < 256; ++page) {
+        pageRom[page] = false;
+        if (statePages[page]) statePages[page].reset();
+        pageClean[page] = true;
+        pageShared[page] = true;
+        refreshPage(page);
+    }
 }
 
 void cpu::reset() {
@@ -13,24 +84,202 @@ void cpu::reset() {
 }
 
 void cpu::loadAt0600AndSetReset(const std::vector<Byte>& program) {
+    if (loadShared(program)) return;
     for (size_t i = 0; i < program.size(); ++i) {
-        write(0x0600 + i, program[i]);
+        poke(0x0600 + i, program[i]);
     }
-    write(0xFFFC, 0x00);
-    write(0xFFFD, 0x06);
+    poke(0xFFFC, 0x00);
+    poke(0xFFFD, 0x06);
 }
 
-void cpu::execute() {
-    Byte opcode = read(PC++);
-    instructionTable[opcode]();
+// Installs the program's pages without copying anything, provided every page
+// it touches is still the zero page; otherwise leaves memory alone.
+bool cpu::loadShared(const std::vector<Byte>& program) {
+    std::lock_guard<std::mutex> lock(imageLock);
+    if (program != imageProgram || !imagePages[0xFF]) {
+        std::shared_ptr<MemoryPage> pages[256];
+        for (size_t i = 0; i < program.size(); ++i) {
+            Word address = 0x0600 + i;
+            if (!pages[address >> 8]) pages[address >> 8] = std::make_shared<MemoryPage>();
+            pages[address >> 8]->bytes[address & 0xFF] = program[i];
+        }
+        if (!pages[0xFF]) pages[0xFF] = std::make_shared<MemoryPage>();
+        pages[0xFF]->bytes[0xFC] = 0x00;
+        pages[0xFF]->bytes[0xFD] = 0x06;
+        for (int page = 0; page < 256; ++page) imagePages[page] = pages[page];
+        imageProgram = program;
+    }
+    return sharePages(imagePages);
+}
+
+// Points every page that has an entry in `pages` at it, provided all of them
+// are still the zero page; otherwise leaves memory alone.
+bool cpu::sharePages(const std::shared_ptr<const MemoryPage>* pages) {
+    for (int page = 0; page < 256; ++page) {
+        if (pages[page] && !(pageShared[page] && stateBytes(page) == zeroPage()->bytes)) return false;
+    }
+    for (int page = 0; page < 256; ++page) {
+        if (!pages[page]) continue;
+        statePages[page] = pages[page];
+        if (codePages[page]) invalidateCode(page << 8);
+        refreshPage(page);
+    }
+    return true;
+}
+
+void cpu::loadImage(const RomImage& image) {
+    if (!sharePages(image.pages)) {
+        for (size_t i = 0; i < image.segments.size(); ++i) {
+            const RomSegment& segment = image.segments[i];
+            for (uint32_t a = segment.address; a < segment.address + segment.length; ++a) {
+                poke((Word)a, image.pages[a >> 8]->bytes[a & 0xFF]);
+            }
+        }
+    }
+    // Only the pages a segment covers whole: a page it shares with RAM the
+    // image leaves undefined stays writable.
+    for (size_t i = 0; i < image.segments.size(); ++i) {
+        const RomSegment& segment = image.segments[i];
+        const uint32_t first = (segment.address + 0xFF) >> 8, end = (segment.address + segment.length) >> 8;
+        if (segment.rom && first < end) mapRom(first, end - 1);
+    }
+}
+
+void cpu::mapRom(Byte firstPage, Byte lastPage) {
+    flushCode();
+    for (int page = firstPage; page <= lastPage; ++page) {
+        pageRom[page] = true;
+        refreshPage(page);
+    }
+}
+
+void cpu::attachDevice(const Device& device) {
+    flushCode();
+    devices.push_back(device);
+    for (int page = device.first >> 8; page <= device.last >> 8; ++page) refreshPage(page);
+}
+
+void cpu::poke(Word address, Byte value) {
+    markDirty(address >> 8);
+    pageData[address >> 8][address & 0xFF] = value;
+    if (codePages[address >> 8]) invalidateCode(address);
+}
+
+size_t cpu::privatePages() const {
+    size_t count = 0;
+    for (int page = 0; page < 256; ++page) count += !pageShared[page];
+    return count;
+}
+
+// First change to a clean page. A shared page gets a private copy to write
+// into; the buffer is reused if this machine had one for the page before.
+void cpu::makePrivate(Byte page) {
+    if (pageShared[page]) {
+        if (!ownPages[page]) ownPages[page].reset(new MemoryPage);
+        std::memcpy(ownPages[page]->bytes, stateBytes(page), sizeof(MemoryPage));
+        pageShared[page] = false;
+    }
+    pageClean[page] = false;
+    refreshPage(page);
+}
+
+const Device* cpu::deviceAt(Word address) const {
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (address >= devices[i].first && address <= devices[i].last) return &devices[i];
+    }
+    return nullptr;
+}
+
+Byte cpu::readSlow(Word address) const {
+    if (debugger) debugger->access(address, false);
+    const Device* device = deviceAt(address);
+    if (device && device->read) return device->read(address);
+    return peek(address);
+}
+
+void cpu::writeSlow(Word address, Byte value) {
+    if (tracer) tracer->write(address, value);
+    if (debugger) debugger->access(address, true);
+    if (const Device* device = deviceAt(address)) {
+        if (device->write) device->write(address, value);
+        return;
+    }
+    if (pageRom[address >> 8]) return;
+    markDirty(address >> 8);
+    pageData[address >> 8][address & 0xFF] = value;
+    if (codePages[address >> 8]) invalidateCode(address);
+}
+
+const Byte* cpu::stateBytes(Byte page) const {
+    const MemoryPage* shared = statePages[page].get();
+    return shared ? shared->bytes : zeroPage()->bytes;
+}
+
+// Recomputes a page's fast-path limits from the memory map.
+void cpu::refreshPage(Byte page) {
+    uint16_t readLimit = 256;
+    uint16_t writeLimit = 256;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        int first = devices[i].first >> 8;
+        int last = devices[i].last >> 8;
+        if (page < first || page > last) continue;
+        uint16_t start = page == first ? (devices[i].first & 0xFF) : 0;
+        if (devices[i].read && start < readLimit) readLimit = start;
+        if (start < writeLimit) writeLimit = start;
+    }
+    pageData[page] = pageShared[page] ? const_cast<Byte*>(stateBytes(page)) : ownPages[page]->bytes;
+    if (debugger && debugger->watchesReads(page)) readLimit = 0;
+    pageReadLimit[page] = readLimit;
+    bool watched = pageRom[page] || codePages[page] || pageClean[page] || tracer ||
+                   (debugger && debugger->watchesWrites(page));
+    pageWriteLimit[page] = watched ? 0 : writeLimit;
+}
+
+// Drops all decoded and translated code, e.g. after the memory map changed.
+void cpu::flushCode() {
+    if (jit) jit->flush();
+    if (!blockCache) return;
+    blockCache.reset();
+    codePages = noCodePages;
+    for (int page = 0; page < 256; ++page) refreshPage(page);
 }
 
-Byte cpu::read(Word address) const {
-    return memory[address];
+void cpu::saveState(Snapshot& state) {
+    for (int page = 0; page < 256; ++page) {
+        if (!pageClean[page]) {
+            std::shared_ptr<MemoryPage> copy = std::make_shared<MemoryPage>();
+            std::memcpy(copy->bytes, pageData[page], sizeof(copy->bytes));
+            statePages[page] = copy;
+            pageClean[page] = true;
+            refreshPage(page);
+        }
+        state.pages[page] = statePages[page] ? statePages[page] : zeroPage();
+    }
+    state.PC = PC;
+    state.SP = SP;
+    state.A = A;
+    state.X = X;
+    state.Y = Y;
+    state.P = P;
+    state.cycles = cycles;
 }
 
-void cpu::write(Word address, Byte value) {
-    memory[address] = value;
+void cpu::loadState(const Snapshot& state) {
+    for (int page = 0; page < 256; ++page) {
+        if (pageClean[page] && statePages[page] == state.pages[page]) continue;
+        statePages[page] = state.pages[page];
+        pageClean[page] = true;
+        pageShared[page] = true;
+        if (codePages[page]) invalidateCode(page << 8);
+        refreshPage(page);
+    }
+    PC = state.PC;
+    SP = state.SP;
+    A = state.A;
+    X = state.X;
+    Y = state.Y;
+    P = state.P;
+    cycles = state.cycles;
 }
 
 void cpu::setFlag(StatusFlags flag, bool value) {
@@ -42,50 +291,64 @@ bool cpu::getFlag(StatusFlags flag) const {
     return (P & flag) != 0;
 }
 
-Word cpu::getAddress(AddressingMode mode) {
+template <cpu::AddressingMode mode>
+CPU_ALWAYS_INLINE Word cpu::operand() {
     switch (mode) {
         case Immediate:
-            return PC++;
         case ZeroPage:
-            return read(PC++);
         case ZeroPageX:
-            return (read(PC++) + X) & 0xFF;
         case ZeroPageY:
-            return (read(PC++) + Y) & 0xFF;
-        case Absolute: {
-            Byte lo = read(PC++);
-            Byte hi = read(PC++);
+        case IndirectX:
+        case IndirectY:
+            return fetchCode(PC++);
+        case Absolute:
+        case AbsoluteX:
+        case AbsoluteY:
+        case Indirect: {
+            Byte lo = fetchCode(PC++);
+            Byte hi = fetchCode(PC++);
             return lo | (hi << 8);
         }
-        case AbsoluteX: {
-            Byte lo = read(PC++);
-            Byte hi = read(PC++);
-            return ((hi << 8) | lo) + X;
-        }
-        case AbsoluteY: {
-            Byte lo = read(PC++);
-            Byte hi = read(PC++);
-            return ((hi << 8) | lo) + Y;
+        case Relative: {
+            Byte offset = fetchCode(PC++);
+            return PC + (int8_t)offset;
         }
+        default:
+            return 0;
+    }
+}
+
+template <cpu::AddressingMode mode, bool pagePenalty>
+CPU_ALWAYS_INLINE Word cpu::getAddress(Word operand) {
+    switch (mode) {
+        case ZeroPage:
+        case Absolute:
+            return operand;
+        case ZeroPageX:
+            return (operand + X) & 0xFF;
+        case ZeroPageY:
+            return (operand + Y) & 0xFF;
+        case AbsoluteX:
+            if (pagePenalty && (operand & 0xFF) + X > 0xFF) cycles++;
+            return operand + X;
+        case AbsoluteY:
+            if (pagePenalty && (operand & 0xFF) + Y > 0xFF) cycles++;
+            return operand + Y;
         case Indirect: {
-            Byte lo = read(PC++);
-            Byte hi = read(PC++);
-            Word addr = lo | (hi << 8);
-            if ((addr & 0x00FF) == 0x00FF) { // 6502 page boundary bug
-                return read(addr) | (read(addr & 0xFF00) << 8);
+            if ((operand & 0x00FF) == 0x00FF) { // 6502 page boundary bug
+                return read(operand) | (read(operand & 0xFF00) << 8);
             }
-            return read(addr) | (read(addr + 1) << 8);
+            return read(operand) | (read(operand + 1) << 8);
         }
         case IndirectX: {
-            Byte zpAddr = read(PC++);
-            Byte lo = read((zpAddr + X) & 0xFF);
-            Byte hi = read((zpAddr + X + 1) & 0xFF);
+            Byte lo = read((operand + X) & 0xFF);
+            Byte hi = read((operand + X + 1) & 0xFF);
             return lo | (hi << 8);
         }
         case IndirectY: {
-            Byte zpAddr = read(PC++);
-            Byte lo = read(zpAddr);
-            Byte hi = read((zpAddr + 1) & 0xFF);
+            Byte lo = read(operand);
+            Byte hi = read((operand + 1) & 0xFF);
+            if (pagePenalty && lo + Y > 0xFF) cycles++;
             return ((hi << 8) | lo) + Y;
         }
         default:
@@ -93,22 +356,32 @@ Word cpu::getAddress(AddressingMode mode) {
     }
 }
 
-Byte cpu::fetch(AddressingMode mode) {
+template <cpu::AddressingMode mode>
+CPU_ALWAYS_INLINE Byte cpu::fetch(Word operand) {
     if (mode == Accumulator) {
         return A;
     }
-    return read(getAddress(mode));
+    if (mode == Immediate) {
+        return operand & 0xFF;
+    }
+    return read(getAddress<mode, true>(operand));
 }
 
 void cpu::setZN(Byte value) {
-    setFlag(Z, value == 0);
-    setFlag(N, value & 0x80);
+    zResult = nResult = value;
+}
+
+void cpu::branch(bool condition, Word target) {
+    if (condition) {
+        cycles += ((target ^ PC) & 0xFF00) ? 2 : 1;
+        PC = target;
+    }
 }
 
 void cpu::op_ADC(Byte value) {
-    Word sum = A + value + (getFlag(C) ? 1 : 0);
-    setFlag(C, sum > 0xFF);
-    setFlag(V, (~(A ^ value) & (A ^ sum) & 0x80) != 0);
+    Word sum = A + value + (P & C);
+    Byte overflow = (~(A ^ value) & (A ^ sum) & 0x80) >> 1;
+    P = (P & ~(C | V)) | (sum >> 8) | overflow;
     A = sum & 0xFF;
     setZN(A);
 }
@@ -121,218 +394,670 @@ void cpu::op_AND(Byte value) { A &= value; setZN(A); }
 void cpu::op_EOR(Byte value) { A ^= value; setZN(A); }
 void cpu::op_ORA(Byte value) { A |= value; setZN(A); }
 
-void cpu::op_ASL(Byte& value) { setFlag(C, value & 0x80); value <<= 1; setZN(value); }
-void cpu::op_LSR(Byte& value) { setFlag(C, value & 0x01); value >>= 1; setZN(value); }
-void cpu::op_ROL(Byte& value) { bool carry = getFlag(C); setFlag(C, value & 0x80); value <<= 1; value |= (carry ? 1 : 0); setZN(value); }
-void cpu::op_ROR(Byte& value) { bool carry = getFlag(C); setFlag(C, value & 0x01); value >>= 1; value |= (carry ? 0x80 : 0); setZN(value); }
+void cpu::op_ASL(Byte& value) { P = (P & ~C) | (value >> 7); value <<= 1; setZN(value); }
+void cpu::op_LSR(Byte& value) { P = (P & ~C) | (value & C); value >>= 1; setZN(value); }
+void cpu::op_ROL(Byte& value) { Byte carry = P & C; P = (P & ~C) | (value >> 7); value = (value << 1) | carry; setZN(value); }
+void cpu::op_ROR(Byte& value) { Byte carry = P & C; P = (P & ~C) | (value & C); value = (value >> 1) | (carry << 7); setZN(value); }
 
 void cpu::op_INC(Byte& value) { value++; setZN(value); }
 void cpu::op_DEC(Byte& value) { value--; setZN(value); }
 
-void cpu::op_CMP(Byte value) { setFlag(C, A >= value); setZN(A - value); }
-void cpu::op_CPX(Byte value) { setFlag(C, X >= value); setZN(X - value); }
-void cpu::op_CPY(Byte value) { setFlag(C, Y >= value); setZN(Y - value); }
+void cpu::op_CMP(Byte value) { P = (P & ~C) | (A >= value); setZN(A - value); }
+void cpu::op_CPX(Byte value) { P = (P & ~C) | (X >= value); setZN(X - value); }
+void cpu::op_CPY(Byte value) { P = (P & ~C) | (Y >= value); setZN(Y - value); }
 
-void cpu::op_BIT(Byte value) { setFlag(Z, (A & value) == 0); setFlag(N, value & 0x80); setFlag(V, value & 0x40); }
+void cpu::op_BIT(Byte value) { zResult = A & value; nResult = value; P = (P & ~V) | (value & V); }
 
-template <void (cpu::*op)(Byte)>
-void cpu::ins_read(AddressingMode mode) {
-    (this->*op)(fetch(mode));
+template <void (cpu::*op)(Byte), cpu::AddressingMode mode>
+void cpu::ins_read(Word operand) {
+    (this->*op)(fetch<mode>(operand));
 }
 
-template <void (cpu::*op)(Byte&)>
-void cpu::ins_rmw(AddressingMode mode) {
+template <void (cpu::*op)(Byte&), cpu::AddressingMode mode>
+void cpu::ins_rmw(Word operand) {
     if (mode == Accumulator) {
         (this->*op)(A);
     } else {
-        Word addr = getAddress(mode);
+        Word addr = getAddress<mode>(operand);
         Byte value = read(addr);
         (this->*op)(value);
         write(addr, value);
     }
 }
 
-void cpu::initInstructionTable() {
-    for (int i = 0; i < 256; i++) instructionTable[i] = [this](){ opcodeUnknown(); };
-
-    // Load
-    instructionTable[0xA9] = [this](){ A = fetch(Immediate); setZN(A); };
-    instructionTable[0xA5] = [this](){ A = fetch(ZeroPage); setZN(A); };
-    instructionTable[0xB5] = [this](){ A = fetch(ZeroPageX); setZN(A); };
-    instructionTable[0xAD] = [this](){ A = fetch(Absolute); setZN(A); };
-    instructionTable[0xBD] = [this](){ A = fetch(AbsoluteX); setZN(A); };
-    instructionTable[0xB9] = [this](){ A = fetch(AbsoluteY); setZN(A); };
-    instructionTable[0xA1] = [this](){ A = fetch(IndirectX); setZN(A); };
-    instructionTable[0xB1] = [this](){ A = fetch(IndirectY); setZN(A); };
-    instructionTable[0xA2] = [this](){ X = fetch(Immediate); setZN(X); };
-    instructionTable[0xA6] = [this](){ X = fetch(ZeroPage); setZN(X); };
-    instructionTable[0xB6] = [this](){ X = fetch(ZeroPageY); setZN(X); };
-    instructionTable[0xAE] = [this](){ X = fetch(Absolute); setZN(X); };
-    instructionTable[0xBE] = [this](){ X = fetch(AbsoluteY); setZN(X); };
-    instructionTable[0xA0] = [this](){ Y = fetch(Immediate); setZN(Y); };
-    instructionTable[0xA4] = [this](){ Y = fetch(ZeroPage); setZN(Y); };
-    instructionTable[0xB4] = [this](){ Y = fetch(ZeroPageX); setZN(Y); };
-    instructionTable[0xAC] = [this](){ Y = fetch(Absolute); setZN(Y); };
-    instructionTable[0xBC] = [this](){ Y = fetch(AbsoluteX); setZN(Y); };
-
-    // Store
-    instructionTable[0x85] = [this](){ write(getAddress(ZeroPage), A); };
-    instructionTable[0x95] = [this](){ write(getAddress(ZeroPageX), A); };
-    instructionTable[0x8D] = [this](){ write(getAddress(Absolute), A); };
-    instructionTable[0x9D] = [this](){ write(getAddress(AbsoluteX), A); };
-    instructionTable[0x99] = [this](){ write(getAddress(AbsoluteY), A); };
-    instructionTable[0x81] = [this](){ write(getAddress(IndirectX), A); };
-    instructionTable[0x91] = [this](){ write(getAddress(IndirectY), A); };
-    instructionTable[0x86] = [this](){ write(getAddress(ZeroPage), X); };
-    instructionTable[0x96] = [this](){ write(getAddress(ZeroPageY), X); };
-    instructionTable[0x8E] = [this](){ write(getAddress(Absolute), X); };
-    instructionTable[0x84] = [this](){ write(getAddress(ZeroPage), Y); };
-    instructionTable[0x94] = [this](){ write(getAddress(ZeroPageX), Y); };
-    instructionTable[0x8C] = [this](){ write(getAddress(Absolute), Y); };
-
-    // Transfer
-    instructionTable[0xAA] = [this](){ X = A; setZN(X); };
-    instructionTable[0xA8] = [this](){ Y = A; setZN(Y); };
-    instructionTable[0xBA] = [this](){ X = SP; setZN(X); };
-    instructionTable[0x8A] = [this](){ A = X; setZN(A); };
-    instructionTable[0x9A] = [this](){ SP = X; };
-    instructionTable[0x98] = [this](){ A = Y; setZN(A); };
-
-    // Stack
-    instructionTable[0x48] = [this](){ write(0x0100 + SP--, A); };
-    instructionTable[0x08] = [this](){ write(0x0100 + SP--, P | B | U); };
-    instructionTable[0x68] = [this](){ A = read(0x0100 + ++SP); setZN(A); };
-    instructionTable[0x28] = [this](){ P = read(0x0100 + ++SP); P &= ~B; P |= U; };
-
-    // Arithmetic
-    instructionTable[0x69] = [this](){ ins_read<&cpu::op_ADC>(Immediate); };
-    instructionTable[0x65] = [this](){ ins_read<&cpu::op_ADC>(ZeroPage); };
-    instructionTable[0x75] = [this](){ ins_read<&cpu::op_ADC>(ZeroPageX); };
-    instructionTable[0x6D] = [this](){ ins_read<&cpu::op_ADC>(Absolute); };
-    instructionTable[0x7D] = [this](){ ins_read<&cpu::op_ADC>(AbsoluteX); };
-    instructionTable[0x79] = [this](){ ins_read<&cpu::op_ADC>(AbsoluteY); };
-    instructionTable[0x61] = [this](){ ins_read<&cpu::op_ADC>(IndirectX); };
-    instructionTable[0x71] = [this](){ ins_read<&cpu::op_ADC>(IndirectY); };
-    instructionTable[0xE9] = [this](){ ins_read<&cpu::op_SBC>(Immediate); };
-    instructionTable[0xE5] = [this](){ ins_read<&cpu::op_SBC>(ZeroPage); };
-    instructionTable[0xF5] = [this](){ ins_read<&cpu::op_SBC>(ZeroPageX); };
-    instructionTable[0xED] = [this](){ ins_read<&cpu::op_SBC>(Absolute); };
-    instructionTable[0xFD] = [this](){ ins_read<&cpu::op_SBC>(AbsoluteX); };
-    instructionTable[0xF9] = [this](){ ins_read<&cpu::op_SBC>(AbsoluteY); };
-    instructionTable[0xE1] = [this](){ ins_read<&cpu::op_SBC>(IndirectX); };
-    instructionTable[0xF1] = [this](){ ins_read<&cpu::op_SBC>(IndirectY); };
-
-    // Compare
-    instructionTable[0xC9] = [this](){ ins_read<&cpu::op_CMP>(Immediate); };
-    instructionTable[0xC5] = [this](){ ins_read<&cpu::op_CMP>(ZeroPage); };
-    instructionTable[0xD5] = [this](){ ins_read<&cpu::op_CMP>(ZeroPageX); };
-    instructionTable[0xCD] = [this](){ ins_read<&cpu::op_CMP>(Absolute); };
-    instructionTable[0xDD] = [this](){ ins_read<&cpu::op_CMP>(AbsoluteX); };
-    instructionTable[0xD9] = [this](){ ins_read<&cpu::op_CMP>(AbsoluteY); };
-    instructionTable[0xC1] = [this](){ ins_read<&cpu::op_CMP>(IndirectX); };
-    instructionTable[0xD1] = [this](){ ins_read<&cpu::op_CMP>(IndirectY); };
-    instructionTable[0xE0] = [this](){ ins_read<&cpu::op_CPX>(Immediate); };
-    instructionTable[0xE4] = [this](){ ins_read<&cpu::op_CPX>(ZeroPage); };
-    instructionTable[0xEC] = [this](){ ins_read<&cpu::op_CPX>(Absolute); };
-    instructionTable[0xC0] = [this](){ ins_read<&cpu::op_CPY>(Immediate); };
-    instructionTable[0xC4] = [this](){ ins_read<&cpu::op_CPY>(ZeroPage); };
-    instructionTable[0xCC] = [this](){ ins_read<&cpu::op_CPY>(Absolute); };
-
-    // Bitwise
-    instructionTable[0x29] = [this](){ ins_read<&cpu::op_AND>(Immediate); };
-    instructionTable[0x25] = [this](){ ins_read<&cpu::op_AND>(ZeroPage); };
-    instructionTable[0x35] = [this](){ ins_read<&cpu::op_AND>(ZeroPageX); };
-    instructionTable[0x2D] = [this](){ ins_read<&cpu::op_AND>(Absolute); };
-    instructionTable[0x3D] = [this](){ ins_read<&cpu::op_AND>(AbsoluteX); };
-    instructionTable[0x39] = [this](){ ins_read<&cpu::op_AND>(AbsoluteY); };
-    instructionTable[0x21] = [this](){ ins_read<&cpu::op_AND>(IndirectX); };
-    instructionTable[0x31] = [this](){ ins_read<&cpu::op_AND>(IndirectY); };
-    instructionTable[0x49] = [this](){ ins_read<&cpu::op_EOR>(Immediate); };
-    instructionTable[0x45] = [this](){ ins_read<&cpu::op_EOR>(ZeroPage); };
-    instructionTable[0x55] = [this](){ ins_read<&cpu::op_EOR>(ZeroPageX); };
-    instructionTable[0x4D] = [this](){ ins_read<&cpu::op_EOR>(Absolute); };
-    instructionTable[0x5D] = [this](){ ins_read<&cpu::op_EOR>(AbsoluteX); };
-    instructionTable[0x59] = [this](){ ins_read<&cpu::op_EOR>(AbsoluteY); };
-    instructionTable[0x41] = [this](){ ins_read<&cpu::op_EOR>(IndirectX); };
-    instructionTable[0x51] = [this](){ ins_read<&cpu::op_EOR>(IndirectY); };
-    instructionTable[0x09] = [this](){ ins_read<&cpu::op_ORA>(Immediate); };
-    instructionTable[0x05] = [this](){ ins_read<&cpu::op_ORA>(ZeroPage); };
-    instructionTable[0x15] = [this](){ ins_read<&cpu::op_ORA>(ZeroPageX); };
-    instructionTable[0x0D] = [this](){ ins_read<&cpu::op_ORA>(Absolute); };
-    instructionTable[0x1D] = [this](){ ins_read<&cpu::op_ORA>(AbsoluteX); };
-    instructionTable[0x19] = [this](){ ins_read<&cpu::op_ORA>(AbsoluteY); };
-    instructionTable[0x01] = [this](){ ins_read<&cpu::op_ORA>(IndirectX); };
-    instructionTable[0x11] = [this](){ ins_read<&cpu::op_ORA>(IndirectY); };
-    instructionTable[0x24] = [this](){ ins_read<&cpu::op_BIT>(ZeroPage); };
-    instructionTable[0x2C] = [this](){ ins_read<&cpu::op_BIT>(Absolute); };
-
-    // Increment/Decrement
-    instructionTable[0xE6] = [this](){ ins_rmw<&cpu::op_INC>(ZeroPage); };
-    instructionTable[0xF6] = [this](){ ins_rmw<&cpu::op_INC>(ZeroPageX); };
-    instructionTable[0xEE] = [this](){ ins_rmw<&cpu::op_INC>(Absolute); };
-    instructionTable[0xFE] = [this](){ ins_rmw<&cpu::op_INC>(AbsoluteX); };
-    instructionTable[0xE8] = [this](){ X++; setZN(X); };
-    instructionTable[0xC8] = [this](){ Y++; setZN(Y); };
-    instructionTable[0xC6] = [this](){ ins_rmw<&cpu::op_DEC>(ZeroPage); };
-    instructionTable[0xD6] = [this](){ ins_rmw<&cpu::op_DEC>(ZeroPageX); };
-    instructionTable[0xCE] = [this](){ ins_rmw<&cpu::op_DEC>(Absolute); };
-    instructionTable[0xDE] = [this](){ ins_rmw<&cpu::op_DEC>(AbsoluteX); };
-    instructionTable[0xCA] = [this](){ X--; setZN(X); };
-    instructionTable[0x88] = [this](){ Y--; setZN(Y); };
-
-    // Shift
-    instructionTable[0x0A] = [this](){ ins_rmw<&cpu::op_ASL>(Accumulator); };
-    instructionTable[0x06] = [this](){ ins_rmw<&cpu::op_ASL>(ZeroPage); };
-    instructionTable[0x16] = [this](){ ins_rmw<&cpu::op_ASL>(ZeroPageX); };
-    instructionTable[0x0E] = [this](){ ins_rmw<&cpu::op_ASL>(Absolute); };
-    instructionTable[0x1E] = [this](){ ins_rmw<&cpu::op_ASL>(AbsoluteX); };
-    instructionTable[0x4A] = [this](){ ins_rmw<&cpu::op_LSR>(Accumulator); };
-    instructionTable[0x46] = [this](){ ins_rmw<&cpu::op_LSR>(ZeroPage); };
-    instructionTable[0x56] = [this](){ ins_rmw<&cpu::op_LSR>(ZeroPageX); };
-    instructionTable[0x4E] = [this](){ ins_rmw<&cpu::op_LSR>(Absolute); };
-    instructionTable[0x5E] = [this](){ ins_rmw<&cpu::op_LSR>(AbsoluteX); };
-    instructionTable[0x2A] = [this](){ ins_rmw<&cpu::op_ROL>(Accumulator); };
-    instructionTable[0x26] = [this](){ ins_rmw<&cpu::op_ROL>(ZeroPage); };
-    instructionTable[0x36] = [this](){ ins_rmw<&cpu::op_ROL>(ZeroPageX); };
-    instructionTable[0x2E] = [this](){ ins_rmw<&cpu::op_ROL>(Absolute); };
-    instructionTable[0x3E] = [this](){ ins_rmw<&cpu::op_ROL>(AbsoluteX); };
-    instructionTable[0x6A] = [this](){ ins_rmw<&cpu::op_ROR>(Accumulator); };
-    instructionTable[0x66] = [this](){ ins_rmw<&cpu::op_ROR>(ZeroPage); };
-    instructionTable[0x76] = [this](){ ins_rmw<&cpu::op_ROR>(ZeroPageX); };
-    instructionTable[0x6E] = [this](){ ins_rmw<&cpu::op_ROR>(Absolute); };
-    instructionTable[0x7E] = [this](){ ins_rmw<&cpu::op_ROR>(AbsoluteX); };
-
-    // Jump
-    instructionTable[0x4C] = [this](){ PC = getAddress(Absolute); };
-    instructionTable[0x6C] = [this](){ PC = getAddress(Indirect); };
-    instructionTable[0x20] = [this](){ Word addr = getAddress(Absolute); Word returnAddr = PC - 1; write(0x0100 + SP--, (returnAddr >> 8) & 0xFF); write(0x0100 + SP--, returnAddr & 0xFF); PC = addr; };
-    instructionTable[0x60] = [this](){ Byte lo = read(0x0100 + ++SP); Byte hi = read(0x0100 + ++SP); PC = (lo | (hi << 8)) + 1; };
-
-    // Branch
-    instructionTable[0x90] = [this](){ Byte offset = read(PC++); if (!getFlag(C)) PC += (int8_t)offset; };
-    instructionTable[0xB0] = [this](){ Byte offset = read(PC++); if (getFlag(C)) PC += (int8_t)offset; };
-    instructionTable[0xF0] = [this](){ Byte offset = read(PC++); if (getFlag(Z)) PC += (int8_t)offset; };
-    instructionTable[0x30] = [this](){ Byte offset = read(PC++); if (getFlag(N)) PC += (int8_t)offset; };
-    instructionTable[0xD0] = [this](){ Byte offset = read(PC++); if (!getFlag(Z)) PC += (int8_t)offset; };
-    instructionTable[0x10] = [this](){ Byte offset = read(PC++); if (!getFlag(N)) PC += (int8_t)offset; };
-    instructionTable[0x50] = [this](){ Byte offset = read(PC++); if (!getFlag(V)) PC += (int8_t)offset; };
-    instructionTable[0x70] = [this](){ Byte offset = read(PC++); if (getFlag(V)) PC += (int8_t)offset; };
-
-    // Flag
-    instructionTable[0x18] = [this](){ setFlag(C, false); };
-    instructionTable[0xD8] = [this](){ setFlag(D, false); };
-    instructionTable[0x58] = [this](){ setFlag(I, false); };
-    instructionTable[0xB8] = [this](){ setFlag(V, false); };
-    instructionTable[0x38] = [this](){ setFlag(C, true); };
-    instructionTable[0xF8] = [this](){ setFlag(D, true); };
-    instructionTable[0x78] = [this](){ setFlag(I, true); };
-
-    // System
-    instructionTable[0x00] = [this](){ PC++; write(0x0100 + SP--, (PC >> 8) & 0xFF); write(0x0100 + SP--, PC & 0xFF); write(0x0100 + SP--, P | B | U); setFlag(B, true); PC = (read(0xFFFE) | (read(0xFFFF) << 8)); };
-    instructionTable[0xEA] = [](){};
-    instructionTable[0x40] = [this](){ P = read(0x0100 + ++SP); P &= ~B; P |= U; Byte lo = read(0x0100 + ++SP); Byte hi = read(0x0100 + ++SP); PC = (lo | (hi << 8)); };
+template <cpu::AddressingMode mode> void cpu::ins_LDA(Word operand) { A = fetch<mode>(operand); setZN(A); }
+template <cpu::AddressingMode mode> void cpu::ins_LDX(Word operand) { X = fetch<mode>(operand); setZN(X); }
+template <cpu::AddressingMode mode> void cpu::ins_LDY(Word operand) { Y = fetch<mode>(operand); setZN(Y); }
+
+template <cpu::AddressingMode mode> void cpu::ins_STA(Word operand) { write(getAddress<mode>(operand), A); }
+template <cpu::AddressingMode mode> void cpu::ins_STX(Word operand) { write(getAddress<mode>(operand), X); }
+template <cpu::AddressingMode mode> void cpu::ins_STY(Word operand) { write(getAddress<mode>(operand), Y); }
+
+template <cpu::AddressingMode mode> void cpu::ins_TAX(Word operand) { X = A; setZN(X); }
+template <cpu::AddressingMode mode> void cpu::ins_TAY(Word operand) { Y = A; setZN(Y); }
+template <cpu::AddressingMode mode> void cpu::ins_TSX(Word operand) { X = SP; setZN(X); }
+template <cpu::AddressingMode mode> void cpu::ins_TXA(Word operand) { A = X; setZN(A); }
+template <cpu::AddressingMode mode> void cpu::ins_TXS(Word operand) { SP = X; }
+template <cpu::AddressingMode mode> void cpu::ins_TYA(Word operand) { A = Y; setZN(A); }
+
+template <cpu::AddressingMode mode> void cpu::ins_PHA(Word operand) { write(0x0100 + SP--, A); }
+template <cpu::AddressingMode mode> void cpu::ins_PHP(Word operand) { packFlags(); write(0x0100 + SP--, P | B | U); }
+template <cpu::AddressingMode mode> void cpu::ins_PLA(Word operand) { A = read(0x0100 + ++SP); setZN(A); }
+template <cpu::AddressingMode mode> void cpu::ins_PLP(Word operand) { P = read(0x0100 + ++SP); P &= ~B; P |= U; unpackFlags(); pollIrq(); }
+
+template <cpu::AddressingMode mode> void cpu::ins_ADC(Word operand) { ins_read<&cpu::op_ADC, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_SBC(Word operand) { ins_read<&cpu::op_SBC, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_CMP(Word operand) { ins_read<&cpu::op_CMP, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_CPX(Word operand) { ins_read<&cpu::op_CPX, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_CPY(Word operand) { ins_read<&cpu::op_CPY, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_AND(Word operand) { ins_read<&cpu::op_AND, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_EOR(Word operand) { ins_read<&cpu::op_EOR, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_ORA(Word operand) { ins_read<&cpu::op_ORA, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BIT(Word operand) { ins_read<&cpu::op_BIT, mode>(operand); }
+
+template <cpu::AddressingMode mode> void cpu::ins_INC(Word operand) { ins_rmw<&cpu::op_INC, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_INX(Word operand) { X++; setZN(X); }
+template <cpu::AddressingMode mode> void cpu::ins_INY(Word operand) { Y++; setZN(Y); }
+template <cpu::AddressingMode mode> void cpu::ins_DEC(Word operand) { ins_rmw<&cpu::op_DEC, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_DEX(Word operand) { X--; setZN(X); }
+template <cpu::AddressingMode mode> void cpu::ins_DEY(Word operand) { Y--; setZN(Y); }
+
+template <cpu::AddressingMode mode> void cpu::ins_ASL(Word operand) { ins_rmw<&cpu::op_ASL, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_LSR(Word operand) { ins_rmw<&cpu::op_LSR, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_ROL(Word operand) { ins_rmw<&cpu::op_ROL, mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_ROR(Word operand) { ins_rmw<&cpu::op_ROR, mode>(operand); }
+
+template <cpu::AddressingMode mode> void cpu::ins_JMP(Word operand) { PC = getAddress<mode>(operand); }
+template <cpu::AddressingMode mode> void cpu::ins_JSR(Word operand) { Word returnAddr = PC - 1; write(0x0100 + SP--, (returnAddr >> 8) & 0xFF); write(0x0100 + SP--, returnAddr & 0xFF); PC = operand; }
+template <cpu::AddressingMode mode> void cpu::ins_RTS(Word operand) { Byte lo = read(0x0100 + ++SP); Byte hi = read(0x0100 + ++SP); PC = (lo | (hi << 8)) + 1; }
+
+template <cpu::AddressingMode mode> void cpu::ins_BCC(Word operand) { branch(!getFlag(C), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BCS(Word operand) { branch(getFlag(C), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BEQ(Word operand) { branch(zero(), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BMI(Word operand) { branch(negative(), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BNE(Word operand) { branch(!zero(), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BPL(Word operand) { branch(!negative(), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BVC(Word operand) { branch(!getFlag(V), operand); }
+template <cpu::AddressingMode mode> void cpu::ins_BVS(Word operand) { branch(getFlag(V), operand); }
+
+template <cpu::AddressingMode mode> void cpu::ins_CLC(Word operand) { setFlag(C, false); }
+template <cpu::AddressingMode mode> void cpu::ins_CLD(Word operand) { setFlag(D, false); }
+template <cpu::AddressingMode mode> void cpu::ins_CLI(Word operand) { setFlag(I, false); pollIrq(); }
+template <cpu::AddressingMode mode> void cpu::ins_CLV(Word operand) { setFlag(V, false); }
+template <cpu::AddressingMode mode> void cpu::ins_SEC(Word operand) { setFlag(C, true); }
+template <cpu::AddressingMode mode> void cpu::ins_SED(Word operand) { setFlag(D, true); }
+template <cpu::AddressingMode mode> void cpu::ins_SEI(Word operand) { setFlag(I, true); }
+
+template <cpu::AddressingMode mode> void cpu::ins_BRK(Word operand) { PC++; packFlags(); write(0x0100 + SP--, (PC >> 8) & 0xFF); write(0x0100 + SP--, PC & 0xFF); write(0x0100 + SP--, P | B | U); setFlag(I, true); PC = (read(0xFFFE) | (read(0xFFFF) << 8)); }
+template <cpu::AddressingMode mode> void cpu::ins_NOP(Word operand) {}
+template <cpu::AddressingMode mode> void cpu::ins_RTI(Word operand) { P = read(0x0100 + ++SP); P &= ~B; P |= U; unpackFlags(); Byte lo = read(0x0100 + ++SP); Byte hi = read(0x0100 + ++SP); PC = (lo | (hi << 8)); pollIrq(); }
+template <cpu::AddressingMode mode> void cpu::ins_UNK(Word operand) { opcodeUnknown(); }
+
+const cpu::OpInfo cpu::opTable[256] = {
+#define OPCODE(code, name, mode, cyc) { &cpu::thunk<&cpu::ins_##name<mode> >, &cpu::decode<mode>, cyc },
+#include "opcodes.def"
+#undef OPCODE
+};
+
+// Runs two adjacent decoded ops back to back. None of the first halves look
+// at PC, so it is set once for the second (branches measure page crossings
+// from it).
+template <void (cpu::*first)(Word), void (cpu::*second)(Word)>
+void cpu::fuse(cpu& c, const DecodedOp* op) {
+    c.PC = op[1].next;
+    (c.*first)(op[0].operand);
+    (c.*second)(op[1].operand);
+    c.cycles += op[0].cycles + op[1].cycles;
+}
+
+#define FUSE(code1, name1, mode1, code2, name2, mode2) \
+    { code1, code2, &cpu::fuse<&cpu::ins_##name1<mode1>, &cpu::ins_##name2<mode2> > }
+
+const cpu::FusedForm cpu::fusedForms[FUSED_FORMS] = {
+    { 0, 0, nullptr },
+    FUSE(0xA9, LDA, Immediate, 0x85, STA, ZeroPage),
+    FUSE(0xC9, CMP, Immediate, 0xD0, BNE, Relative),
+    FUSE(0xC9, CMP, Immediate, 0xF0, BEQ, Relative),
+    FUSE(0xC5, CMP, ZeroPage, 0xD0, BNE, Relative),
+    FUSE(0xC5, CMP, ZeroPage, 0xF0, BEQ, Relative),
+    FUSE(0xE0, CPX, Immediate, 0xD0, BNE, Relative),
+    FUSE(0xE0, CPX, Immediate, 0xF0, BEQ, Relative),
+    FUSE(0xE4, CPX, ZeroPage, 0xD0, BNE, Relative),
+    FUSE(0xE4, CPX, ZeroPage, 0xF0, BEQ, Relative),
+    FUSE(0xC0, CPY, Immediate, 0xD0, BNE, Relative),
+    FUSE(0xC0, CPY, Immediate, 0xF0, BEQ, Relative),
+    FUSE(0xC4, CPY, ZeroPage, 0xD0, BNE, Relative),
+    FUSE(0xC4, CPY, ZeroPage, 0xF0, BEQ, Relative),
+    FUSE(0xCA, DEX, Implied, 0xD0, BNE, Relative),
+    FUSE(0x88, DEY, Implied, 0xD0, BNE, Relative),
+    FUSE(0x18, CLC, Implied, 0x69, ADC, Immediate),
+    FUSE(0x18, CLC, Implied, 0x65, ADC, ZeroPage),
+    FUSE(0x18, CLC, Implied, 0x75, ADC, ZeroPageX),
+    FUSE(0x18, CLC, Implied, 0x6D, ADC, Absolute),
+    FUSE(0x18, CLC, Implied, 0x7D, ADC, AbsoluteX),
+    FUSE(0x18, CLC, Implied, 0x79, ADC, AbsoluteY),
+    FUSE(0x18, CLC, Implied, 0x61, ADC, IndirectX),
+    FUSE(0x18, CLC, Implied, 0x71, ADC, IndirectY),
+    FUSE(0x38, SEC, Implied, 0xE9, SBC, Immediate),
+    FUSE(0x38, SEC, Implied, 0xE5, SBC, ZeroPage),
+    FUSE(0x38, SEC, Implied, 0xF5, SBC, ZeroPageX),
+    FUSE(0x38, SEC, Implied, 0xED, SBC, Absolute),
+    FUSE(0x38, SEC, Implied, 0xFD, SBC, AbsoluteX),
+    FUSE(0x38, SEC, Implied, 0xF9, SBC, AbsoluteY),
+    FUSE(0x38, SEC, Implied, 0xE1, SBC, IndirectX),
+    FUSE(0x38, SEC, Implied, 0xF1, SBC, IndirectY),
+};
+
+#undef FUSE
+
+// Branches, jumps, calls, returns and unknown opcodes end a basic block, as
+// do CLI and PLP, which may let a pending IRQ in.
+static bool endsBlock(Byte opcode) {
+    switch (opcode) {
+        case 0x00: case 0x20: case 0x40: case 0x4C: case 0x60: case 0x6C:
+        case 0x28: case 0x58:
+        case 0x10: case 0x30: case 0x50: case 0x70:
+        case 0x90: case 0xB0: case 0xD0: case 0xF0:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void cpu::execute() {
+    unpackFlags();
+    step();
+    packFlags();
+}
+
+void cpu::step() {
+    Byte opcode = fetchCode(PC++);
+#if CPU_DISPATCH == CPU_DISPATCH_TABLE
+    instructionTable[opcode](*this);
+    cycles += opTable[opcode].cycles;
+#elif CPU_DISPATCH == CPU_DISPATCH_SWITCH
+    switch (opcode) {
+#define OPCODE(code, name, mode, cyc) case code: ins_##name<mode>(operand<mode>()); cycles += cyc; break;
+#include "opcodes.def"
+#undef OPCODE
+    }
+#elif CPU_DISPATCH == CPU_DISPATCH_THREADED
+    static void* const labels[256] = {
+#define OPCODE(code, name, mode, cyc) &&op_##code,
+#include "opcodes.def"
+#undef OPCODE
+    };
+    goto *labels[opcode];
+#define OPCODE(code, name, mode, cyc) op_##code: ins_##name<mode>(operand<mode>()); cycles += cyc; return;
+#include "opcodes.def"
+#undef OPCODE
+#else
+#error "Unknown CPU_DISPATCH"
+#endif
+}
+
+// Executes whole instructions until at least cycleBudget cycles have elapsed
+// and returns the number actually spent (the last instruction may overshoot).
+// Runs in slices up to the next event; events and interrupts are handled
+// between slices, so the loops themselves never poll for them.
+uint64_t cpu::run(uint64_t cycleBudget) {
+    const uint64_t start = cycles;
+    const uint64_t target = start + cycleBudget;
+    waited = false;
+    if (debugger) debugger->resume(*this);
+    while (cycles < target) {
+        if (events && events->next() <= cycles) {
+            events->fire(cycles);
+            continue;
+        }
+        if (interruptReady()) {
+            interrupt();
+            continue;
+        }
+        sliceEnd = events ? std::min(target, events->next()) : target;
+        if (tracer || profiler || debugger) interpret<InstrumentedHooks>();
+        else if (blockCacheEnabled) runBlocks();
+        else interpret<BareHooks>();
+        if (debugger && debugger->stopped()) break;
+    }
+    return cycles - start;
+}
+
+bool cpu::waitingForHost() const {
+    return waited && PC >= waitFirst && PC <= waitLast && !nmiPending && (!events || events->empty());
+}
+
+uint64_t cpu::schedule(uint64_t cycle, const std::function<void()>& callback) {
+    if (!events) events.reset(new Scheduler());
+    uint64_t id = events->add(cycle, callback);
+    if (cycle < sliceEnd) sliceEnd = cycle; // scheduled from a device callback
+    return id;
+}
+
+bool cpu::cancelEvent(uint64_t id) {
+    return events && events->cancel(id);
+}
+
+void cpu::setIrq(unsigned line, bool asserted) {
+    if (asserted) irqLines |= 1u << line;
+    else irqLines &= ~(1u << line);
+    pollIrq();
+}
+
+void cpu::nmi() {
+    nmiPending = true;
+    sliceEnd = 0;
+}
+
+// Interrupt entry between instructions: pushes PC and P with B clear, sets I
+// and jumps through the vector, 7 cycles. NMI goes first.
+void cpu::interrupt() {
+    Word vector = nmiPending ? 0xFFFA : 0xFFFE;
+    nmiPending = false;
+    write(0x0100 + SP--, PC >> 8);
+    write(0x0100 + SP--, PC & 0xFF);
+    write(0x0100 + SP--, (P & ~B) | U);
+    setFlag(I, true);
+    PC = read(vector) | (read(vector + 1) << 8);
+    cycles += 7;
+    if (tracer) tracer->resync();
+}
+
+void cpu::setTracer(Tracer* tracer) {
+    this->tracer = tracer;
+    // Every store has to reach writeSlow() while tracing.
+    for (int page = 0; page < 256; ++page) refreshPage(page);
+}
+
+void cpu::setProfiler(Profiler* profiler) {
+    this->profiler = profiler;
+}
+
+void cpu::setDebugger(Debugger* debugger) {
+    if (this->debugger) this->debugger->machine = nullptr;
+    this->debugger = debugger;
+    if (debugger) debugger->machine = this;
+    sliceEnd = 0; // called from a callback: switch loops at the next boundary
+    refreshWatchedPages();
+}
+
+void cpu::refreshWatchedPages() {
+    for (int page = 0; page < 256; ++page) refreshPage(page);
+}
+
+void cpu::setBlockCacheEnabled(bool enabled) {
+    blockCacheEnabled = enabled;
+    if (!enabled) flushCode();
+}
+
+void cpu::setJitEnabled(bool enabled) {
+    // Blocks may hold native entry points into the old arena.
+    flushCode();
+    jit.reset();
+    if (enabled) {
+        jit.reset(new Jit());
+        if (!jit->available()) jit.reset();
+    }
+}
+
+bool cpu::jitSupported() {
+    return Jit().available();
+}
+
+const char* cpu::mnemonic(Byte opcode) {
+    return mnemonics[opcode];
+}
+
+cpu::AddressingMode cpu::addressingMode(Byte opcode) {
+    static const AddressingMode modes[256] = {
+#define OPCODE(code, name, mode, cyc) mode,
+#include "opcodes.def"
+#undef OPCODE
+    };
+    return modes[opcode];
+}
+
+Byte cpu::baseCycles(Byte opcode) {
+    return opTable[opcode].cycles;
+}
+
+Byte cpu::instructionLength(Byte opcode) {
+    switch (addressingMode(opcode)) {
+        case Implied:
+        case Accumulator:
+            return 1;
+        case Absolute:
+        case AbsoluteX:
+        case AbsoluteY:
+        case Indirect:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+std::string cpu::disassemble(Word pc, Byte opcode, Byte lo, Byte hi) {
+    char text[32];
+    const char* name = mnemonic(opcode);
+    Word word = lo | (hi << 8);
+    switch (addressingMode(opcode)) {
+        case Immediate:   std::snprintf(text, sizeof(text), "%s #$%02X", name, lo); break;
+        case ZeroPage:    std::snprintf(text, sizeof(text), "%s $%02X", name, lo); break;
+        case ZeroPageX:   std::snprintf(text, sizeof(text), "%s $%02X,X", name, lo); break;
+        case ZeroPageY:   std::snprintf(text, sizeof(text), "%s $%02X,Y", name, lo); break;
+        case Absolute:    std::snprintf(text, sizeof(text), "%s $%04X", name, word); break;
+        case AbsoluteX:   std::snprintf(text, sizeof(text), "%s $%04X,X", name, word); break;
+        case AbsoluteY:   std::snprintf(text, sizeof(text), "%s $%04X,Y", name, word); break;
+        case Indirect:    std::snprintf(text, sizeof(text), "%s ($%04X)", name, word); break;
+        case IndirectX:   std::snprintf(text, sizeof(text), "%s ($%02X,X)", name, lo); break;
+        case IndirectY:   std::snprintf(text, sizeof(text), "%s ($%02X),Y", name, lo); break;
+        case Accumulator: std::snprintf(text, sizeof(text), "%s A", name); break;
+        case Relative:    std::snprintf(text, sizeof(text), "%s $%04X", name, (Word)(pc + 2 + (int8_t)lo)); break;
+        default:          std::snprintf(text, sizeof(text), "%s", name); break;
+    }
+    return text;
+}
+
+// Hooks policies for interpret(). before() runs with PC at the next
+// instruction and can stop the loop ahead of it; after() gets the address,
+// opcode and cycles of the instruction just run and can stop the loop
+// behind it.
+struct cpu::BareHooks {
+    static bool before(cpu&) { return false; }
+    static bool after(cpu&, Word, Byte, Byte) { return false; }
+};
+
+// The hooks see P, so it is kept whole after every instruction.
+struct cpu::InstrumentedHooks {
+    static bool before(cpu& c) {
+        if (c.debugger && c.debugger->before(c)) return true;
+        if (c.tracer) c.tracer->begin(c, c.PC, c.fetchCode(c.PC), c.fetchCode(c.PC + 1), c.fetchCode(c.PC + 2));
+        return false;
+    }
+    static bool after(cpu& c, Word pc, Byte opcode, Byte spent) {
+        c.packFlags();
+        if (c.tracer) c.tracer->end(c, spent);
+        if (c.profiler) c.profiler->step(c, pc, opcode, spent);
+        return c.debugger && c.debugger->stopped();
+    }
+};
+
+template <class Hooks>
+void cpu::interpret() {
+    if (cycles >= sliceEnd) return;
+    unpackFlags();
+    if (Hooks::before(*this)) return;
+    uint64_t done = 0; // instructions, added to the member on the way out
+#if CPU_DISPATCH == CPU_DISPATCH_THREADED
+    static void* const labels[256] = {
+#define OPCODE(code, name, mode, cyc) &&op_##code,
+#include "opcodes.def"
+#undef OPCODE
+    };
+    goto *labels[fetchCode(PC++)];
+#define OPCODE(code, name, mode, cyc) \
+    op_##code: { \
+        const Word at = PC - 1; \
+        const uint64_t start = cycles; \
+        ins_##name<mode>(operand<mode>()); \
+        cycles += cyc; \
+        ++done; \
+        if (!Hooks::after(*this, at, code, (Byte)(cycles - start)) && cycles < sliceEnd && !Hooks::before(*this)) \
+            goto *labels[fetchCode(PC++)]; \
+        instructions += done; \
+        packFlags(); \
+        return; \
+    }
+#include "opcodes.def"
+#undef OPCODE
+#else
+    do {
+        const Word at = PC;
+        const Byte opcode = fetchCode(at);
+        const uint64_t start = cycles;
+        step();
+        ++done;
+        if (Hooks::after(*this, at, opcode, (Byte)(cycles - start))) break;
+    } while (cycles < sliceEnd && !Hooks::before(*this));
+    instructions += done;
+    packFlags();
+#endif
+}
+
+// Runs cached blocks, decoding on first visit. The budget is checked after
+// every instruction so the stopping point matches the interpreter exactly;
+// native blocks are only entered when their worst case fits the budget.
+void cpu::runBlocks() {
+    unpackFlags();
+    while (cycles < sliceEnd) {
+        if (!blockCache || (jit && jit->exhausted())) {
+            flushCode();
+            blockCache.reset(new BlockCache());
+            codePages = blockCache->codePages();
+        }
+        blockCache->releaseRetired();
+        Block* block = blockCache->lookup(PC);
+        if (!block) block = decodeBlock(PC);
+        if (block->spin == SpinCountdown) skipSpin(*block);
+        if (jit) {
+            if (block->native) {
+                if (sliceEnd - cycles >= block->maxCycles) {
+                    packFlags(); // translated code keeps P whole
+                    block->native(this);
+                    unpackFlags();
+                    instructions += block->ops.size(); // rare early exits are counted whole
+                    if (block->spin == SpinWait && PC == block->start) skipSpin(*block);
+                    continue;
+                }
+            } else if (!block->jitFailed && ++block->hits == JIT_THRESHOLD) {
+                if (jit->compile(*this, *block)) continue;
+            }
+        }
+        const DecodedOp* const begin = block->ops.data();
+        const DecodedOp* op = begin;
+        const DecodedOp* end = op + block->ops.size();
+        for (; op != end; ++op) {
+            if (op->fused && sliceEnd - cycles > op->cycles) {
+                fusedForms[op->fused].run(*this, op);
+                ++fusedHits[op->fused];
+                ++op;
+            } else {
+                PC = op->next;
+                op->handler(*this, op->operand);
+                cycles += op->cycles;
+            }
+            if (cycles >= sliceEnd || !block->valid) {
+                ++op;
+                break;
+            }
+        }
+        instructions += op - begin;
+        if (block->spin == SpinWait && PC == block->start) skipSpin(*block);
+    }
+    packFlags();
+}
+
+// Fast-forwards a self-looping block by the whole iterations that end before
+// sliceEnd, as if they had run. At least the iteration that crosses sliceEnd
+// (or leaves the loop) is left to run normally, so the stopping point,
+// registers and flags all match the interpreter. Nothing can interrupt the
+// guest inside a slice, so a wait loop spins until its end; it is only
+// skipped after an iteration has run, which already set the registers and
+// flags every further iteration would.
+void cpu::skipSpin(const Block& block) {
+    if (cycles >= sliceEnd) return;
+    uint64_t fit = (sliceEnd - cycles - 1) / block.spinCycles;
+    if (block.spin == SpinWait) {
+        cycles += fit * block.spinCycles;
+        instructions += fit * block.ops.size();
+        waited = true;
+        waitFirst = block.start;
+        waitLast = block.end;
+        return;
+    }
+    const size_t count = block.ops.size();
+    const Byte step = block.ops[count - 2].opcode;
+    const bool down = step == 0xCA || step == 0x88; // DEX, DEY
+    Byte& counter = (step == 0xCA || step == 0xE8) ? X : Y;
+    unsigned left = down ? counter : (Byte)-counter; // iterations until it reaches zero
+    if (!left) left = 256;
+    uint64_t skip = std::min<uint64_t>(fit, left - 1);
+    if (!skip) return;
+    for (size_t i = 0; i + 2 < count; ++i) block.ops[i].handler(*this, block.ops[i].operand);
+    counter = down ? (Byte)(counter - skip) : (Byte)(counter + skip);
+    setZN(counter);
+    cycles += skip * block.spinCycles;
+    instructions += skip * count;
+}
+
+// Marks the ops that start a fused pair. A compare only fuses when its
+// operand reads RAM: a device read could raise an interrupt that has to be
+// taken before the branch.
+void cpu::fusePairs(Block& block) const {
+    for (size_t i = 0; i + 1 < block.ops.size(); ++i) {
+        DecodedOp& op = block.ops[i];
+        if (addressingMode(op.opcode) == ZeroPage && op.operand >= pageReadLimit[0]) continue; // compare zp
+        for (int form = 1; form < FUSED_FORMS; ++form) {
+            if (fusedForms[form].first == op.opcode && fusedForms[form].second == block.ops[i + 1].opcode) {
+                op.fused = (Byte)form;
+                ++i;
+                break;
+            }
+        }
+    }
 }
 
+// "ADC zp,X", "BNE": the instruction without its operand value.
+static std::string operandForm(Byte opcode) {
+    std::string text = cpu::mnemonic(opcode);
+    switch (cpu::addressingMode(opcode)) {
+        case cpu::Immediate: return text + " #imm";
+        case cpu::ZeroPage:  return text + " zp";
+        case cpu::ZeroPageX: return text + " zp,X";
+        case cpu::Absolute:  return text + " abs";
+        case cpu::AbsoluteX: return text + " abs,X";
+        case cpu::AbsoluteY: return text + " abs,Y";
+        case cpu::IndirectX: return text + " (zp,X)";
+        case cpu::IndirectY: return text + " (zp),Y";
+        default:             return text;
+    }
+}
+
+std::vector<cpu::FusionCount> cpu::fusionCounts() const {
+    std::vector<FusionCount> counts;
+    for (int form = 1; form < FUSED_FORMS; ++form) {
+        const FusedForm& f = fusedForms[form];
+        FusionCount count = { operandForm(f.first) + "; " + operandForm(f.second), fusedHits[form] };
+        counts.push_back(count);
+    }
+    return counts;
+}
+
+// Recognises the loops skipSpin() handles in a block that branches back to
+// its own start.
+void cpu::findSpin(Block& block) const {
+    const size_t count = block.ops.size();
+    const DecodedOp& last = block.ops[count - 1];
+    if (addressingMode(last.opcode) != Relative || last.operand != block.start) return;
+    uint32_t spent = 1 + (((block.start ^ last.next) & 0xFF00) ? 1 : 0); // branch taken
+    for (size_t i = 0; i < count; ++i) spent += block.ops[i].cycles;
+
+    if (last.opcode == 0xD0 && count >= 2) { // BNE
+        switch (block.ops[count - 2].opcode) {
+            case 0xCA: case 0x88: case 0xE8: case 0xC8: break; // DEX, DEY, INX, INY
+            default: return;
+        }
+        for (size_t i = 0; i + 2 < count; ++i) {
+            switch (block.ops[i].opcode) {
+                case 0xEA: case 0x18: case 0x38: case 0xD8: case 0xF8: case 0xB8: break; // NOP, flag sets
+                default: return;
+            }
+        }
+        block.spin = SpinCountdown;
+        block.spinCycles = spent;
+        return;
+    }
+
+    // A load or BIT of one zero page or absolute address, optionally masked
+    // or compared against an immediate: every iteration computes the same
+    // registers and flags as long as the address reads the same.
+    if (count != 2 && count != 3) return;
+    switch (block.ops[0].opcode) {
+        case 0xA5: case 0xAD: case 0xA6: case 0xAE: case 0xA4: case 0xAC: case 0x24: case 0x2C: break;
+        default: return;
+    }
+    if (count == 3) {
+        switch (block.ops[1].opcode) {
+            case 0x29: case 0xC9: case 0xE0: case 0xC0: break; // AND, CMP, CPX, CPY immediate
+            default: return;
+        }
+    }
+    Word address = block.ops[0].operand;
+    if ((address & 0xFF) >= pageReadLimit[address >> 8]) {
+        const Device* device = deviceAt(address);
+        if (device && device->read && !device->pollable) return;
+    }
+    block.spin = SpinWait;
+    block.spinCycles = spent;
+}
+
+Block* cpu::decodeBlock(Word pc) {
+    std::unique_ptr<Block> block(new Block());
+    block->start = pc;
+    block->valid = true;
+    block->native = nullptr;
+    block->maxCycles = 0;
+    block->hits = 0;
+    block->jitFailed = false;
+    block->spin = SpinNone;
+    block->spinCycles = 0;
+    const Word savedPC = PC;
+    PC = pc;
+    for (;;) {
+        Byte opcode = fetchCode(PC++);
+        const OpInfo& info = opTable[opcode];
+        DecodedOp op;
+        op.handler = info.handler;
+        op.operand = info.decode(*this);
+        op.next = PC;
+        op.opcode = opcode;
+        op.cycles = info.cycles;
+        op.fused = 0;
+        block->ops.push_back(op);
+        if (endsBlock(opcode) || block->ops.size() == MAX_BLOCK_OPS) break;
+    }
+    block->end = PC - 1;
+    PC = savedPC;
+    findSpin(*block);
+    fusePairs(*block);
+    Block* inserted = blockCache->insert(std::move(block));
+    // Writes to pages holding code now take the slow path.
+    refreshPage(inserted->start >> 8);
+    refreshPage(inserted->end >> 8);
+    return inserted;
+}
+
+// A write landed in a page that holds decoded blocks. Blocks can straddle a
+// page boundary, so the neighbouring pages may have lost their code as well.
+void cpu::invalidateCode(Word address) {
+    Byte page = address >> 8;
+    blockCache->invalidatePage(page);
+    refreshPage(page - 1);
+    refreshPage(page);
+    refreshPage(page + 1);
+}
+
+#if CPU_DISPATCH == CPU_DISPATCH_TABLE
+const std::function<void(cpu&)> cpu::instructionTable[256] = {
+#define OPCODE(code, name, mode, cyc) [](cpu& c) { c.ins_##name<mode>(c.operand<mode>()); },
+#include "opcodes.def"
+#undef OPCODE
+};
+#endif
+
+// Reports the first one; the rest only show in unknownOpcodes. One stdio call,
+// so machines on different threads neither interleave nor share stream state.
 void cpu::opcodeUnknown() {
-    std::cerr << "Unknown opcode: 0x" << std::hex << (int)read(PC - 1) << " at PC: 0x" << std::hex << PC - 1 << std::endl;
+    if (unknownOpcodes++) return;
+    std::fprintf(stderr, "Unknown opcode: 0x%x at PC: 0x%x\n", fetchCode((Word)(PC - 1)), (Word)(PC - 1));
 }
@@ -0,0 +1,68 @@
+#include "debugger.h"
+
+Debugger::Debugger() : breakpoints(0x10000), machine(nullptr), current(0), resumePC(0), resuming(false) {
+    last.reason = None;
+    last.pc = last.address = 0;
+}
+
+void Debugger::watch(Word first, Word last, bool reads, bool writes) {
+    Watch w = { first, last, reads, writes };
+    watches.push_back(w);
+    if (machine) machine->refreshWatchedPages();
+}
+
+void Debugger::clearWatches() {
+    watches.clear();
+    if (machine) machine->refreshWatchedPages();
+}
+
+bool Debugger::watchesReads(Byte page) const {
+    for (size_t i = 0; i < watches.size(); ++i) {
+        if (watches[i].reads && page >= watches[i].first >> 8 && page <= watches[i].last >> 8) return true;
+    }
+    return false;
+}
+
+bool Debugger::watchesWrites(Byte page) const {
+    for (size_t i = 0; i < watches.size(); ++i) {
+        if (watches[i].writes && page >= watches[i].first >> 8 && page <= watches[i].last >> 8) return true;
+    }
+    return false;
+}
+
+// Start of run(). If the previous run() stopped in front of the instruction
+// the cpu is still at, that instruction now goes ahead.
+void Debugger::resume(const cpu& c) {
+    resuming = (last.reason == Breakpoint || last.reason == Callback) && last.pc == c.PC;
+    resumePC = c.PC;
+    last.reason = None;
+}
+
+bool Debugger::before(const cpu& c) {
+    current = c.PC;
+    if (resuming) {
+        resuming = false;
+        if (c.PC == resumePC) return false;
+    }
+    Reason reason = None;
+    if (breakpoints[c.PC]) reason = Breakpoint;
+    else if (callback && callback(c)) reason = Callback;
+    if (reason == None) return false;
+    last.reason = reason;
+    last.pc = c.PC;
+    last.address = c.PC;
+    return true;
+}
+
+// A slow-path read or write; the first watched access in an instruction wins.
+void Debugger::access(Word address, bool write) {
+    if (last.reason != None) return;
+    for (size_t i = 0; i < watches.size(); ++i) {
+        const Watch& w = watches[i];
+        if (address < w.first || address > w.last || !(write ? w.writes : w.reads)) continue;
+        last.reason = write ? WriteWatch : ReadWatch;
+        last.pc = current;
+        last.address = address;
+        return;
+    }
+}
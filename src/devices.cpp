@@ -0,0 +1,98 @@
+#include "devices.h"
+
+RandomDevice::RandomDevice(Word address) : RandomDevice(address, std::random_device{}()) {}
+
+RandomDevice::RandomDevice(Word address, uint32_t seed) : address(address), initialSeed(seed), rng(seed) {}
+
+Device RandomDevice::device() {
+    Device d;
+    d.first = d.last = address;
+    d.read = [this](Word) { return next(); };
+    return d;
+}
+
+void RandomDevice::reseed(uint32_t seed) {
+    initialSeed = seed;
+    rng.seed(seed);
+}
+
+// 1 to 15. mt19937's output is fixed by the standard; the distributions are not.
+Byte RandomDevice::next() {
+    return (Byte)(1 + rng() % 15);
+}
+
+KeyboardDevice::KeyboardDevice(Word address) : address(address), latch(0) {}
+
+Device KeyboardDevice::device() {
+    Device d;
+    d.first = d.last = address;
+    d.read = [this](Word) { return latch; };
+    d.write = [this](Word, Byte value) { latch = value; };
+    d.pollable = true;
+    return d;
+}
+
+TimerDevice::TimerDevice(cpu& c, uint32_t period, Word address, unsigned line)
+    : c(c), period(period ? period : 1), address(address), line(line), ticks(0), event(0) {}
+
+Device TimerDevice::device() {
+    Device d;
+    d.first = d.last = address;
+    d.read = [this](Word) {
+        Byte count = ticks;
+        ticks = 0;
+        c.setIrq(line, false);
+        return count;
+    };
+    return d;
+}
+
+void TimerDevice::start() {
+    stop();
+    uint64_t due = c.cycles + period;
+    event = c.schedule(due, [this, due]() { tick(due); });
+}
+
+void TimerDevice::stop() {
+    if (event) c.cancelEvent(event);
+    event = 0;
+}
+
+// Reschedules from the deadline rather than the cycle the event actually
+// fired at, so instruction overshoot does not make the timer drift.
+void TimerDevice::tick(uint64_t due) {
+    if (ticks < 255) ticks++;
+    c.setIrq(line, true);
+    uint64_t next = due + period;
+    event = c.schedule(next, [this, next]() { tick(next); });
+}
+
+// Starts fully dirty so the first frame uploads whatever the loader put there.
+ScreenDevice::ScreenDevice(cpu& c, Word base) : c(c), base(base), dirtyRows(0xFFFFFFFFu) {}
+
+Device ScreenDevice::device() {
+    Device d;
+    d.first = base;
+    d.last = base + W * H - 1;
+    d.write = [this](Word address, Byte value) {
+        if (c.peek(address) == value) return;
+        c.poke(address, value);
+        dirtyRows |= 1u << ((address - base) / W);
+    };
+    return d;
+}
+
+void ScreenDevice::copyPixels(Byte* out) const {
+    for (int i = 0; i < W * H; ++i) out[i] = c.peek((Word)(base + i));
+}
+
+void ScreenDevice::color(Byte value, Byte* rgb) {
+    Byte v = value == 0 ? 0 : value == 1 ? 255 : (Byte)(value * 16);
+    rgb[0] = rgb[1] = rgb[2] = v;
+}
+
+uint32_t ScreenDevice::takeDirtyRows() {
+    uint32_t rows = dirtyRows;
+    dirtyRows = 0;
+    return rows;
+}
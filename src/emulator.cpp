@@ -0,0 +1,174 @@
+#include "emulator.h"
+#include "replay.h"
+#include <chrono>
+
+Emulator::Emulator(cpu& c, ScreenDevice& screen, KeyboardDevice& keys, uint64_t clockHz, unsigned frameRate)
+    : c(c), screen(screen), keyboard(keys), clockHz(clockHz), frameRate(frameRate), rewindSlots(0), rewindInterval(0), telemetry(nullptr),
+      recording(nullptr), droppedRows(0), frameCount(0), frameEnd(0),
+      running(false), throttled(true), frameCycles(c.cycles) {}
+
+Emulator::~Emulator() {
+    stop();
+}
+
+void Emulator::start() {
+    if (running.exchange(true)) return;
+    thread = std::thread(&Emulator::loop, this);
+}
+
+void Emulator::stop() {
+    running.store(false);
+    inputs.wake();
+    if (!thread.joinable()) return;
+    thread.join();
+    if (recording) {
+        recording->frames = frameCount;
+        recording->finalHash = stateHash(c);
+    }
+}
+
+void Emulator::enableRewind(size_t slots, unsigned interval) {
+    rewind.reset(slots ? new RewindBuffer(slots, interval) : nullptr);
+    rewindSlots = slots;
+    rewindInterval = interval;
+}
+
+void Emulator::record(InputLog* log) {
+    recording = log;
+    if (!log) return;
+    log->clockHz = clockHz;
+    log->frameRate = frameRate;
+    log->rewindSlots = (uint32_t)rewindSlots;
+    log->rewindInterval = rewindInterval;
+    log->events.clear();
+    log->frames = 0;
+    log->finalHash = 0;
+}
+
+bool Emulator::replay(const InputLog& log) {
+    enableRewind(log.rewindSlots, log.rewindInterval);
+    frameCount = 0;
+    frameEnd = c.cycles;
+    size_t next = 0;
+    bool diverged = false;
+    while (frameCount < log.frames) {
+        for (; next < log.events.size() && log.events[next].frame == frameCount; ++next) {
+            diverged = diverged || log.events[next].cycles != c.cycles;
+            apply(log.events[next].input);
+        }
+        runFrame();
+    }
+    frameCycles.store(c.cycles, std::memory_order_release);
+    return !diverged && next == log.events.size();
+}
+
+const Frame* Emulator::takeFrame() {
+    return frames.acquire() ? &frames.readBuffer() : nullptr;
+}
+
+void Emulator::loop() {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate));
+
+    Clock::time_point nextFrame = Clock::now();
+    frameEnd = c.cycles;
+
+    while (running.load(std::memory_order_relaxed)) {
+        Input in;
+        while (inputs.pop(in)) apply(in);
+        runFrame();
+
+        // The guest is spinning on something only input can change; more
+        // frames would burn host time without changing a pixel.
+        if (c.waitingForHost()) {
+            inputs.wait(running);
+            nextFrame = Clock::now();
+            continue;
+        }
+
+        if (!throttled.load(std::memory_order_relaxed)) {
+            nextFrame = Clock::now();
+            continue;
+        }
+        nextFrame += frameTime;
+        Clock::time_point now = Clock::now();
+        if (now < nextFrame) std::this_thread::sleep_until(nextFrame);
+        else nextFrame = now; // fell behind; don't try to catch up
+    }
+}
+
+// Taking the mutex before notifying closes the gap between wait()'s check
+// and its sleep, so a push or wake() can't slip through unseen.
+bool Emulator::InputQueue::push(const Input& in) {
+    if (!queue.push(in)) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    pushed.notify_one();
+    return true;
+}
+
+void Emulator::InputQueue::wait(const std::atomic<bool>& running) {
+    std::unique_lock<std::mutex> lock(mutex);
+    pushed.wait(lock, [&]() { return !queue.empty() || !running.load(); });
+}
+
+void Emulator::InputQueue::wake() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pushed.notify_one();
+}
+
+void Emulator::apply(const Input& in) {
+    if (recording) {
+        InputLog::Event e = { frameCount, c.cycles, in };
+        recording->events.push_back(e);
+    }
+    if (in.kind == Input::Key) {
+        keyboard.press(in.key);
+    } else if (rewind && rewind->rewind(c)) {
+        frameEnd = c.cycles;
+        screen.markAllDirty();
+    }
+}
+
+// One frame's worth of cycles. Everything a run depends on happens here or
+// in apply(), which is what lets replay() skip the pacing in loop().
+void Emulator::runFrame() {
+    const uint64_t started = telemetry ? Telemetry::nanos() : 0;
+    const uint64_t firstCycle = c.cycles;
+    frameEnd += clockHz / frameRate;
+    if (c.cycles < frameEnd) c.run(frameEnd - c.cycles);
+    if (rewind) rewind->onFrame(c);
+    publishFrame();
+    ++frameCount;
+    frameCycles.store(c.cycles, std::memory_order_release);
+    if (telemetry) report(started, c.cycles - firstCycle);
+}
+
+void Emulator::publishFrame() {
+    uint32_t dirty = screen.takeDirtyRows() | droppedRows;
+    if (!dirty) return;
+
+    Frame& frame = frames.writeBuffer();
+    screen.copyPixels(frame.pixels);
+    frame.dirtyRows = dirty;
+    frame.cycles = c.cycles;
+    frame.publishedNanos = telemetry ? Telemetry::nanos() : 0;
+    // A frame the reader never saw is now our write buffer; its rows must
+    // be redrawn with the next one.
+    const bool dropped = frames.publish();
+    droppedRows = dropped ? frames.writeBuffer().dirtyRows : 0;
+    if (dropped && telemetry) Telemetry::add(telemetry->get().droppedFrames, 1);
+}
+
+// Copies the cpu's counters out once per frame, so the run loops never touch
+// shared memory.
+void Emulator::report(uint64_t frameStart, uint64_t frameCycles) {
+    TelemetryCounters& t = telemetry->get();
+    const uint64_t spent = Telemetry::nanos() - frameStart;
+    t.instructions.store(c.instructions, std::memory_order_relaxed);
+    t.cycles.store(c.cycles, std::memory_order_relaxed);
+    t.unknownOpcodes.store(c.unknownOpcodes, std::memory_order_relaxed);
+    t.lastFrameCycles.store(frameCycles, std::memory_order_relaxed);
+    t.lastFrameNanos.store(spent, std::memory_order_relaxed);
+    Telemetry::add(t.frameNanos, spent);
+    Telemetry::add(t.frames, 1);
+}
@@ -0,0 +1,329 @@
+#include "explore.h"
+#include "devices.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+const int SEEN_SHARDS = 64;
+
+uint64_t mix(uint64_t hash, uint64_t value) {
+    hash = (hash ^ value) * 0xFF51AFD7ED558CCDull;
+    return hash ^ (hash >> 32);
+}
+
+uint64_t hashPage(const MemoryPage& page) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int i = 0; i < 256; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, page.bytes + i, sizeof(word));
+        hash = mix(hash, word);
+    }
+    return hash;
+}
+
+struct PageHashes {
+    uint64_t page[256];
+};
+
+uint64_t combine(const Snapshot& state, const PageHashes& hashes) {
+    uint64_t hash = mix(0, (uint64_t)state.PC | (uint64_t)state.SP << 16 | (uint64_t)state.A << 24 |
+                           (uint64_t)state.X << 32 | (uint64_t)state.Y << 40 | (uint64_t)state.P << 48);
+    for (int page = 0; page < 256; ++page) hash = mix(hash, hashes.page[page]);
+    return hash;
+}
+
+struct Visit;
+
+// A branch that reached a state: where from, and the index of its input in
+// the order fork() tries them.
+struct Edge {
+    const Visit* parent;
+    uint32_t input;
+};
+
+// A distinct (state, depth). Every branch that reaches it is kept, not just
+// the first, so the path picked for it at the end does not depend on which
+// thread got there first.
+struct Visit {
+    unsigned depth;
+    double score;
+    std::vector<Edge> edges; // under the shard lock while exploring
+    const Edge* best;        // set at the end: the smallest path, in input order
+    size_t rank;             // of that path among the visits at this depth
+};
+
+struct Node {
+    Snapshot state;
+    PageHashes hashes;
+    Visit* visit;
+    unsigned depth;
+};
+
+// One branch: a parent state and the input to run it with.
+struct Task {
+    std::shared_ptr<const Node> parent;
+    uint32_t input;
+};
+
+struct Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+};
+
+struct Shard {
+    std::mutex lock;
+    std::unordered_map<uint64_t, Visit> visits; // nodes never move
+};
+
+class Explorer {
+public:
+    Explorer(const ExploreOptions& options, unsigned threads) : options(options), pending(0), stop(false),
+        sleepers(0), wakeups(0), states(0), duplicates(0), cycles(0), steals(0), queues(threads) {
+        for (size_t i = 0; i < queues.size(); ++i) queues[i].reset(new Queue());
+    }
+
+    ExploreInput input(uint32_t index) const {
+        const size_t seeds = options.seeds.size();
+        ExploreInput in = { options.keys[index / seeds], options.seeds[index % seeds] };
+        return in;
+    }
+
+    // Distinct (state, depth) pairs: a state met again at another depth has
+    // a different number of forks left, and keying on both keeps the set of
+    // states explored independent of thread timing. Records the branch that
+    // got here and returns true if it was the first.
+    bool visit(uint64_t hash, unsigned depth, const Edge& edge, Visit*& result) {
+        const uint64_t key = mix(hash, depth);
+        Shard& shard = seen[key >> 58];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        std::pair<std::unordered_map<uint64_t, Visit>::iterator, bool> found = shard.visits.emplace(key, Visit());
+        Visit& v = found.first->second;
+        if (found.second) {
+            v.depth = depth;
+            v.score = 0;
+            v.best = nullptr;
+            v.rank = 0;
+        }
+        if (edge.parent) v.edges.push_back(edge);
+        result = &v;
+        return found.second;
+    }
+
+    void fork(unsigned worker, const std::shared_ptr<const Node>& node) {
+        {
+            Queue& queue = *queues[worker];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            // Newest is taken first, so push in reverse to run the first input first.
+            for (size_t i = options.keys.size() * options.seeds.size(); i-- > 0;) {
+                Task task = { node, (uint32_t)i };
+                queue.tasks.push_back(task);
+                pending.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (sleepers.load()) wake();
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> guard(idleLock);
+        ++wakeups;
+        idle.notify_all();
+    }
+
+    bool queued() {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            std::lock_guard<std::mutex> guard(queues[i]->lock);
+            if (!queues[i]->tasks.empty()) return true;
+        }
+        return false;
+    }
+
+    // Sleeps until a fork, the last task finishing or the stop. The count
+    // goes up before the queues are looked at again, so a fork either
+    // leaves tasks this sees or sees the sleeper and wakes it. Returns
+    // false once there is nothing left to do.
+    bool park() {
+        std::unique_lock<std::mutex> guard(idleLock);
+        const uint64_t seen = wakeups;
+        sleepers.fetch_add(1);
+        if (!queued()) {
+            idle.wait(guard, [&]() {
+                return wakeups != seen || stop.load(std::memory_order_relaxed) || pending.load(std::memory_order_acquire) == 0;
+            });
+        }
+        sleepers.fetch_sub(1);
+        return !stop.load(std::memory_order_relaxed) && pending.load(std::memory_order_acquire) != 0;
+    }
+
+    bool take(unsigned worker, Task& task) {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front(); // oldest: nearest the root, the most work under it
+                victim.tasks.pop_front();
+                steals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(unsigned worker) {
+        cpu c;
+        KeyboardDevice keys(options.keyAddress);
+        RandomDevice random(options.randomAddress, 0);
+        c.attachDevice(keys.device());
+        c.attachDevice(random.device());
+        for (size_t i = 0; i < options.romPages.size(); ++i) c.mapRom(options.romPages[i], options.romPages[i]);
+        uint64_t ran = 0;
+
+        Task task;
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (!take(worker, task)) {
+                if (!park()) break;
+                continue;
+            }
+            const Node& parent = *task.parent;
+            c.loadState(parent.state);
+            const ExploreInput in = input(task.input);
+            keys.press(in.key);
+            random.reseed(in.seed);
+            const uint64_t start = c.cycles;
+            c.run(options.cycles);
+            ran += c.cycles - start;
+
+            std::shared_ptr<Node> child = std::make_shared<Node>();
+            c.saveState(child->state);
+            for (int page = 0; page < 256; ++page) {
+                child->hashes.page[page] = child->state.pages[page] == parent.state.pages[page]
+                    ? parent.hashes.page[page] : hashPage(*child->state.pages[page]);
+            }
+            child->depth = parent.depth + 1;
+            const Edge edge = { parent.visit, task.input };
+            if (visit(combine(child->state, child->hashes), child->depth, edge, child->visit)) {
+                // Only read once the workers are joined.
+                child->visit->score = options.score ? options.score(c) : 0;
+                if (child->depth < options.depth && (!options.expand || options.expand(c))) fork(worker, child);
+                const uint64_t count = states.fetch_add(1, std::memory_order_relaxed) + 1;
+                if (options.maxStates && count >= options.maxStates) {
+                    stop.store(true, std::memory_order_relaxed);
+                    wake();
+                }
+            } else {
+                duplicates.fetch_add(1, std::memory_order_relaxed);
+            }
+            task.parent.reset();
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) wake();
+        }
+        cycles.fetch_add(ran, std::memory_order_relaxed);
+    }
+
+    const ExploreOptions& options;
+    std::atomic<uint64_t> pending; // tasks queued or running
+    std::atomic<bool> stop;
+    std::atomic<unsigned> sleepers; // workers in park()
+    std::mutex idleLock;
+    std::condition_variable idle;
+    uint64_t wakeups; // under idleLock
+    std::atomic<uint64_t> states, duplicates, cycles, steals;
+    std::vector<std::unique_ptr<Queue> > queues;
+    Shard seen[SEEN_SHARDS];
+};
+
+bool precedes(const Edge& a, const Edge& b) {
+    return a.parent->rank != b.parent->rank ? a.parent->rank < b.parent->rank : a.input < b.input;
+}
+
+bool pathPrecedes(const Visit* a, const Visit* b) {
+    return precedes(*a->best, *b->best);
+}
+
+// Gives every visit its smallest path, comparing paths input by input in the
+// order fork() tries them, one depth at a time: a visit's smallest path runs
+// through one of its parents' smallest paths, and those are already ranked.
+// Returns the best visit: highest score, then shallowest, then smallest path.
+const Visit* rankPaths(Shard (&seen)[SEEN_SHARDS]) {
+    std::vector<std::vector<Visit*> > depths(1);
+    for (int i = 0; i < SEEN_SHARDS; ++i) {
+        for (std::unordered_map<uint64_t, Visit>::iterator it = seen[i].visits.begin(); it != seen[i].visits.end(); ++it) {
+            const unsigned depth = it->second.depth;
+            if (depth >= depths.size()) depths.resize(depth + 1);
+            depths[depth].push_back(&it->second);
+        }
+    }
+    const Visit* best = nullptr;
+    for (size_t depth = 1; depth < depths.size(); ++depth) {
+        std::vector<Visit*>& visits = depths[depth];
+        for (size_t i = 0; i < visits.size(); ++i) {
+            Visit& v = *visits[i];
+            v.best = &v.edges[0];
+            for (size_t e = 1; e < v.edges.size(); ++e) {
+                if (precedes(v.edges[e], *v.best)) v.best = &v.edges[e];
+            }
+        }
+        std::sort(visits.begin(), visits.end(), pathPrecedes);
+        for (size_t i = 0; i < visits.size(); ++i) {
+            visits[i]->rank = i;
+            if (!best || visits[i]->score > best->score) best = visits[i];
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+uint64_t exploreHash(const Snapshot& state) {
+    PageHashes hashes;
+    for (int page = 0; page < 256; ++page) hashes.page[page] = hashPage(*state.pages[page]);
+    return combine(state, hashes);
+}
+
+ExploreResult explore(const Snapshot& root, const ExploreOptions& options) {
+    const auto start = std::chrono::steady_clock::now();
+    unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    Explorer explorer(options, threads);
+
+    std::shared_ptr<Node> node = std::make_shared<Node>();
+    node->state = root;
+    for (int page = 0; page < 256; ++page) node->hashes.page[page] = hashPage(*root.pages[page]);
+    node->depth = 0;
+    const Edge none = { nullptr, 0 };
+    explorer.visit(combine(node->state, node->hashes), 0, none, node->visit);
+    if (options.depth > 0) explorer.fork(0, node);
+    node.reset();
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) workers.emplace_back(&Explorer::work, &explorer, i);
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+
+    ExploreResult result;
+    const Visit* best = rankPaths(explorer.seen);
+    result.bestScore = best ? best->score : 0;
+    for (const Visit* v = best; v && v->best; v = v->best->parent) result.bestPath.push_back(explorer.input(v->best->input));
+    std::reverse(result.bestPath.begin(), result.bestPath.end());
+    result.states = explorer.states;
+    result.duplicates = explorer.duplicates;
+    result.cycles = explorer.cycles;
+    result.steals = explorer.steals;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -2,7 +2,7 @@
 #include <iostream>
 #include <cstring>
 
-Frontend::Frontend() : window(nullptr), renderer(nullptr), texture(nullptr) {}
+Frontend::Frontend() : window(nullptr), renderer(nullptr), texture(nullptr), telemetry(nullptr) {}
 
 Frontend::~Frontend() {
     shutdown();
@@ -28,7 +28,8 @@ bool Frontend::init() {
         std::fprintf(stderr, "SDL_CreateTexture error: %s\n", SDL_GetError());
         return false;
     }
-    last_frame.assign(W * H, 0xFF); // force initial upload
+    for (int v = 0; v < 256; ++v) ScreenDevice::color((Byte)v, palette[v]);
+    staging.resize(W * H * 3);
     return true;
 }
 
@@ -39,54 +40,56 @@ void Frontend::shutdown() {
     SDL_Quit();
 }
 
-void Frontend::map_to_rgb(Byte v, Byte& r, Byte& g, Byte& b) {
-    if (v == 0) { r = g = b = 0; }
-    else if (v == 1) { r = g = b = 255; }
-    else { r = g = b = (Byte)(v * 16); }
-}
-
-void Frontend::draw_if_changed(const Byte* screen) {
-    bool changed = false;
-    for (int i = 0; i < W * H; ++i) {
-        if (last_frame[i] != screen[i]) {
-            changed = true;
-            break;
-        }
-    }
-    if (!changed) return;
-
-    void* pixels = nullptr;
-    int pitch = 0;
-    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) return;
+// Uploads only the frame's dirty rows, one SDL_UpdateTexture per run of
+// adjacent rows. Nothing is presented while the screen is idle.
+void Frontend::draw_if_changed(const Frame& frame) {
+    uint32_t dirty = frame.dirtyRows;
+    if (!dirty) return;
 
-    for (int y = 0; y < H; ++y) {
-        uint8_t* row = (uint8_t*)pixels + y * pitch;
-        for (int x = 0; x < W; ++x) {
-            Byte r, g, b;
-            map_to_rgb(screen[y * W + x], r, g, b);
-            row[x * 3 + 0] = r;
-            row[x * 3 + 1] = g;
-            row[x * 3 + 2] = b;
+    const Byte* pixels = frame.pixels;
+    const int pitch = W * 3;
+    int y = 0;
+    while (y < H) {
+        if (!(dirty & (1u << y))) { ++y; continue; }
+        int first = y;
+        while (y < H && (dirty & (1u << y))) {
+            Byte* row = &staging[y * pitch];
+            for (int x = 0; x < W; ++x) std::memcpy(row + x * 3, palette[pixels[y * W + x]], 3);
+            ++y;
         }
+        SDL_Rect rect = { 0, first, W, y - first };
+        SDL_UpdateTexture(texture, &rect, &staging[first * pitch], pitch);
     }
-    SDL_UnlockTexture(texture);
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
-    std::memcpy(last_frame.data(), screen, W * H);
+
+    if (telemetry) {
+        TelemetryCounters& t = telemetry->get();
+        const uint64_t latency = Telemetry::nanos() - frame.publishedNanos;
+        t.lastPresentNanos.store(latency, std::memory_order_relaxed);
+        Telemetry::add(t.presentNanos, latency);
+        Telemetry::add(t.presented, 1);
+    }
+}
+
+static void post(Emulator::InputQueue& input, Input::Kind kind, Byte key = 0) {
+    Input in = { kind, key };
+    input.push(in); // dropped if the emulation thread is 64 events behind
 }
 
-bool Frontend::handle_events(cpu& cpu) {
+bool Frontend::handle_events(Emulator::InputQueue& input) {
     SDL_Event ev;
     while (SDL_PollEvent(&ev)) {
         if (ev.type == SDL_QUIT) return false;
         if (ev.type == SDL_KEYDOWN) {
             switch (ev.key.keysym.sym) {
                 case SDLK_ESCAPE: return false;
-                case SDLK_w: cpu.write(0x00FF, 'w'); break;
-                case SDLK_a: cpu.write(0x00FF, 'a'); break;
-                case SDLK_s: cpu.write(0x00FF, 's'); break;
-                case SDLK_d: cpu.write(0x00FF, 'd'); break;
+                case SDLK_w: post(input, Input::Key, 'w'); break;
+                case SDLK_a: post(input, Input::Key, 'a'); break;
+                case SDLK_s: post(input, Input::Key, 's'); break;
+                case SDLK_d: post(input, Input::Key, 'd'); break;
+                case SDLK_BACKSPACE: post(input, Input::Rewind); break;
                 default: break;
             }
         }
@@ -0,0 +1,186 @@
+#include "headless.h"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void onSignal(int) {
+    interrupted = 1;
+}
+
+HeadlessFrontend::HeadlessFrontend(const std::string& path, int scale, uint64_t cyclesPerFrame, unsigned frameRate)
+    : path(path), scale(scale < 1 ? 1 : scale > 16 ? 16 : scale), cyclesPerFrame(cyclesPerFrame ? cyclesPerFrame : 1),
+      frameRate(frameRate), y4m(path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0), file(nullptr),
+      dropped(0), endIndex(0), stopping(false), written(0), writeFailed(false) {}
+
+HeadlessFrontend::~HeadlessFrontend() {
+    if (encoder.joinable()) finish(0);
+}
+
+bool HeadlessFrontend::init() {
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot write video to " << path << std::endl;
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IONBF, 0); // writes are already batched
+
+    for (int v = 0; v < 256; ++v) {
+        Byte rgb[3];
+        ScreenDevice::color((Byte)v, rgb);
+        int r = rgb[0], g = rgb[1], b = rgb[2];
+        if (y4m) { // BT.601, studio range
+            planes[0][v] = (Byte)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            planes[1][v] = (Byte)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            planes[2][v] = (Byte)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        } else {
+            for (int c = 0; c < 3; ++c) planes[c][v] = rgb[c];
+        }
+    }
+    std::memset(image, 0, sizeof(image));
+    const size_t pixels = (size_t)ScreenDevice::W * scale * ScreenDevice::H * scale;
+    frameBytes.resize(y4m ? 6 + pixels * 3 : pixels * 3);
+    out.reserve(WRITE_BLOCK + frameBytes.size());
+    if (y4m) {
+        char header[96];
+        int n = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n",
+                              ScreenDevice::W * scale, ScreenDevice::H * scale, frameRate);
+        out.insert(out.end(), header, header + n);
+    }
+
+    slots.resize(SLOTS);
+    for (size_t i = 0; i < slots.size(); ++i) free.push_back(&slots[i]);
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    std::signal(SIGPIPE, SIG_IGN); // a closed pipe fails the write instead
+    encoder = std::thread(&HeadlessFrontend::encoderLoop, this);
+    return true;
+}
+
+bool HeadlessFrontend::finish(uint64_t cycles) {
+    if (!encoder.joinable()) return !writeFailed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        endIndex = cycles / cyclesPerFrame;
+        stopping = true;
+    }
+    changed.notify_one();
+    encoder.join();
+    flush();
+    if (std::fclose(file) != 0) writeFailed = true;
+    file = nullptr;
+    return !writeFailed;
+}
+
+void HeadlessFrontend::draw_if_changed(const Frame& frame) {
+    if (!frame.dirtyRows) return;
+    Capture* slot;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (free.empty()) {
+            // The newest queued capture has not reached the encoder yet: it
+            // takes this frame instead, so the latest image is never lost
+            // (the emulator only publishes again once the screen changes).
+            ++dropped;
+            if (queued.empty()) return; // the encoder holds at most one slot
+            queued.back()->index = frame.cycles / cyclesPerFrame;
+            std::memcpy(queued.back()->pixels, frame.pixels, sizeof(queued.back()->pixels));
+            return;
+        }
+        slot = free.back();
+        free.pop_back();
+    }
+    slot->index = frame.cycles / cyclesPerFrame;
+    std::memcpy(slot->pixels, frame.pixels, sizeof(slot->pixels));
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued.push_back(slot);
+    }
+    changed.notify_one();
+}
+
+bool HeadlessFrontend::handle_events(Emulator::InputQueue&) {
+    return !interrupted;
+}
+
+// Each capture replaces the image from its frame on; the frames in between
+// repeat the previous image.
+void HeadlessFrontend::encoderLoop() {
+    for (;;) {
+        Capture* slot;
+        uint64_t limit;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this]() { return !queued.empty() || stopping; });
+            if (queued.empty()) break;
+            slot = queued.front();
+            queued.pop_front();
+            limit = stopping ? endIndex + 1 : slot->index;
+        }
+        emit(std::min(slot->index, limit));
+        std::memcpy(image, slot->pixels, sizeof(image));
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            free.push_back(slot);
+        }
+    }
+    emit(endIndex + 1);
+}
+
+// Palette-maps and upscales `image` into frameBytes. Each output row is
+// built once with runs of memset and then copied down; both are plain
+// contiguous byte loops the compiler and libc vectorise.
+void HeadlessFrontend::convert() {
+    const int W = ScreenDevice::W;
+    const int H = ScreenDevice::H;
+    Byte* p = frameBytes.data();
+    if (y4m) {
+        const int width = W * scale;
+        std::memcpy(p, "FRAME\n", 6);
+        p += 6;
+        for (int plane = 0; plane < 3; ++plane) {
+            const Byte* lut = planes[plane];
+            for (int y = 0; y < H; ++y) {
+                const Byte* src = image + y * W;
+                Byte* row = p;
+                for (int x = 0; x < W; ++x) std::memset(row + x * scale, lut[src[x]], scale);
+                p += width;
+                for (int k = 1; k < scale; ++k, p += width) std::memcpy(p, row, width);
+            }
+        }
+        return;
+    }
+    const int width = W * scale * 3;
+    for (int y = 0; y < H; ++y) {
+        const Byte* src = image + y * W;
+        Byte* row = p;
+        for (int x = 0; x < W; ++x) {
+            const Byte r = planes[0][src[x]], g = planes[1][src[x]], b = planes[2][src[x]];
+            Byte* px = row + x * scale * 3;
+            for (int k = 0; k < scale; ++k, px += 3) {
+                px[0] = r;
+                px[1] = g;
+                px[2] = b;
+            }
+        }
+        p += width;
+        for (int k = 1; k < scale; ++k, p += width) std::memcpy(p, row, width);
+    }
+}
+
+// Appends the current image until the stream holds `upTo` frames.
+void HeadlessFrontend::emit(uint64_t upTo) {
+    if (written >= upTo) return;
+    convert();
+    for (; written < upTo; ++written) {
+        out.insert(out.end(), frameBytes.begin(), frameBytes.end());
+        if (out.size() >= WRITE_BLOCK) flush();
+    }
+}
+
+void HeadlessFrontend::flush() {
+    if (file && !out.empty() && !writeFailed) writeFailed = std::fwrite(out.data(), 1, out.size(), file) != out.size();
+    out.clear();
+}
@@ -0,0 +1,723 @@
+#include "jit.h"
+#include "blockcache.h"
+#include <cstring>
+#include <string>
+#include <vector>
+#include <initializer_list>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef JIT_X86_64
+
+namespace {
+
+const size_t ARENA_SIZE = 4 * 1024 * 1024;
+const size_t MAX_BLOCK_CODE = 16 * 1024; // generous bound for one translated block
+
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Guest state pinned to callee-saved host registers so helper calls keep it.
+const int REG_CPU = RBX;
+const int REG_A = R12;
+const int REG_X = R13;
+const int REG_Y = R14;
+const int REG_P = R15;
+const int REG_PENALTY = RBP; // dynamic page-cross/branch cycles
+
+enum Cond { CC_O = 0, CC_C = 2, CC_NC = 3, CC_Z = 4, CC_NZ = 5 };
+
+// Memory operand [base + index * (1 << scale) + disp32]; index < 0 means none.
+struct Mem {
+    int base;
+    int index;
+    int32_t disp;
+    int scale;
+    Mem(int b, int i, int32_t d, int s = 0) : base(b), index(i), disp(d), scale(s) {}
+};
+
+// Where the cpu keeps its page table, plus the read limits for decisions
+// made at translation time. Read limits only change through attachDevice(),
+// which drops all native code.
+struct BusLayout {
+    int32_t pageDataOff;
+    int32_t readLimitOff;
+    int32_t writeLimitOff;
+    const uint16_t* readLimits;
+};
+
+// N and Z for every possible result byte.
+struct NZTable {
+    Byte bits[256];
+    NZTable() {
+        for (int v = 0; v < 256; ++v) bits[v] = (v == 0 ? Z : 0) | (v & 0x80);
+    }
+};
+const NZTable nzTable;
+
+void jitWrite(cpu* c, unsigned address, unsigned value) {
+    c->write((Word)address, (Byte)value);
+}
+
+unsigned jitRead(cpu* c, unsigned address) {
+    return c->read((Word)address);
+}
+
+// Little-endian zero-page pointer, wrapping inside page zero.
+unsigned jitPointer(cpu* c, unsigned zp) {
+    return c->read((Word)(zp & 0xFF)) | (c->read((Word)((zp + 1) & 0xFF)) << 8);
+}
+
+// Minimal x86-64 encoder covering the forms the translator emits. All memory
+// operands use a 32-bit displacement.
+class Emitter {
+public:
+    std::vector<Byte> code;
+
+    void byte(Byte b) { code.push_back(b); }
+    void dword(uint32_t v) { for (int i = 0; i < 4; ++i) byte((v >> (8 * i)) & 0xFF); }
+    void qword(uint64_t v) { for (int i = 0; i < 8; ++i) byte((v >> (8 * i)) & 0xFF); }
+
+    int newLabel() { labels.push_back(-1); return (int)labels.size() - 1; }
+    void bind(int label) { labels[label] = (int)code.size(); }
+
+    void jmp(int label) { byte(0xE9); rel32(label); }
+    void jcc(Cond cc, int label) { byte(0x0F); byte(0x80 + cc); rel32(label); }
+
+    // op r/m, reg with a register r/m operand.
+    void rr(std::initializer_list<Byte> op, int reg, int rm, bool w = false) {
+        rex(w, reg, 0, rm);
+        for (Byte b : op) byte(b);
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // op r/m, reg with a memory r/m operand.
+    void rm(std::initializer_list<Byte> op, int reg, const Mem& m, bool w = false) {
+        rex(w, reg, m.index < 0 ? 0 : m.index, m.base);
+        for (Byte b : op) byte(b);
+        if (m.index < 0) {
+            byte(0x80 | ((reg & 7) << 3) | (m.base & 7));
+            if ((m.base & 7) == RSP) byte(0x24);
+        } else {
+            byte(0x80 | ((reg & 7) << 3) | 4);
+            byte((m.scale << 6) | ((m.index & 7) << 3) | (m.base & 7));
+        }
+        dword((uint32_t)m.disp);
+    }
+
+    void movImm8(int dst, Byte imm) { rex(false, 0, 0, dst); byte(0xB0 + (dst & 7)); byte(imm); }
+    void movImm32(int dst, uint32_t imm) { rex(false, 0, 0, dst); byte(0xB8 + (dst & 7)); dword(imm); }
+    void movImm64(int dst, uint64_t imm) { rex(true, 0, 0, dst); byte(0xB8 + (dst & 7)); qword(imm); }
+    void push(int r) { rex(false, 0, 0, r); byte(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, 0, r); byte(0x58 + (r & 7)); }
+
+    void resolve() {
+        for (size_t i = 0; i < fixups.size(); ++i) {
+            int pos = fixups[i].first;
+            int32_t rel = labels[fixups[i].second] - (pos + 4);
+            std::memcpy(&code[pos], &rel, 4);
+        }
+    }
+
+private:
+    std::vector<int> labels;
+    std::vector<std::pair<int, int> > fixups;
+
+    void rex(bool w, int reg, int index, int base) {
+        Byte r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+        if (r != 0x40) byte(r);
+    }
+
+    void rel32(int label) {
+        fixups.push_back(std::make_pair((int)code.size(), label));
+        dword(0);
+    }
+};
+
+// Translates one Block. Each guest instruction is emitted in order; the
+// static cycle count up to the current instruction is tracked at translation
+// time and only the page-cross/branch extras are counted at run time.
+class Translator {
+public:
+    Translator(cpu& c, const BusLayout& bus) : c(c), bus(bus), staticCycles(0), maxCycles(0) {
+        aOff = offset(&c.A);
+        xOff = offset(&c.X);
+        yOff = offset(&c.Y);
+        pOff = offset(&c.P);
+        spOff = offset(&c.SP);
+        pcOff = offset(&c.PC);
+        cyclesOff = offset(&c.cycles);
+    }
+
+    bool translate(const Block& block);
+
+    std::vector<Byte>& code() { return e.code; }
+    uint32_t cycleBound() const { return maxCycles; }
+
+private:
+    enum StubKind { StubWrite, StubRead, StubPointer };
+    struct Stub { int label; int resume; StubKind kind; int value; };
+    struct Exit { int label; Word pc; uint32_t cycles; };
+
+    cpu& c;
+    Emitter e;
+    BusLayout bus;
+    int32_t aOff, xOff, yOff, pOff, spOff, pcOff, cyclesOff;
+    int epilogue;
+    std::vector<Stub> stubs;
+    std::vector<Exit> exits;
+    uint32_t staticCycles;
+    uint32_t maxCycles;
+
+    int32_t offset(const void* field) const {
+        return (int32_t)((const char*)field - (const char*)&c);
+    }
+
+    Mem field(int32_t off) const { return Mem(REG_CPU, -1, off); }
+    bool fastRead(Word address) const { return (address & 0xFF) < bus.readLimits[address >> 8]; }
+
+    void prologue();
+    void emitEpilogue();
+    void exitTo(Word pc, uint32_t cycles);
+    int exitLabel(Word pc, uint32_t cycles);
+
+    void setNZ(int reg);
+    void setCFromCarry();
+    void address(cpu::AddressingMode mode, Word operand, bool penalty);
+    int stub(StubKind kind, int value);
+    void call(const void* helper);
+    void pageBase(Byte page);
+    void readStatic(Word address);
+    void readDynamic();
+    void pointer(Byte zp);
+    void load(cpu::AddressingMode mode, Word operand, bool penalty);
+    void store(int value);
+    void push(int value);
+    void pull();
+    void addWithCarry();
+
+    bool instruction(const DecodedOp& op, bool last);
+};
+
+void Translator::prologue() {
+    e.push(RBX); e.push(RBP); e.push(R12); e.push(R13); e.push(R14); e.push(R15);
+    e.rr({0x81}, 5, RSP, true); e.dword(8);           // sub rsp, 8 (keeps rsp 16-aligned)
+    e.rr({0x89}, RDI, REG_CPU, true);                 // mov rbx, rdi
+    e.rm({0x0F, 0xB6}, REG_A, field(aOff));
+    e.rm({0x0F, 0xB6}, REG_X, field(xOff));
+    e.rm({0x0F, 0xB6}, REG_Y, field(yOff));
+    e.rm({0x0F, 0xB6}, REG_P, field(pOff));
+    e.rr({0x31}, REG_PENALTY, REG_PENALTY);          // xor ebp, ebp
+    e.rm({0xC6}, 0, Mem(RSP, -1, 0)); e.byte(0);      // helper-write flag; [rsp+4] is scratch
+}
+
+// Expects the next PC in eax and the static cycle count in edx.
+void Translator::emitEpilogue() {
+    e.bind(epilogue);
+    e.byte(0x66); e.rm({0x89}, RAX, field(pcOff));   // mov [PC], ax
+    e.rr({0x01}, REG_PENALTY, RDX, true);             // add rdx, rbp
+    e.rm({0x01}, RDX, field(cyclesOff), true);        // add [cycles], rdx
+    e.rm({0x88}, REG_A, field(aOff));
+    e.rm({0x88}, REG_X, field(xOff));
+    e.rm({0x88}, REG_Y, field(yOff));
+    e.rm({0x88}, REG_P, field(pOff));
+    e.rr({0x81}, 0, RSP, true); e.dword(8);           // add rsp, 8
+    e.pop(R15); e.pop(R14); e.pop(R13); e.pop(R12); e.pop(RBP); e.pop(RBX);
+    e.byte(0xC3);
+}
+
+void Translator::exitTo(Word pc, uint32_t cycles) {
+    e.movImm32(RAX, pc);
+    e.movImm32(RDX, cycles);
+    e.jmp(epilogue);
+}
+
+int Translator::exitLabel(Word pc, uint32_t cycles) {
+    Exit x = { e.newLabel(), pc, cycles };
+    exits.push_back(x);
+    return x.label;
+}
+
+void Translator::setNZ(int reg) {
+    e.movImm64(RCX, (uint64_t)(uintptr_t)nzTable.bits);
+    e.rr({0x0F, 0xB6}, RDX, reg);                     // movzx edx, reg
+    e.rr({0x80}, 4, REG_P); e.byte((Byte)~(N | Z));  // and p, ~(N|Z)
+    e.rm({0x0A}, REG_P, Mem(RCX, RDX, 0));            // or p, [rcx+rdx]
+}
+
+void Translator::setCFromCarry() {
+    e.rr({0x0F, 0x90 + CC_C}, 0, R9);                 // setc r9b
+    e.rr({0x80}, 4, REG_P); e.byte((Byte)~C);
+    e.rr({0x08}, R9, REG_P);                          // or p, r9b
+}
+
+// Effective address of a non-immediate operand into eax.
+void Translator::address(cpu::AddressingMode mode, Word operand, bool penalty) {
+    switch (mode) {
+        case cpu::ZeroPage:
+        case cpu::Absolute:
+            e.movImm32(RAX, operand);
+            break;
+        case cpu::ZeroPageX:
+        case cpu::ZeroPageY:
+            e.rr({0x0F, 0xB6}, RAX, mode == cpu::ZeroPageX ? REG_X : REG_Y);
+            e.rr({0x81}, 0, RAX); e.dword(operand);
+            e.rr({0x81}, 4, RAX); e.dword(0xFF);
+            break;
+        case cpu::AbsoluteX:
+        case cpu::AbsoluteY:
+            e.rr({0x0F, 0xB6}, RAX, mode == cpu::AbsoluteX ? REG_X : REG_Y);
+            e.rr({0x81}, 0, RAX); e.dword(operand);
+            if (penalty) {
+                e.rr({0x89}, RAX, RCX);                 // mov ecx, eax
+                e.rr({0xC1}, 5, RCX); e.byte(8);        // shr ecx, 8
+                e.rr({0x81}, 5, RCX); e.dword(operand >> 8);
+                e.rr({0x01}, RCX, REG_PENALTY);         // add ebp, ecx
+            }
+            e.rr({0x0F, 0xB7}, RAX, RAX);               // movzx eax, ax
+            break;
+        case cpu::IndirectX: {
+            e.rr({0x0F, 0xB6}, RCX, REG_X);
+            e.rr({0x81}, 0, RCX); e.dword(operand);
+            e.rr({0x81}, 4, RCX); e.dword(0xFF);
+            uint16_t limit = bus.readLimits[0];
+            int slow = -1;
+            if (limit < 256) {                          // pointer may touch a device
+                slow = stub(StubPointer, RCX);
+                e.rr({0x81}, 7, RCX); e.dword(limit ? limit - 1 : 0);
+                e.jcc(CC_NC, slow);                     // jae: ecx >= limit - 1
+            }
+            pageBase(0);
+            e.rm({0x0F, 0xB6}, RAX, Mem(RDX, RCX, 0));
+            e.rr({0xFF}, 0, RCX);                       // inc ecx
+            e.rr({0x81}, 4, RCX); e.dword(0xFF);
+            e.rm({0x0F, 0xB6}, RCX, Mem(RDX, RCX, 0));
+            e.rr({0xC1}, 4, RCX); e.byte(8);            // shl ecx, 8
+            e.rr({0x09}, RCX, RAX);                     // or eax, ecx
+            if (slow >= 0) e.bind(stubs.back().resume);
+            break;
+        }
+        case cpu::IndirectY:
+            pointer(operand & 0xFF);
+            if (penalty) {
+                e.rr({0x0F, 0xB6}, RCX, RAX);           // movzx ecx, al
+                e.rr({0x0F, 0xB6}, RDX, REG_Y);
+                e.rr({0x01}, RDX, RCX);                 // add ecx, edx
+                e.rr({0xC1}, 5, RCX); e.byte(8);        // carry out of the low byte
+                e.rr({0x01}, RCX, REG_PENALTY);
+            }
+            e.rr({0x0F, 0xB6}, RCX, REG_Y);
+            e.rr({0x01}, RCX, RAX);                     // add eax, ecx
+            e.rr({0x0F, 0xB7}, RAX, RAX);
+            break;
+        default:
+            break;
+    }
+}
+
+// Registers an out-of-line slow path; the caller binds stubs.back().resume.
+int Translator::stub(StubKind kind, int value) {
+    Stub s = { e.newLabel(), e.newLabel(), kind, value };
+    stubs.push_back(s);
+    return s.label;
+}
+
+// Calls a helper taking (cpu*, esi[, edx]). Clobbers every caller-saved
+// register; the guest state lives in callee-saved ones.
+void Translator::call(const void* helper) {
+    e.rr({0x89}, REG_CPU, RDI, true);                  // mov rdi, rbx
+    e.movImm64(RAX, (uint64_t)(uintptr_t)helper);
+    e.rr({0xFF}, 2, RAX);                              // call rax
+}
+
+// rdx = cpu::pageData[page]
+void Translator::pageBase(Byte page) {
+    e.rm({0x8B}, RDX, field(bus.pageDataOff + page * (int32_t)sizeof(Byte*)), true);
+}
+
+// Byte at a fixed address into eax. The page map is known at translation
+// time, so device addresses call cpu::read() without a runtime test.
+void Translator::readStatic(Word address) {
+    if (fastRead(address)) {
+        pageBase(address >> 8);
+        e.rm({0x0F, 0xB6}, RAX, Mem(RDX, -1, address & 0xFF));
+    } else {
+        e.movImm32(RSI, address);
+        call((const void*)&jitRead);
+        e.rr({0x0F, 0xB6}, RAX, RAX);                  // movzx eax, al
+    }
+}
+
+// Byte at the address in eax into eax, through the page table.
+void Translator::readDynamic() {
+    int slow = stub(StubRead, 0);
+    e.rr({0x89}, RAX, RCX);                            // mov ecx, eax
+    e.rr({0xC1}, 5, RCX); e.byte(8);                   // shr ecx, 8
+    e.rr({0x0F, 0xB6}, RSI, RAX);                      // movzx esi, al
+    e.rm({0x0F, 0xB7}, RDX, Mem(REG_CPU, RCX, bus.readLimitOff, 1));
+    e.rr({0x39}, RDX, RSI);                            // cmp esi, edx
+    e.jcc(CC_NC, slow);
+    e.rm({0x8B}, RDX, Mem(REG_CPU, RCX, bus.pageDataOff, 3), true);
+    e.rm({0x0F, 0xB6}, RAX, Mem(RDX, RSI, 0));
+    e.bind(stubs.back().resume);
+}
+
+// Zero-page pointer at a fixed address into eax.
+void Translator::pointer(Byte zp) {
+    if (fastRead(zp) && fastRead((zp + 1) & 0xFF)) {
+        pageBase(0);
+        e.rm({0x0F, 0xB6}, RAX, Mem(RDX, -1, zp));
+        e.rm({0x0F, 0xB6}, RCX, Mem(RDX, -1, (zp + 1) & 0xFF));
+        e.rr({0xC1}, 4, RCX); e.byte(8);
+        e.rr({0x09}, RCX, RAX);
+    } else {
+        e.movImm32(RSI, zp);
+        call((const void*)&jitPointer);
+        e.rr({0x0F, 0xB7}, RAX, RAX);
+    }
+}
+
+// Operand value into al.
+void Translator::load(cpu::AddressingMode mode, Word operand, bool penalty) {
+    if (mode == cpu::Immediate) {
+        e.movImm8(RAX, operand & 0xFF);
+    } else if (mode == cpu::ZeroPage || mode == cpu::Absolute) {
+        readStatic(operand);
+    } else {
+        address(mode, operand, penalty);
+        readDynamic();
+    }
+}
+
+// Stores value (not rax/rcx/rdx/rsi) at the address in eax. Writes the page
+// table does not allow directly (devices, ROM, pages holding decoded code) go
+// through cpu::write() and end the block.
+void Translator::store(int value) {
+    int slow = stub(StubWrite, value);
+    e.rr({0x89}, RAX, RCX);                            // mov ecx, eax
+    e.rr({0xC1}, 5, RCX); e.byte(8);                   // shr ecx, 8
+    e.rr({0x0F, 0xB6}, RSI, RAX);                      // movzx esi, al
+    e.rm({0x0F, 0xB7}, RDX, Mem(REG_CPU, RCX, bus.writeLimitOff, 1));
+    e.rr({0x39}, RDX, RSI);                            // cmp esi, edx
+    e.jcc(CC_NC, slow);
+    e.rm({0x8B}, RDX, Mem(REG_CPU, RCX, bus.pageDataOff, 3), true);
+    e.rm({0x88}, value, Mem(RDX, RSI, 0));
+    e.bind(stubs.back().resume);
+}
+
+void Translator::push(int value) {
+    e.rm({0x0F, 0xB6}, RAX, field(spOff));
+    e.rm({0xFE}, 1, field(spOff));                     // dec byte [SP]
+    e.rr({0x81}, 0, RAX); e.dword(0x0100);
+    store(value);
+}
+
+void Translator::pull() {
+    e.rm({0xFE}, 0, field(spOff));                     // inc byte [SP]
+    e.rm({0x0F, 0xB6}, RAX, field(spOff));
+    if (bus.readLimits[1] == 256) {
+        pageBase(1);
+        e.rm({0x0F, 0xB6}, RAX, Mem(RDX, RAX, 0));
+    } else {
+        e.rr({0x81}, 0, RAX); e.dword(0x0100);
+        readDynamic();
+    }
+}
+
+// A += al + C, setting N/Z/C/V exactly like cpu::op_ADC.
+void Translator::addWithCarry() {
+    e.rr({0x0F, 0xBA}, 4, REG_P); e.byte(0);           // bt p, 0 -> CF
+    e.rr({0x10}, RAX, REG_A);                          // adc a, al
+    e.rr({0x0F, 0x90 + CC_C}, 0, R9);
+    e.rr({0x0F, 0x90 + CC_O}, 0, R10);
+    e.rr({0xC0}, 4, R10); e.byte(6);                   // shl r10b, 6
+    e.rr({0x08}, R10, R9);
+    e.rr({0x80}, 4, REG_P); e.byte((Byte)~(C | V));
+    e.rr({0x08}, R9, REG_P);
+    setNZ(REG_A);
+}
+
+static bool is(const char* name, const char* mnemonic) {
+    return std::strcmp(name, mnemonic) == 0;
+}
+
+static bool pagePenalty(const char* name, cpu::AddressingMode mode) {
+    if (mode != cpu::AbsoluteX && mode != cpu::AbsoluteY && mode != cpu::IndirectY) return false;
+    return is(name, "LDA") || is(name, "LDX") || is(name, "LDY") || is(name, "ADC") || is(name, "SBC") ||
+           is(name, "AND") || is(name, "ORA") || is(name, "EOR") || is(name, "CMP");
+}
+
+// Emits one guest instruction. Returns false for opcodes left to the
+// interpreter, including CLI and PLP, whose handlers check for a pending IRQ.
+bool Translator::instruction(const DecodedOp& op, bool last) {
+    const char* name = cpu::mnemonic(op.opcode);
+    const cpu::AddressingMode mode = cpu::addressingMode(op.opcode);
+    const Word operand = op.operand;
+    const bool penalty = pagePenalty(name, mode);
+    const uint32_t after = staticCycles + op.cycles;
+    const size_t stubsBefore = stubs.size();
+
+    maxCycles += op.cycles + (penalty ? 1 : 0);
+
+    if (is(name, "LDA") || is(name, "LDX") || is(name, "LDY")) {
+        int reg = name[2] == 'A' ? REG_A : name[2] == 'X' ? REG_X : REG_Y;
+        load(mode, operand, penalty);
+        e.rr({0x88}, RAX, reg);
+        setNZ(reg);
+    } else if (is(name, "STA") || is(name, "STX") || is(name, "STY")) {
+        int reg = name[2] == 'A' ? REG_A : name[2] == 'X' ? REG_X : REG_Y;
+        address(mode, operand, false);
+        store(reg);
+    } else if (is(name, "TAX") || is(name, "TAY") || is(name, "TXA") || is(name, "TYA")) {
+        int src = name[1] == 'A' ? REG_A : name[1] == 'X' ? REG_X : REG_Y;
+        int dst = name[2] == 'A' ? REG_A : name[2] == 'X' ? REG_X : REG_Y;
+        e.rr({0x88}, src, dst);
+        setNZ(dst);
+    } else if (is(name, "TSX")) {
+        e.rm({0x0F, 0xB6}, REG_X, field(spOff));
+        setNZ(REG_X);
+    } else if (is(name, "TXS")) {
+        e.rm({0x88}, REG_X, field(spOff));
+    } else if (is(name, "PHA")) {
+        push(REG_A);
+    } else if (is(name, "PHP")) {
+        e.rr({0x88}, REG_P, R8);
+        e.rr({0x80}, 1, R8); e.byte(B | U);
+        push(R8);
+    } else if (is(name, "PLA")) {
+        pull();
+        e.rr({0x88}, RAX, REG_A);
+        setNZ(REG_A);
+    } else if (is(name, "ADC") || is(name, "SBC")) {
+        load(mode, operand, penalty);
+        if (name[0] == 'S') e.rr({0xF6}, 2, RAX);     // not al
+        addWithCarry();
+    } else if (is(name, "AND") || is(name, "ORA") || is(name, "EOR")) {
+        Byte alu = name[0] == 'A' ? 0x20 : name[0] == 'O' ? 0x08 : 0x30;
+        load(mode, operand, penalty);
+        e.rr({alu}, RAX, REG_A);
+        setNZ(REG_A);
+    } else if (is(name, "CMP") || is(name, "CPX") || is(name, "CPY")) {
+        int reg = name[2] == 'P' ? REG_A : name[2] == 'X' ? REG_X : REG_Y;
+        load(mode, operand, penalty);
+        e.rr({0x88}, reg, R8);
+        e.rr({0x28}, RAX, R8);                         // sub r8b, al
+        e.rr({0x0F, 0x90 + CC_NC}, 0, R9);             // C = no borrow
+        e.rr({0x80}, 4, REG_P); e.byte((Byte)~C);
+        e.rr({0x08}, R9, REG_P);
+        setNZ(R8);
+    } else if (is(name, "BIT")) {
+        load(mode, operand, penalty);
+        e.rr({0x88}, RAX, R9);
+        e.rr({0x80}, 4, R9); e.byte(N | V);
+        e.rr({0x80}, 4, REG_P); e.byte((Byte)~(N | V | Z));
+        e.rr({0x08}, R9, REG_P);
+        e.rr({0x84}, RAX, REG_A);                      // test a, al
+        e.rr({0x0F, 0x90 + CC_Z}, 0, R9);
+        e.rr({0xD0}, 4, R9);                           // shl r9b, 1 -> Z
+        e.rr({0x08}, R9, REG_P);
+    } else if (is(name, "INX") || is(name, "INY") || is(name, "DEX") || is(name, "DEY")) {
+        int reg = name[2] == 'X' ? REG_X : REG_Y;
+        e.rr({0xFE}, name[0] == 'I' ? 0 : 1, reg);
+        setNZ(reg);
+    } else if (is(name, "INC") || is(name, "DEC")) {
+        address(mode, operand, false);
+        e.rm({0x89}, RAX, Mem(RSP, -1, 4));            // save the address
+        readDynamic();
+        e.rr({0x89}, RAX, R8);                          // mov r8d, eax
+        e.rr({0xFE}, name[0] == 'I' ? 0 : 1, R8);
+        setNZ(R8);
+        e.rm({0x8B}, RAX, Mem(RSP, -1, 4));
+        store(R8);
+    } else if (is(name, "ASL") || is(name, "LSR") || is(name, "ROL") || is(name, "ROR")) {
+        int target = REG_A;
+        if (mode != cpu::Accumulator) {
+            address(mode, operand, false);
+            e.rm({0x89}, RAX, Mem(RSP, -1, 4));
+            readDynamic();
+            e.rr({0x89}, RAX, R8);
+            target = R8;
+        }
+        int shift = is(name, "ASL") ? 4 : is(name, "LSR") ? 5 : is(name, "ROL") ? 2 : 3;
+        if (shift == 2 || shift == 3) { e.rr({0x0F, 0xBA}, 4, REG_P); e.byte(0); }
+        e.rr({0xD0}, shift, target);
+        setCFromCarry();
+        setNZ(target);
+        if (target == R8) {
+            e.rm({0x8B}, RAX, Mem(RSP, -1, 4));
+            store(R8);
+        }
+    } else if (is(name, "CLC") || is(name, "CLD") || is(name, "CLV")) {
+        Byte flag = name[2] == 'C' ? C : name[2] == 'D' ? D : V;
+        e.rr({0x80}, 4, REG_P); e.byte((Byte)~flag);
+    } else if (is(name, "SEC") || is(name, "SED") || is(name, "SEI")) {
+        Byte flag = name[2] == 'C' ? C : name[2] == 'D' ? D : I;
+        e.rr({0x80}, 1, REG_P); e.byte(flag);
+    } else if (is(name, "NOP")) {
+        // nothing
+    } else if (is(name, "JMP") && mode == cpu::Absolute) {
+        exitTo(operand, after);
+    } else if (is(name, "JSR")) {
+        Word returnAddr = op.next - 1;
+        e.movImm8(R8, returnAddr >> 8);
+        push(R8);
+        e.movImm8(R8, returnAddr & 0xFF);
+        push(R8);
+        exitTo(operand, after);
+    } else if (is(name, "RTS")) {
+        pull();
+        e.rm({0x89}, RAX, Mem(RSP, -1, 4));            // low byte; pull() may call out
+        pull();
+        e.rr({0xC1}, 4, RAX); e.byte(8);
+        e.rm({0x0B}, RAX, Mem(RSP, -1, 4));            // or eax, [rsp+4]
+        e.rr({0xFF}, 0, RAX);                          // inc eax
+        e.rr({0x0F, 0xB7}, RAX, RAX);
+        e.movImm32(RDX, after);
+        e.jmp(epilogue);
+    } else if (mode == cpu::Relative) {
+        Byte flag;
+        bool whenSet;
+        if (is(name, "BCC")) { flag = C; whenSet = false; }
+        else if (is(name, "BCS")) { flag = C; whenSet = true; }
+        else if (is(name, "BEQ")) { flag = Z; whenSet = true; }
+        else if (is(name, "BNE")) { flag = Z; whenSet = false; }
+        else if (is(name, "BMI")) { flag = N; whenSet = true; }
+        else if (is(name, "BPL")) { flag = N; whenSet = false; }
+        else if (is(name, "BVS")) { flag = V; whenSet = true; }
+        else { flag = V; whenSet = false; }
+        uint32_t extra = ((operand ^ op.next) & 0xFF00) ? 2 : 1;
+        maxCycles += 2;
+        int taken = e.newLabel();
+        e.rr({0xF6}, 0, REG_P); e.byte(flag);          // test p, flag
+        e.jcc(whenSet ? CC_NZ : CC_Z, taken);
+        exitTo(op.next, after);
+        e.bind(taken);
+        exitTo(operand, after + extra);
+    } else {
+        return false;
+    }
+
+    // A helper write may have replaced decoded code; leave at the boundary.
+    bool wrote = false;
+    for (size_t i = stubsBefore; i < stubs.size(); ++i) wrote = wrote || stubs[i].kind == StubWrite;
+    if (wrote && !last) {
+        e.rm({0x80}, 7, Mem(RSP, -1, 0)); e.byte(0);
+        e.jcc(CC_NZ, exitLabel(op.next, after));
+    }
+
+    staticCycles = after;
+    return true;
+}
+
+bool Translator::translate(const Block& block) {
+    epilogue = e.newLabel();
+    prologue();
+    for (size_t i = 0; i < block.ops.size(); ++i) {
+        if (!instruction(block.ops[i], i + 1 == block.ops.size())) return false;
+    }
+    const DecodedOp& tail = block.ops.back();
+    if (!(cpu::addressingMode(tail.opcode) == cpu::Relative || is(cpu::mnemonic(tail.opcode), "JMP") ||
+          is(cpu::mnemonic(tail.opcode), "JSR") || is(cpu::mnemonic(tail.opcode), "RTS"))) {
+        exitTo(tail.next, staticCycles); // block was cut at its length limit
+    }
+
+    for (size_t i = 0; i < stubs.size(); ++i) {
+        const Stub& s = stubs[i];
+        e.bind(s.label);
+        switch (s.kind) {
+            case StubWrite:
+                e.rr({0x89}, RAX, RSI);                 // mov esi, eax
+                e.rr({0x0F, 0xB6}, RDX, s.value);
+                call((const void*)&jitWrite);
+                e.rm({0xC6}, 0, Mem(RSP, -1, 0)); e.byte(1);
+                break;
+            case StubRead:
+                e.rr({0x89}, RAX, RSI);
+                call((const void*)&jitRead);
+                e.rr({0x0F, 0xB6}, RAX, RAX);
+                break;
+            case StubPointer:
+                e.rr({0x89}, s.value, RSI);
+                call((const void*)&jitPointer);
+                e.rr({0x0F, 0xB7}, RAX, RAX);
+                break;
+        }
+        e.jmp(s.resume);
+    }
+    for (size_t i = 0; i < exits.size(); ++i) {
+        e.bind(exits[i].label);
+        exitTo(exits[i].pc, exits[i].cycles);
+    }
+    emitEpilogue();
+    e.resolve();
+    return e.code.size() <= MAX_BLOCK_CODE;
+}
+
+} // namespace
+
+// The arena is never writable and executable at once: it is mapped RW, and
+// compile() makes the pages it writes RW for the copy and RX after it.
+Jit::Jit() : arena(nullptr), arenaSize(ARENA_SIZE), used(0), full(false) {
+    void* p = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) arena = static_cast<Byte*>(p);
+}
+
+Jit::~Jit() {
+    if (arena) munmap(arena, arenaSize);
+}
+
+bool Jit::compile(cpu& c, Block& block) {
+    if (!arena || full) return false;
+    if (arenaSize - used < MAX_BLOCK_CODE) {
+        full = true;
+        return false;
+    }
+    BusLayout bus;
+    bus.pageDataOff = (int32_t)((const char*)c.pageData - (const char*)&c);
+    bus.readLimitOff = (int32_t)((const char*)c.pageReadLimit - (const char*)&c);
+    bus.writeLimitOff = (int32_t)((const char*)c.pageWriteLimit - (const char*)&c);
+    bus.readLimits = c.pageReadLimit;
+    Translator t(c, bus);
+    if (!t.translate(block)) {
+        block.jitFailed = true;
+        return false;
+    }
+    std::vector<Byte>& code = t.code();
+    // The pages may hold earlier blocks, which stay intact through the copy.
+    const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    Byte* first = reinterpret_cast<Byte*>((uintptr_t)(arena + used) & ~(pageSize - 1));
+    const size_t span = (((uintptr_t)(arena + used + code.size()) + pageSize - 1) & ~(pageSize - 1)) - (uintptr_t)first;
+    if (mprotect(first, span, PROT_READ | PROT_WRITE) != 0) {
+        block.jitFailed = true;
+        return false;
+    }
+    std::memcpy(arena + used, code.data(), code.size());
+    if (mprotect(first, span, PROT_READ | PROT_EXEC) != 0) {
+        full = true; // earlier blocks on these pages can't run either
+        return false;
+    }
+    block.native = reinterpret_cast<void (*)(cpu*)>(arena + used);
+    block.maxCycles = t.cycleBound();
+    used += (code.size() + 15) & ~(size_t)15;
+    return true;
+}
+
+// The pages stay executable: a device callback may flush while the block
+// that called it has yet to return. compile() reprotects them as it reuses
+// them.
+void Jit::flush() {
+    used = 0;
+    full = false;
+}
+
+#else // !JIT_X86_64
+
+Jit::Jit() : arena(nullptr), arenaSize(0), used(0), full(false) {}
+Jit::~Jit() {}
+bool Jit::compile(cpu&, Block& block) { block.jitFailed = true; return false; }
+void Jit::flush() {}
+
+#endif
@@ -0,0 +1,386 @@
+#include "loader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char MAGIC[8] = { '6', '5', '0', '2', 'S', 'E', 'G', 'S' };
+const size_t HEADER_SIZE = 8 + 2 + 2 * 3 + 2;
+const size_t ENTRY_SIZE = 2 + 1 + 1 + 4 + 4;
+
+// A read-only view of a whole file, unmapped with the last page that uses it.
+struct Mapping {
+    const Byte* data;
+    size_t size;
+    Mapping(const Byte* data, size_t size) : data(data), size(size) {}
+    ~Mapping() { munmap(const_cast<Byte*>(data), size); }
+};
+
+// Pages being filled in: a view of the mapped file where a segment covers a
+// whole page, a private copy otherwise.
+struct Builder {
+    std::shared_ptr<const Mapping> mapping; // null: nothing may be viewed
+    const Byte* view[256];
+    std::shared_ptr<MemoryPage> own[256];
+    std::vector<RomSegment> segments;
+
+    explicit Builder(const std::shared_ptr<const Mapping>& mapping) : mapping(mapping) {
+        std::fill(view, view + 256, nullptr);
+    }
+
+    Byte* writable(int page) {
+        if (!own[page]) {
+            own[page] = std::make_shared<MemoryPage>();
+            if (view[page]) std::memcpy(own[page]->bytes, view[page], sizeof(MemoryPage));
+            view[page] = nullptr;
+        }
+        return own[page]->bytes;
+    }
+
+    // `data` is viewed rather than copied if it lies in the mapping.
+    void place(Word address, const Byte* data, uint32_t length, bool rom) {
+        const bool viewable = mapping && data >= mapping->data && data + length <= mapping->data + mapping->size;
+        if (!segments.empty() && segments.back().rom == rom &&
+            segments.back().address + segments.back().length == address) {
+            segments.back().length += length; // consecutive HEX records
+        } else {
+            RomSegment segment = { address, length, rom };
+            segments.push_back(segment);
+        }
+        uint32_t at = address;
+        const uint32_t end = address + length;
+        while (at < end) {
+            const int page = at >> 8;
+            const uint32_t offset = at & 0xFF;
+            const uint32_t n = std::min<uint32_t>(256 - offset, end - at);
+            if (viewable && n == 256) {
+                view[page] = data;
+                own[page].reset();
+            } else {
+                std::memcpy(writable(page) + offset, data, n);
+            }
+            at += n;
+            data += n;
+        }
+    }
+
+    bool covers(Word address) const {
+        for (size_t i = 0; i < segments.size(); ++i) {
+            if (address >= segments[i].address && (uint32_t)(address - segments[i].address) < segments[i].length) return true;
+        }
+        return false;
+    }
+
+    void vector(Word address, Word target) {
+        const Byte bytes[2] = { (Byte)(target & 0xFF), (Byte)(target >> 8) };
+        place(address, bytes, 2, false);
+    }
+
+    // Vectors given explicitly (-1: not given) win over the data; a reset
+    // vector the data leaves out points at the lowest address loaded.
+    std::shared_ptr<const RomImage> finish(RomFormat format, int reset, int irq, int nmi, std::string& error) {
+        if (segments.empty()) {
+            error = "no data";
+            return nullptr;
+        }
+        if (reset < 0 && !covers(0xFFFC) && !covers(0xFFFD)) {
+            Word lowest = 0xFFFF;
+            for (size_t i = 0; i < segments.size(); ++i) lowest = std::min(lowest, segments[i].address);
+            reset = lowest;
+        }
+        if (nmi >= 0) vector(0xFFFA, (Word)nmi);
+        if (reset >= 0) vector(0xFFFC, (Word)reset);
+        if (irq >= 0) vector(0xFFFE, (Word)irq);
+
+        std::shared_ptr<RomImage> image = std::make_shared<RomImage>();
+        image->format = format;
+        image->segments = segments;
+        image->mappedPages = 0;
+        for (int page = 0; page < 256; ++page) {
+            if (view[page]) {
+                image->pages[page] = std::shared_ptr<const MemoryPage>(mapping, reinterpret_cast<const MemoryPage*>(view[page]));
+                ++image->mappedPages;
+            } else {
+                image->pages[page] = own[page];
+            }
+        }
+        return image;
+    }
+};
+
+uint16_t u16(const Byte* p) { return p[0] | (p[1] << 8); }
+uint32_t u32(const Byte* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+std::shared_ptr<const RomImage> parseRaw(Builder& b, const Byte* data, size_t size, const RomOptions& options,
+                                         std::string& error) {
+    const long load = options.loadAddress >= 0 ? options.loadAddress : size == 0x10000 ? 0x0000 : 0x0600;
+    if (!size || load + size > 0x10000) {
+        error = size ? "image does not fit below $10000" : "empty image";
+        return nullptr;
+    }
+    b.place((Word)load, data, (uint32_t)size, false);
+    return b.finish(RomRaw, -1, -1, -1, error);
+}
+
+int hexDigit(Byte c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+std::shared_ptr<const RomImage> parseHex(Builder& b, const Byte* data, size_t size, std::string& error) {
+    uint32_t base = 0;
+    int start = -1;
+    size_t line = 0;
+    const Byte* p = data;
+    const Byte* end = data + size;
+    while (p < end) {
+        if (*p == '\n') ++line;
+        if (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t') {
+            ++p;
+            continue;
+        }
+        const std::string where = "line " + std::to_string(line + 1) + ": ";
+        if (*p++ != ':') {
+            error = where + "expected ':'";
+            return nullptr;
+        }
+        // Count, address, type, data, checksum: decode the whole record first.
+        Byte record[5 + 255];
+        size_t n = 0;
+        while (p + 1 < end && hexDigit(p[0]) >= 0 && hexDigit(p[1]) >= 0 && n < sizeof(record)) {
+            record[n++] = (Byte)(hexDigit(p[0]) << 4 | hexDigit(p[1]));
+            p += 2;
+        }
+        if (n < 5 || n != 5u + record[0]) {
+            error = where + "malformed record";
+            return nullptr;
+        }
+        Byte sum = 0;
+        for (size_t i = 0; i < n; ++i) sum += record[i];
+        if (sum) {
+            error = where + "bad checksum";
+            return nullptr;
+        }
+        const Byte count = record[0];
+        const Byte* bytes = record + 4;
+        switch (record[3]) {
+            case 0x00: {
+                const uint32_t address = base + (record[1] << 8 | record[2]); // big-endian, unlike the 6502
+                if (address + count > 0x10000) {
+                    error = where + "data beyond $FFFF";
+                    return nullptr;
+                }
+                if (count) b.place((Word)address, bytes, count, false);
+                break;
+            }
+            case 0x01:
+                return b.finish(RomIntelHex, start, -1, -1, error);
+            case 0x02:
+            case 0x04:
+                if (count != 2) {
+                    error = where + "malformed record";
+                    return nullptr;
+                }
+                base = record[3] == 0x02 ? (uint32_t)(bytes[0] << 8 | bytes[1]) << 4
+                                         : (uint32_t)(bytes[0] << 8 | bytes[1]) << 16;
+                break;
+            case 0x03:
+            case 0x05: {
+                if (count != 4) {
+                    error = where + "malformed record";
+                    return nullptr;
+                }
+                const uint32_t address = record[3] == 0x03
+                    ? ((uint32_t)(bytes[0] << 8 | bytes[1]) << 4) + (bytes[2] << 8 | bytes[3])
+                    : (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+                if (address > 0xFFFF) {
+                    error = where + "start address beyond $FFFF";
+                    return nullptr;
+                }
+                start = (int)address;
+                break;
+            }
+            default:
+                error = where + "unknown record type";
+                return nullptr;
+        }
+    }
+    error = "no end-of-file record";
+    return nullptr;
+}
+
+std::shared_ptr<const RomImage> parseSegments(Builder& b, const Byte* data, size_t size, std::string& error) {
+    if (size < HEADER_SIZE || std::memcmp(data, MAGIC, 8) != 0) {
+        error = "not a segment image";
+        return nullptr;
+    }
+    if (u16(data + 8) != ROM_SEGMENTS_VERSION) {
+        error = "unsupported segment image version";
+        return nullptr;
+    }
+    const int vectors[3] = { u16(data + 10), u16(data + 12), u16(data + 14) };
+    const size_t count = u16(data + 16);
+    if (size < HEADER_SIZE + count * ENTRY_SIZE) {
+        error = "truncated segment table";
+        return nullptr;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const Byte* entry = data + HEADER_SIZE + i * ENTRY_SIZE;
+        const Word address = u16(entry);
+        const uint32_t length = u32(entry + 4);
+        const uint32_t offset = u32(entry + 8);
+        if (!length || address + length > 0x10000 || offset > size || length > size - offset) {
+            error = "segment " + std::to_string(i) + " out of range";
+            return nullptr;
+        }
+        if ((entry[2] & 1) && ((address | length) & 0xFF)) {
+            error = "ROM segment " + std::to_string(i) + " does not start and end on a page boundary";
+            return nullptr;
+        }
+        b.place(address, data + offset, length, (entry[2] & 1) != 0);
+    }
+    return b.finish(RomSegments, vectors[0] ? vectors[0] : -1, vectors[1] ? vectors[1] : -1,
+                    vectors[2] ? vectors[2] : -1, error);
+}
+
+std::shared_ptr<const RomImage> parse(const std::shared_ptr<const Mapping>& mapping, const Byte* data, size_t size,
+                                      const RomOptions& options, std::string& error) {
+    RomFormat format = options.format;
+    if (format == RomAuto) {
+        const Byte* first = data;
+        while (first < data + size && (*first == ' ' || *first == '\t' || *first == '\r' || *first == '\n')) ++first;
+        format = size >= 8 && std::memcmp(data, MAGIC, 8) == 0 ? RomSegments
+               : first < data + size && *first == ':'         ? RomIntelHex
+                                                               : RomRaw;
+    }
+    Builder b(format == RomIntelHex ? nullptr : mapping); // HEX is text: nothing to view
+    switch (format) {
+        case RomIntelHex: return parseHex(b, data, size, error);
+        case RomSegments: return parseSegments(b, data, size, error);
+        default:          return parseRaw(b, data, size, options, error);
+    }
+}
+
+struct CacheEntry {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+    std::shared_ptr<const RomImage> image;
+};
+
+std::mutex cacheLock;
+std::map<std::string, CacheEntry> cache;
+
+struct timespec modifiedTime(const struct stat& st) {
+#ifdef __APPLE__
+    return st.st_mtimespec;
+#else
+    return st.st_mtim;
+#endif
+}
+
+bool unchanged(const CacheEntry& entry, const struct stat& st) {
+    const struct timespec modified = modifiedTime(st);
+    return entry.device == st.st_dev && entry.inode == st.st_ino && entry.size == st.st_size &&
+           entry.modified.tv_sec == modified.tv_sec && entry.modified.tv_nsec == modified.tv_nsec;
+}
+
+} // namespace
+
+std::shared_ptr<const RomImage> parseRom(const Byte* data, size_t size, const RomOptions& options, std::string& error) {
+    return parse(nullptr, data, size, options, error);
+}
+
+std::shared_ptr<const RomImage> openRom(const std::string& path, const RomOptions& options, std::string& error) {
+    const std::string key = path + '\n' + std::to_string(options.format) + '\n' + std::to_string(options.loadAddress);
+    std::lock_guard<std::mutex> lock(cacheLock);
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        error = path + ": " + std::strerror(errno);
+        return nullptr;
+    }
+    std::map<std::string, CacheEntry>::const_iterator hit = cache.find(key);
+    if (hit != cache.end() && unchanged(hit->second, st)) return hit->second.image;
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error = path + ": " + std::strerror(errno);
+        if (fd >= 0) close(fd);
+        return nullptr;
+    }
+    std::shared_ptr<const Mapping> mapping;
+    if (st.st_size > 0) {
+        void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            error = path + ": " + std::strerror(errno);
+            close(fd);
+            return nullptr;
+        }
+        mapping = std::make_shared<Mapping>(static_cast<const Byte*>(data), (size_t)st.st_size);
+    }
+    close(fd);
+
+    std::shared_ptr<const RomImage> image = parse(mapping, mapping ? mapping->data : nullptr,
+                                                  mapping ? mapping->size : 0, options, error);
+    if (!image) {
+        error = path + ": " + error;
+        return nullptr;
+    }
+    CacheEntry entry = { st.st_dev, st.st_ino, st.st_size, modifiedTime(st), image };
+    cache[key] = entry;
+    return image;
+}
+
+void clearRomCache() {
+    std::lock_guard<std::mutex> lock(cacheLock);
+    cache.clear();
+}
+
+size_t romCacheSize() {
+    std::lock_guard<std::mutex> lock(cacheLock);
+    return cache.size();
+}
+
+bool writeSegments(std::ostream& out, const RomImage& image, Word reset, Word irq, Word nmi) {
+    const std::vector<RomSegment>& segments = image.segments;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        if (segments[i].rom && ((segments[i].address | segments[i].length) & 0xFF)) return false;
+    }
+    std::vector<Byte> header(HEADER_SIZE + segments.size() * ENTRY_SIZE);
+    Byte* p = header.data();
+    std::memcpy(p, MAGIC, 8); p += 8;
+    const Word fields[5] = { ROM_SEGMENTS_VERSION, reset, irq, nmi, (Word)segments.size() };
+    for (int i = 0; i < 5; ++i) {
+        *p++ = fields[i] & 0xFF;
+        *p++ = fields[i] >> 8;
+    }
+    uint32_t offset = (uint32_t)header.size();
+    for (size_t i = 0; i < segments.size(); ++i) {
+        *p++ = segments[i].address & 0xFF;
+        *p++ = segments[i].address >> 8;
+        *p++ = segments[i].rom ? 1 : 0;
+        *p++ = 0;
+        for (int b = 0; b < 4; ++b) *p++ = (Byte)(segments[i].length >> (8 * b));
+        for (int b = 0; b < 4; ++b) *p++ = (Byte)(offset >> (8 * b));
+        offset += segments[i].length;
+    }
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    for (size_t i = 0; i < segments.size(); ++i) {
+        for (uint32_t a = segments[i].address; a < segments[i].address + segments[i].length; ++a) {
+            const MemoryPage* page = image.pages[a >> 8].get();
+            out.put((char)(page ? page->bytes[a & 0xFF] : 0));
+        }
+    }
+    return out.good();
+}
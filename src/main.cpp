@@ -1,57 +1,187 @@
 #include "cpu.h"
 #include "frontend.h"
+#include "devices.h"
+#include "emulator.h"
+#include "headless.h"
+#include "loader.h"
+#include "profiler.h"
+#include "replay.h"
+#include "snake.h"
+#include "trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
-#include <vector>
+#include <memory>
 #include <random>
+#include <thread>
+#include <vector>
 #include <string>
 
+static const uint64_t CLOCK_HZ = 1000000;
+static const unsigned FRAME_RATE = 60;
+
+// Forwards input and presents finished frames until the frontend quits or
+// the emulator passes `stopAt` cycles (0: never).
+template <class Front>
+static void present(Front& fe, Emulator& emu, uint64_t stopAt) {
+    bool running = true;
+    while (running && (!stopAt || emu.cycles() < stopAt)) {
+        running = fe.handle_events(emu.input());
+        if (const Frame* frame = emu.takeFrame()) fe.draw_if_changed(*frame);
+        else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
 int main(int argc, char** argv) {
-    std::string romPath = (argc >= 2 ? argv[1] : std::string("snake.bin"));
-
-    std::vector<Byte> snake_game = {
-        0x20, 0x06, 0x06, 0x20, 0x38, 0x06, 0x20, 0x0d, 0x06, 0x20, 0x2a, 0x06, 0x60, 0xa9, 0x02, 0x85,
-        0x02, 0xa9, 0x04, 0x85, 0x03, 0xa9, 0x11, 0x85, 0x10, 0xa9, 0x10, 0x85, 0x12, 0xa9, 0x0f, 0x85,
-        0x14, 0xa9, 0x04, 0x85, 0x11, 0x85, 0x13, 0x85, 0x15, 0x60, 0xa5, 0xfe, 0x85, 0x00, 0xa5, 0xfe,
-        0x29, 0x03, 0x18, 0x69, 0x02, 0x85, 0x01, 0x60, 0x20, 0x4d, 0x06, 0x20, 0x8d, 0x06, 0x20, 0xc3,
-        0x06, 0x20, 0x19, 0x07, 0x20, 0x20, 0x07, 0x20, 0x2d, 0x07, 0x4c, 0x38, 0x06, 0xa5, 0xff, 0xc9,
-        0x77, 0xf0, 0x0d, 0xc9, 0x64, 0xf0, 0x14, 0xc9, 0x73, 0xf0, 0x1b, 0xc9, 0x61, 0xf0, 0x22, 0x60,
-        0xa9, 0x04, 0x24, 0x02, 0xd0, 0x26, 0xa9, 0x01, 0x85, 0x02, 0x60, 0xa9, 0x08, 0x24, 0x02, 0xd0,
-        0x1b, 0xa9, 0x02, 0x85, 0x02, 0x60, 0xa9, 0x01, 0x24, 0x02, 0xd0, 0x10, 0xa9, 0x04, 0x85, 0x02,
-        0x60, 0xa9, 0x02, 0x24, 0x02, 0xd0, 0x05, 0xa9, 0x08, 0x85, 0x02, 0x60, 0x60, 0x20, 0x94, 0x06,
-        0x20, 0xa8, 0x06, 0x60, 0xa5, 0x00, 0xc5, 0x10, 0xd0, 0x0d, 0xa5, 0x01, 0xc5, 0x11, 0xd0, 0x07,
-        0xe6, 0x03, 0xe6, 0x03, 0x20, 0x2a, 0x06, 0x60, 0xa2, 0x02, 0xb5, 0x10, 0xc5, 0x10, 0xd0, 0x06,
-        0xb5, 0x11, 0xc5, 0x11, 0xf0, 0x09, 0xe8, 0xe8, 0xe4, 0x03, 0xf0, 0x06, 0x4c, 0xaa, 0x06, 0x4c,
-        0x35, 0x07, 0x60, 0xa6, 0x03, 0xca, 0x8a, 0xb5, 0x10, 0x95, 0x12, 0xca, 0x10, 0xf9, 0xa5, 0x02,
-        0x4a, 0xb0, 0x09, 0x4a, 0xb0, 0x19, 0x4a, 0xb0, 0x1f, 0x4a, 0xb0, 0x2f, 0xa5, 0x10, 0x38, 0xe9,
-        0x20, 0x85, 0x10, 0x90, 0x01, 0x60, 0xc6, 0x11, 0xa9, 0x01, 0xc5, 0x11, 0xf0, 0x28, 0x60, 0xe6,
-        0x10, 0xa9, 0x1f, 0x24, 0x10, 0xf0, 0x1f, 0x60, 0xa5, 0x10, 0x18, 0x69, 0x20, 0x85, 0x10, 0xb0,
-        0x01, 0x60, 0xe6, 0x11, 0xa9, 0x06, 0xc5, 0x11, 0xf0, 0x0c, 0x60, 0xc6, 0x10, 0xa5, 0x10, 0x29,
-        0x1f, 0xc9, 0x1f, 0xf0, 0x01, 0x60, 0x4c, 0x35, 0x07, 0xa0, 0x00, 0xa5, 0xfe, 0x91, 0x00, 0x60,
-        0xa6, 0x03, 0xa9, 0x00, 0x81, 0x10, 0xa2, 0x00, 0xa9, 0x01, 0x81, 0x10, 0x60, 0xa2, 0x00, 0xea,
-        0xea, 0xca, 0xd0, 0xfb, 0x60
-    };
+    std::string romPath; // empty: the built-in snake game
+    RomOptions romOptions;
+    std::string tracePath;
+    std::string profilePath;
+    std::string videoPath;
+    std::string telemetryName;
+    std::string recordPath;
+    std::string replayPath;
+    uint32_t seed = std::random_device{}();
+    int scale = 8;
+    uint64_t frameLimit = 0;
+    bool throttled = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--unthrottled") throttled = false;
+        else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+        else if (arg == "--profile" && i + 1 < argc) profilePath = argv[++i];
+        else if (arg == "--headless" && i + 1 < argc) videoPath = argv[++i];
+        else if (arg == "--telemetry" && i + 1 < argc) telemetryName = argv[++i];
+        else if (arg == "--scale" && i + 1 < argc) scale = std::atoi(argv[++i]);
+        else if (arg == "--frames" && i + 1 < argc) frameLimit = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc) replayPath = argv[++i];
+        else if (arg == "--seed" && i + 1 < argc) seed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--load" && i + 1 < argc) romOptions.loadAddress = (int)std::strtoul(argv[++i], nullptr, 16);
+        else romPath = arg;
+    }
+
+    InputLog log;
+    if (!replayPath.empty()) {
+        std::ifstream in(replayPath, std::ios::binary);
+        if (!readInputLog(in, log)) {
+            std::cerr << "Cannot read input log " << replayPath << std::endl;
+            return 1;
+        }
+        seed = log.seed;
+    }
 
     cpu cpu;
-    cpu.loadAt0600AndSetReset(snake_game);
+    RandomDevice random(0x00FE, seed);
+    KeyboardDevice keys(0x00FF);
+    ScreenDevice screen(cpu, 0x0200);
+    cpu.attachDevice(random.device());
+    cpu.attachDevice(keys.device());
+    cpu.attachDevice(screen.device());
+    if (romPath.empty()) {
+        cpu.loadAt0600AndSetReset(snakeGame());
+    } else {
+        std::string error;
+        std::shared_ptr<const RomImage> rom = openRom(romPath, romOptions, error);
+        if (!rom) {
+            std::cerr << "Cannot load " << error << std::endl;
+            return 1;
+        }
+        cpu.loadImage(*rom);
+    }
+    cpu.mapRom(0xFF, 0xFF); // vectors
     cpu.reset();
 
-    Frontend fe;
-    if (!fe.init()) return 1;
+    std::unique_ptr<Tracer> tracer;
+    if (!tracePath.empty()) {
+        tracer.reset(new Tracer(tracePath));
+        if (!tracer->ok()) {
+            std::cerr << "Cannot write trace to " << tracePath << std::endl;
+            return 1;
+        }
+        cpu.setTracer(tracer.get());
+    }
 
-    std::mt19937 rng{std::random_device{}()};
-    std::uniform_int_distribution<int> rnd(1, 15);
+    std::unique_ptr<Profiler> profiler;
+    if (!profilePath.empty()) {
+        profiler.reset(new Profiler());
+        cpu.setProfiler(profiler.get());
+    }
 
-    bool running = true;
-    const Word SCREEN_START = 0x0200;
-    const Word RNG_ADDR = 0x00FE;
+    std::unique_ptr<Telemetry> telemetry;
+    if (!telemetryName.empty()) {
+        telemetry.reset(new Telemetry(telemetryName, Telemetry::Create));
+        if (!telemetry->ok()) {
+            std::cerr << "Cannot create telemetry segment " << telemetryName << std::endl;
+            return 1;
+        }
+    }
+
+    // The cpu runs on its own thread at 1 MHz in 60 Hz slices; this thread
+    // only forwards input and presents finished frames.
+    const uint64_t cyclesPerFrame = CLOCK_HZ / FRAME_RATE;
+    const uint64_t stopAt = frameLimit * cyclesPerFrame;
+    Emulator emu(cpu, screen, keys, replayPath.empty() ? CLOCK_HZ : log.clockHz,
+                 replayPath.empty() ? FRAME_RATE : log.frameRate);
+    emu.setThrottled(throttled);
+    emu.setTelemetry(telemetry.get());
+    emu.enableRewind(300, 6); // Backspace steps back through the last 30 seconds
+    if (!recordPath.empty()) {
+        log.seed = seed;
+        emu.record(&log);
+    }
+
+    int status = 0;
+    if (!replayPath.empty()) {
+        // No frontend and no pacing: the frames run back to back on this thread.
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        bool inStep = emu.replay(log);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        uint64_t hash = stateHash(cpu);
+        std::printf("%llu frames, %llu cycles in %.3f s, state %016llx\n", (unsigned long long)log.frames,
+                    (unsigned long long)cpu.cycles, seconds, (unsigned long long)hash);
+        if (!inStep || hash != log.finalHash) {
+            std::printf("diverged from the recording (expected state %016llx)\n", (unsigned long long)log.finalHash);
+            return 1;
+        }
+    } else if (!videoPath.empty()) {
+        // Nobody is watching, so there is no input and no SDL.
+        HeadlessFrontend fe(videoPath, scale, cyclesPerFrame, FRAME_RATE);
+        if (!fe.init()) return 1;
+        emu.start();
+        present(fe, emu, stopAt);
+        emu.stop();
+        uint64_t end = emu.cycles();
+        if (stopAt && end >= stopAt) end = stopAt - 1; // exactly frameLimit frames
+        if (!fe.finish(end)) {
+            std::cerr << "Cannot write video to " << videoPath << std::endl;
+            status = 1;
+        }
+        if (fe.droppedFrames()) std::cerr << fe.droppedFrames() << " frames dropped while the disk was busy" << std::endl;
+    } else {
+        Frontend fe;
+        if (!fe.init()) return 1;
+        fe.setTelemetry(telemetry.get());
+        emu.start();
+        present(fe, emu, stopAt);
+        emu.stop();
+    }
+
+    if (!recordPath.empty()) {
+        std::ofstream out(recordPath, std::ios::binary);
+        if (!writeInputLog(out, log)) std::cerr << "Cannot write input log to " << recordPath << std::endl;
+    }
 
-    while (running) {
-        running = fe.handle_events(cpu);
-        cpu.write(RNG_ADDR, (Byte)rnd(rng));
-        fe.draw_if_changed(&cpu.memory[SCREEN_START]);
-        cpu.execute();
-        SDL_Delay(1);
+    if (profiler) {
+        std::ofstream report(profilePath);
+        profiler->writeHistogram(report);
+        profiler->writeListing(report, cpu);
+        std::ofstream folded(profilePath + ".folded");
+        profiler->writeFoldedStacks(folded);
+        if (!report || !folded) std::cerr << "Cannot write profile to " << profilePath << std::endl;
     }
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,18 @@
+#include "pool.h"
+
+CpuPool::Handle CpuPool::acquire() {
+    cpu* c;
+    if (freeList.empty()) {
+        machines.emplace_back();
+        c = &machines.back();
+    } else {
+        c = freeList.back();
+        freeList.pop_back();
+    }
+    return Handle(c, Release{ this });
+}
+
+void CpuPool::release(cpu* c) {
+    c->clear();
+    freeList.push_back(c);
+}
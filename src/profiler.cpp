@@ -0,0 +1,136 @@
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <ostream>
+#include <string>
+
+static const char* const modeNames[] = {
+    "Immediate", "ZeroPage", "ZeroPageX", "ZeroPageY", "Absolute", "AbsoluteX", "AbsoluteY",
+    "Indirect", "IndirectX", "IndirectY", "Implied", "Accumulator", "Relative"
+};
+static const int MODE_COUNT = sizeof(modeNames) / sizeof(modeNames[0]);
+
+Profiler::Profiler() : hits(0x10000), cycleCounts(0x10000) {
+    clear();
+}
+
+void Profiler::clear() {
+    std::fill(hits.begin(), hits.end(), 0);
+    std::fill(cycleCounts.begin(), cycleCounts.end(), 0);
+    std::fill(opcodeHits, opcodeHits + 256, 0);
+    std::fill(opcodeCycles, opcodeCycles + 256, 0);
+    totalCycles = 0;
+    nodes.assign(1, Node{ 0, 0, 0 });
+    children.clear();
+    stack.clear();
+    node = 0;
+}
+
+uint64_t Profiler::instructions() const {
+    uint64_t n = 0;
+    for (int op = 0; op < 256; ++op) n += opcodeHits[op];
+    return n;
+}
+
+// JSR has already pushed its return address, so SP + 2 is the level the
+// matching RTS returns to. Frames at or below that level were abandoned
+// (the guest reset SP or dropped its return address) and are closed first.
+void Profiler::call(const cpu& c) {
+    Byte sp = (Byte)(c.SP + 2);
+    unwind(sp);
+    uint64_t key = ((uint64_t)node << 16) | c.PC;
+    std::unordered_map<uint64_t, uint32_t>::iterator it = children.find(key);
+    uint32_t child;
+    if (it != children.end()) {
+        child = it->second;
+    } else {
+        child = (uint32_t)nodes.size();
+        nodes.push_back(Node{ node, c.PC, 0 });
+        children[key] = child;
+    }
+    stack.push_back(Frame{ node, sp });
+    node = child;
+}
+
+// Closes every frame whose caller's stack level has been reached again.
+void Profiler::unwind(Byte sp) {
+    while (!stack.empty() && stack.back().sp <= sp) {
+        node = stack.back().node;
+        stack.pop_back();
+    }
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+void Profiler::writeListing(std::ostream& out, const cpu& c) const {
+    char line[128];
+    std::snprintf(line, sizeof(line), "; %llu instructions, %llu cycles\n",
+                  (unsigned long long)instructions(), (unsigned long long)totalCycles);
+    out << line;
+    out << ";       hits       cycles  cycle%  addr   instruction\n";
+    for (int pc = 0; pc < 0x10000; ++pc) {
+        if (!hits[pc]) continue;
+        Word at = (Word)pc;
+        Byte opcode = c.peek(at);
+        std::string text = cpu::disassemble(at, opcode, c.peek((Word)(at + 1)), c.peek((Word)(at + 2)));
+        std::snprintf(line, sizeof(line), "%12llu %12llu %6.2f%%  $%04X  %s\n",
+                      (unsigned long long)hits[pc], (unsigned long long)cycleCounts[pc],
+                      percent(cycleCounts[pc], totalCycles), pc, text.c_str());
+        out << line;
+    }
+}
+
+void Profiler::writeHistogram(std::ostream& out) const {
+    char line[128];
+    std::vector<int> order;
+    for (int op = 0; op < 256; ++op) {
+        if (opcodeHits[op]) order.push_back(op);
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b) { return opcodeCycles[a] > opcodeCycles[b]; });
+    out << "; opcode        mode               hits       cycles  cycle%\n";
+    for (size_t i = 0; i < order.size(); ++i) {
+        int op = order[i];
+        std::snprintf(line, sizeof(line), "  $%02X %-8s %-12s %12llu %12llu %6.2f%%\n", op, cpu::mnemonic((Byte)op),
+                      modeNames[cpu::addressingMode((Byte)op)], (unsigned long long)opcodeHits[op],
+                      (unsigned long long)opcodeCycles[op], percent(opcodeCycles[op], totalCycles));
+        out << line;
+    }
+
+    uint64_t modeHits[MODE_COUNT] = {};
+    uint64_t modeCycles[MODE_COUNT] = {};
+    for (int op = 0; op < 256; ++op) {
+        modeHits[cpu::addressingMode((Byte)op)] += opcodeHits[op];
+        modeCycles[cpu::addressingMode((Byte)op)] += opcodeCycles[op];
+    }
+    std::vector<int> modes;
+    for (int m = 0; m < MODE_COUNT; ++m) {
+        if (modeHits[m]) modes.push_back(m);
+    }
+    std::sort(modes.begin(), modes.end(), [&modeCycles](int a, int b) { return modeCycles[a] > modeCycles[b]; });
+    out << "; mode                      hits       cycles  cycle%\n";
+    for (size_t i = 0; i < modes.size(); ++i) {
+        int m = modes[i];
+        std::snprintf(line, sizeof(line), "  %-16s %12llu %12llu %6.2f%%\n", modeNames[m],
+                      (unsigned long long)modeHits[m], (unsigned long long)modeCycles[m],
+                      percent(modeCycles[m], totalCycles));
+        out << line;
+    }
+}
+
+void Profiler::writeFoldedStacks(std::ostream& out) const {
+    std::vector<Word> path;
+    char frame[8];
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        if (!nodes[n].cycles) continue;
+        path.clear();
+        for (uint32_t at = (uint32_t)n; at != 0; at = nodes[at].parent) path.push_back(nodes[at].entry);
+        out << "root";
+        for (size_t i = path.size(); i-- > 0;) {
+            std::snprintf(frame, sizeof(frame), ";$%04X", path[i]);
+            out << frame;
+        }
+        out << ' ' << nodes[n].cycles << '\n';
+    }
+}
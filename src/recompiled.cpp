@@ -0,0 +1,39 @@
+#include "recompiled.h"
+#include <algorithm>
+
+// Cycles interpreted at a time while the guest runs outside the image.
+static const uint64_t LEAVE_CYCLES = 64;
+
+bool RecompiledRom::matches(const cpu& c) const {
+    for (unsigned i = 0; i < size; ++i) {
+        if (c.peek((Word)(origin + i)) != image[i]) return false;
+    }
+    return true;
+}
+
+uint64_t runRecompiled(const RecompiledRom& rom, cpu& c, uint64_t cycleBudget) {
+    const uint64_t start = c.cycles;
+    const uint64_t target = start + cycleBudget;
+    bool native = rom.matches(c);
+    while (c.cycles < target) {
+        if (!native) {
+            c.run(target - c.cycles);
+            break;
+        }
+        switch (rom.run(c, target)) {
+            case RecompiledRom::Budget:
+                c.run(target - c.cycles); // the interpreter finds the exact stopping point
+                break;
+            case RecompiledRom::Modified:
+                native = rom.matches(c);
+                break;
+            case RecompiledRom::Leave:
+                // One instruction, then translated code again; outside the
+                // image, a short stretch before looking again.
+                if ((Word)(c.PC - rom.origin) < rom.size) c.run(1);
+                else c.run(std::min<uint64_t>(LEAVE_CYCLES, target - c.cycles));
+                break;
+        }
+    }
+    return c.cycles - start;
+}
@@ -0,0 +1,85 @@
+#include "replay.h"
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+static const char MAGIC[8] = { '6', '5', '0', '2', 'I', 'N', 'P', 'T' };
+static const size_t HEADER_SIZE = 8 + 2 + 4 + 8 + 4 + 4 + 4 + 8 + 8 + 4;
+static const size_t EVENT_SIZE = 8 + 8 + 1 + 1;
+
+static Byte* put(Byte* p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) *p++ = (Byte)(value >> (8 * i));
+    return p;
+}
+
+static uint64_t get(const Byte*& p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) value |= (uint64_t)*p++ << (8 * i);
+    return value;
+}
+
+bool writeInputLog(std::ostream& out, const InputLog& log) {
+    Byte header[HEADER_SIZE];
+    Byte* p = header;
+    std::memcpy(p, MAGIC, 8); p += 8;
+    p = put(p, INPUT_LOG_VERSION, 2);
+    p = put(p, log.seed, 4);
+    p = put(p, log.clockHz, 8);
+    p = put(p, log.frameRate, 4);
+    p = put(p, log.rewindSlots, 4);
+    p = put(p, log.rewindInterval, 4);
+    p = put(p, log.frames, 8);
+    p = put(p, log.finalHash, 8);
+    p = put(p, log.events.size(), 4);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    for (size_t i = 0; i < log.events.size(); ++i) {
+        const InputLog::Event& e = log.events[i];
+        Byte record[EVENT_SIZE];
+        p = put(record, e.frame, 8);
+        p = put(p, e.cycles, 8);
+        *p++ = (Byte)e.input.kind;
+        *p++ = e.input.key;
+        out.write(reinterpret_cast<const char*>(record), sizeof(record));
+    }
+    return out.good();
+}
+
+bool readInputLog(std::istream& in, InputLog& log) {
+    Byte header[HEADER_SIZE];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    const Byte* p = header;
+    if (std::memcmp(p, MAGIC, 8) != 0) return false;
+    p += 8;
+    if (get(p, 2) != INPUT_LOG_VERSION) return false;
+    log.seed = (uint32_t)get(p, 4);
+    log.clockHz = get(p, 8);
+    log.frameRate = (unsigned)get(p, 4);
+    log.rewindSlots = (uint32_t)get(p, 4);
+    log.rewindInterval = (uint32_t)get(p, 4);
+    log.frames = get(p, 8);
+    log.finalHash = get(p, 8);
+    uint32_t count = (uint32_t)get(p, 4);
+    if (!log.clockHz || !log.frameRate) return false;
+    log.events.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        Byte record[EVENT_SIZE];
+        if (!in.read(reinterpret_cast<char*>(record), sizeof(record))) return false;
+        const Byte* r = record;
+        InputLog::Event e;
+        e.frame = get(r, 8);
+        e.cycles = get(r, 8);
+        e.input.kind = *r++ == Input::Rewind ? Input::Rewind : Input::Key;
+        e.input.key = *r++;
+        log.events.push_back(e);
+    }
+    return true;
+}
+
+uint64_t stateHash(const cpu& c) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    Byte regs[15] = { (Byte)(c.PC & 0xFF), (Byte)(c.PC >> 8), c.SP, c.A, c.X, c.Y, c.P };
+    for (int i = 0; i < 8; ++i) regs[7 + i] = (Byte)(c.cycles >> (8 * i));
+    for (size_t i = 0; i < sizeof(regs); ++i) hash = (hash ^ regs[i]) * 0x100000001B3ull;
+    for (int a = 0; a < 0x10000; ++a) hash = (hash ^ c.peek((Word)a)) * 0x100000001B3ull;
+    return hash;
+}
@@ -0,0 +1,46 @@
+#include "scheduler.h"
+#include <algorithm>
+
+Scheduler::Scheduler() : nextId(1) {}
+
+uint64_t Scheduler::add(uint64_t cycle, const std::function<void()>& callback) {
+    heap.push_back(Event{ cycle, nextId, callback });
+    std::push_heap(heap.begin(), heap.end(), Later());
+    return nextId++;
+}
+
+// Cancelled events stay in the heap with an empty callback until they reach
+// the top; a machine only ever has a handful pending, so the scan is cheap.
+bool Scheduler::cancel(uint64_t id) {
+    for (size_t i = 0; i < heap.size(); ++i) {
+        if (heap[i].id != id || !heap[i].callback) continue;
+        heap[i].callback = nullptr;
+        dropCancelled();
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::clear() {
+    heap.clear();
+}
+
+void Scheduler::fire(uint64_t now) {
+    while (!heap.empty() && heap.front().cycle <= now) {
+        std::function<void()> callback;
+        callback.swap(heap.front().callback);
+        pop();
+        callback();
+        dropCancelled();
+    }
+}
+
+void Scheduler::pop() {
+    std::pop_heap(heap.begin(), heap.end(), Later());
+    heap.pop_back();
+}
+
+// Keeps the top of the heap a live event so next() stays exact.
+void Scheduler::dropCancelled() {
+    while (!heap.empty() && !heap.front().callback) pop();
+}
@@ -0,0 +1,86 @@
+#include "snapshot.h"
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <set>
+
+static const char MAGIC[8] = { '6', '5', '0', '2', 'S', 'N', 'A', 'P' };
+static const size_t HEADER_SIZE = 8 + 2 + 2 + 5 + 8;
+
+bool writeSnapshot(std::ostream& out, const Snapshot& state) {
+    Byte header[HEADER_SIZE];
+    Byte* p = header;
+    std::memcpy(p, MAGIC, 8); p += 8;
+    *p++ = SNAPSHOT_VERSION & 0xFF;
+    *p++ = SNAPSHOT_VERSION >> 8;
+    *p++ = state.PC & 0xFF;
+    *p++ = state.PC >> 8;
+    *p++ = state.SP;
+    *p++ = state.A;
+    *p++ = state.X;
+    *p++ = state.Y;
+    *p++ = state.P;
+    for (int i = 0; i < 8; ++i) *p++ = (Byte)(state.cycles >> (8 * i));
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    for (int page = 0; page < 256; ++page) {
+        out.write(reinterpret_cast<const char*>(state.pages[page]->bytes), sizeof(MemoryPage));
+    }
+    return out.good();
+}
+
+bool readSnapshot(std::istream& in, Snapshot& state) {
+    Byte header[HEADER_SIZE];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    const Byte* p = header;
+    if (std::memcmp(p, MAGIC, 8) != 0) return false;
+    p += 8;
+    uint16_t version = p[0] | (p[1] << 8);
+    if (version != SNAPSHOT_VERSION) return false;
+    p += 2;
+    state.PC = p[0] | (p[1] << 8);
+    p += 2;
+    state.SP = *p++;
+    state.A = *p++;
+    state.X = *p++;
+    state.Y = *p++;
+    state.P = *p++;
+    state.cycles = 0;
+    for (int i = 0; i < 8; ++i) state.cycles |= (uint64_t)*p++ << (8 * i);
+    for (int page = 0; page < 256; ++page) {
+        std::shared_ptr<MemoryPage> bytes = std::make_shared<MemoryPage>();
+        if (!in.read(reinterpret_cast<char*>(bytes->bytes), sizeof(MemoryPage))) return false;
+        state.pages[page] = bytes;
+    }
+    return true;
+}
+
+RewindBuffer::RewindBuffer(size_t slots, unsigned interval)
+    : ring(slots), newest(slots - 1), count(0), interval(interval ? interval : 1), frame(0) {}
+
+void RewindBuffer::onFrame(cpu& c) {
+    if (++frame < interval) return;
+    frame = 0;
+    newest = (newest + 1) % ring.size();
+    c.saveState(ring[newest]); // overwrites, and releases, the oldest slot when full
+    if (count < ring.size()) ++count;
+}
+
+bool RewindBuffer::rewind(cpu& c) {
+    if (!count) return false;
+    c.loadState(ring[newest]);
+    ring[newest] = Snapshot();
+    newest = (newest + ring.size() - 1) % ring.size();
+    --count;
+    frame = 0;
+    return true;
+}
+
+size_t RewindBuffer::distinctPages() const {
+    std::set<const MemoryPage*> pages;
+    for (size_t i = 0; i < ring.size(); ++i) {
+        for (int page = 0; page < 256; ++page) {
+            if (ring[i].pages[page]) pages.insert(ring[i].pages[page].get());
+        }
+    }
+    return pages.size();
+}
@@ -0,0 +1,48 @@
+#include "telemetry.h"
+#include <chrono>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Telemetry::Telemetry(const std::string& name, Mode mode)
+    : name(name.empty() || name[0] == '/' ? name : "/" + name), mode(mode), counters(nullptr) {
+    const bool create = mode == Create;
+    int fd = shm_open(this->name.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+    if (fd < 0) return;
+    if (create && ftruncate(fd, sizeof(TelemetryCounters)) != 0) {
+        close(fd);
+        shm_unlink(this->name.c_str());
+        return;
+    }
+    void* memory = mmap(nullptr, sizeof(TelemetryCounters), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        if (create) shm_unlink(this->name.c_str());
+        return;
+    }
+    if (create) {
+        // The segment starts zeroed; the atomics only need constructing.
+        counters = new (memory) TelemetryCounters();
+        counters->version = TELEMETRY_VERSION;
+        counters->pid = (uint64_t)getpid();
+        std::atomic_thread_fence(std::memory_order_release);
+        counters->magic = TELEMETRY_MAGIC;
+        return;
+    }
+    counters = static_cast<TelemetryCounters*>(memory);
+    if (counters->magic != TELEMETRY_MAGIC || counters->version != TELEMETRY_VERSION) {
+        munmap(memory, sizeof(TelemetryCounters));
+        counters = nullptr;
+    }
+}
+
+Telemetry::~Telemetry() {
+    if (!counters) return;
+    munmap(counters, sizeof(TelemetryCounters));
+    if (mode == Create) shm_unlink(name.c_str());
+}
+
+uint64_t Telemetry::nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,230 @@
+#include "trace.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char FILE_MAGIC[8] = { '6', '5', '0', '2', 'T', 'R', 'C', '\0' };
+
+static Byte* put16(Byte* p, uint32_t v) { p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF; return p + 2; }
+static Byte* put32(Byte* p, uint32_t v) { p = put16(p, v & 0xFFFF); return put16(p, v >> 16); }
+static Byte* put64(Byte* p, uint64_t v) { p = put32(p, (uint32_t)v); return put32(p, (uint32_t)(v >> 32)); }
+static uint32_t get16(const Byte* p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const Byte* p) { return get16(p) | (get16(p + 2) << 16); }
+static uint64_t get64(const Byte* p) { return get32(p) | ((uint64_t)get32(p + 4) << 32); }
+
+Tracer::Tracer(const std::string& path, size_t bufferSize, size_t bufferCount)
+    : file(std::fopen(path.c_str(), "wb")), bufferSize(bufferSize), current(nullptr), used(0), records(0),
+      writeCount(0), nextPC(0), A(0), X(0), Y(0), SP(0), P(0), index(0), stopping(false) {
+    if (this->bufferSize < TRACE_CHUNK_HEADER + MAX_RECORD) this->bufferSize = TRACE_CHUNK_HEADER + MAX_RECORD;
+    if (bufferCount < 2) bufferCount = 2;
+    buffers.resize(bufferCount);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        buffers[i].resize(this->bufferSize);
+        free.push_back(&buffers[i]);
+    }
+    if (!file) return;
+    Byte header[TRACE_FILE_HEADER];
+    std::memcpy(header, FILE_MAGIC, 8);
+    put16(header + 8, TRACE_VERSION);
+    std::fwrite(header, 1, sizeof(header), file);
+    writer = std::thread(&Tracer::writerLoop, this);
+}
+
+Tracer::~Tracer() {
+    if (!file) return;
+    if (current) finishChunk();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+    std::fclose(file);
+}
+
+void Tracer::begin(const cpu& c, Word pc, Byte opcode, Byte lo, Byte hi) {
+    if (!current) startChunk(c);
+    this->pc = pc;
+    this->opcode = opcode;
+    this->lo = lo;
+    this->hi = hi;
+    writeCount = 0;
+}
+
+void Tracer::end(const cpu& c, Byte cycles) {
+    int length = cpu::instructionLength(opcode) - 1;
+
+    Byte* start = current->data() + used;
+    Byte* p = start + 1;
+    Byte flags = 0;
+    *p++ = opcode;
+    if (length > 0) *p++ = lo;
+    if (length > 1) *p++ = hi;
+    *p++ = cycles;
+    if (pc != nextPC) { flags |= TRACE_JUMP; p = put16(p, pc); }
+    if (c.A != A) { flags |= TRACE_A; *p++ = A = c.A; }
+    if (c.X != X) { flags |= TRACE_X; *p++ = X = c.X; }
+    if (c.Y != Y) { flags |= TRACE_Y; *p++ = Y = c.Y; }
+    if (c.SP != SP) { flags |= TRACE_SP; *p++ = SP = c.SP; }
+    if (c.P != P) { flags |= TRACE_P; *p++ = P = c.P; }
+    if (writeCount) {
+        flags |= TRACE_WRITES;
+        *p++ = (Byte)writeCount;
+        for (int i = 0; i < writeCount; ++i) {
+            p = put16(p, writes[i].address);
+            *p++ = writes[i].value;
+        }
+    }
+    *start = flags;
+    used = p - current->data();
+    nextPC = pc + 1 + length;
+    ++records;
+    ++index;
+    if (bufferSize - used < MAX_RECORD) finishChunk();
+}
+
+// Takes a free buffer, waiting for the writer if every buffer is queued, and
+// writes the keyframe header.
+void Tracer::startChunk(const cpu& c) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]() { return !free.empty(); });
+        current = free.back();
+        free.pop_back();
+    }
+    Byte* p = current->data();
+    p = put32(p, TRACE_CHUNK_MAGIC);
+    p = put32(p, 0); // payload size, patched by finishChunk()
+    p = put32(p, 0); // record count
+    p = put64(p, index);
+    p = put64(p, c.cycles);
+    p = put16(p, c.PC);
+    *p++ = A = c.A;
+    *p++ = X = c.X;
+    *p++ = Y = c.Y;
+    *p++ = SP = c.SP;
+    *p++ = P = c.P;
+    nextPC = c.PC;
+    used = TRACE_CHUNK_HEADER;
+    records = 0;
+}
+
+void Tracer::finishChunk() {
+    put32(current->data() + 4, (uint32_t)(used - TRACE_CHUNK_HEADER));
+    put32(current->data() + 8, records);
+    current->resize(used);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        full.push_back(current);
+    }
+    changed.notify_all();
+    current = nullptr;
+}
+
+void Tracer::writerLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        changed.wait(guard, [this]() { return stopping || !full.empty(); });
+        if (full.empty()) return; // stopping and drained
+        std::vector<Byte>* chunk = full.front();
+        full.pop_front();
+        guard.unlock();
+        std::fwrite(chunk->data(), 1, chunk->size(), file);
+        chunk->resize(bufferSize);
+        guard.lock();
+        free.push_back(chunk);
+        changed.notify_all();
+    }
+}
+
+TraceReader::TraceReader() : data(nullptr), size(0) {}
+
+TraceReader::~TraceReader() {
+    if (data) munmap(const_cast<Byte*>(data), size);
+}
+
+bool TraceReader::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)TRACE_FILE_HEADER) {
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+    data = static_cast<const Byte*>(map);
+    size = st.st_size;
+    if (std::memcmp(data, FILE_MAGIC, 8) != 0 || get16(data + 8) != TRACE_VERSION) return false;
+
+    // Hop from header to header; a truncated final chunk is ignored.
+    size_t offset = TRACE_FILE_HEADER;
+    while (offset + TRACE_CHUNK_HEADER <= size && get32(data + offset) == TRACE_CHUNK_MAGIC) {
+        size_t end = offset + TRACE_CHUNK_HEADER + get32(data + offset + 4);
+        if (end > size) break;
+        chunks.push_back(offset);
+        offset = end;
+    }
+    return true;
+}
+
+uint64_t TraceReader::instructionCount() const {
+    if (chunks.empty()) return 0;
+    const Byte* last = data + chunks.back();
+    return get64(last + 12) + get32(last + 8);
+}
+
+bool TraceReader::decode(size_t i, std::vector<TraceStep>& steps) const {
+    const Byte* h = data + chunks[i];
+    const Byte* p = h + TRACE_CHUNK_HEADER;
+    const Byte* end = p + get32(h + 4);
+    uint32_t count = get32(h + 8);
+
+    TraceStep s;
+    s.index = get64(h + 12);
+    s.cycle = get64(h + 20);
+    Word next = get16(h + 28);
+    s.A = h[30];
+    s.X = h[31];
+    s.Y = h[32];
+    s.SP = h[33];
+    s.P = h[34];
+
+    steps.clear();
+    steps.reserve(count);
+    for (uint32_t n = 0; n < count; ++n) {
+        if (end - p < 3) return false;
+        Byte flags = *p++;
+        s.opcode = *p++;
+        int length = cpu::instructionLength(s.opcode) - 1;
+        s.operand[0] = length > 0 ? *p++ : 0;
+        s.operand[1] = length > 1 ? *p++ : 0;
+        s.cycles = *p++;
+        s.pc = next;
+        if (flags & TRACE_JUMP) { s.pc = get16(p); p += 2; }
+        if (flags & TRACE_A) s.A = *p++;
+        if (flags & TRACE_X) s.X = *p++;
+        if (flags & TRACE_Y) s.Y = *p++;
+        if (flags & TRACE_SP) s.SP = *p++;
+        if (flags & TRACE_P) s.P = *p++;
+        s.writeCount = 0;
+        if (flags & TRACE_WRITES) {
+            s.writeCount = *p++;
+            if (s.writeCount > 8 || end - p < s.writeCount * 3) return false;
+            for (int w = 0; w < s.writeCount; ++w) {
+                s.writeAddress[w] = get16(p);
+                s.writeValue[w] = p[2];
+                p += 3;
+            }
+        }
+        if (p > end) return false;
+        steps.push_back(s);
+        next = s.pc + 1 + length;
+        s.cycle += s.cycles;
+        ++s.index;
+    }
+    return true;
+}
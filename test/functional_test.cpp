@@ -0,0 +1,592 @@
+// Conformance tests for the cpu core, run by `make test`:
+//
+//   functional_test [ROM[:LOAD[:START[:SUCCESS]]]]...
+//
+// 1. Every documented opcode is executed with execute() from thousands of
+//    random states and checked against a reference model written apart from
+//    cpu.cpp and opcodes.def: registers, flags, cycles with page-cross and
+//    branch penalties, and memory.
+// 2. Random programs run through run() with the plain interpreter, the block
+//    cache and the JIT must stop where stepping execute() stops, in the same
+//    state and (but for the JIT) after the same number of instructions.
+// 3. Random programs with a timer IRQ, periodic NMIs and a line the host
+//    holds, run through the interpreter, block cache, JIT and tracer, must
+//    match run(1) stepping: interrupts at the same instruction boundaries.
+// 4. Each functional test ROM on the command line (raw, Intel HEX or a
+//    segment image, see loader.h; hex addresses, defaults 0000, 0400 and
+//    3469 as for Klaus Dormann's 6502_functional_test.bin) runs until it
+//    traps in an instruction that jumps to itself; it passes if that is
+//    SUCCESS. Decimal mode is not emulated, so assemble such ROMs with
+//    their decimal tests disabled.
+// Exits with status 1 if anything fails.
+#include "cpu.h"
+#include "devices.h"
+#include "loader.h"
+#include "trace.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const int CASES_PER_OPCODE = 4000;
+const int PROGRAMS = 200;
+const int INTERRUPT_PROGRAMS = 100;
+const uint64_t ROM_CYCLE_LIMIT = 400000000;
+
+// Documented NMOS 6502 opcodes and their base cycles; zero marks the rest.
+const Byte CYCLES[256] = {
+    7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0,  2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0,  2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0,  2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0,  2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0,  2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0,
+    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0,  2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0,
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,  2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0,  2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0,
+};
+
+const Byte FC = 0x01, FZ = 0x02, FI = 0x04, FD = 0x08, FB = 0x10, FU = 0x20, FV = 0x40, FN = 0x80;
+
+// A plain 6502 decoded from the opcode's aaabbbcc bit fields, binary
+// arithmetic only. B and U in P are left alone except by PLP and RTI, which
+// clear B and set U, matching the cpu.
+struct Reference {
+    Byte mem[0x10000];
+    Word PC;
+    Byte SP, A, X, Y, P;
+    unsigned cycles;
+
+    Byte fetch() { return mem[PC++]; }
+    Word fetchWord() { Byte lo = fetch(); return lo | (fetch() << 8); }
+    Word read16zp(Byte zp) { return mem[zp] | (mem[(Byte)(zp + 1)] << 8); }
+    void push(Byte value) { mem[0x0100 + SP--] = value; }
+    Byte pull() { return mem[0x0100 + ++SP]; }
+    void flag(Byte f, bool on) { P = on ? (P | f) : (P & ~f); }
+    void nz(Byte value) { flag(FZ, value == 0); flag(FN, (value & 0x80) != 0); }
+
+    // The effective address of a group 1/2/3 operand; `read` adds the
+    // page-cross cycle of indexed reads.
+    Word address(int bbb, int cc, bool useY, bool read) {
+        Word base;
+        Byte index;
+        if (cc == 1) {
+            switch (bbb) {
+                case 0: return read16zp((Byte)(fetch() + X));
+                case 1: return fetch();
+                case 3: return fetchWord();
+                case 4: base = read16zp(fetch()); index = Y; break;
+                case 5: return (Byte)(fetch() + X);
+                case 6: base = fetchWord(); index = Y; break;
+                default: base = fetchWord(); index = X; break;
+            }
+        } else {
+            switch (bbb) {
+                case 1: return fetch();
+                case 3: return fetchWord();
+                case 5: return (Byte)(fetch() + (useY ? Y : X));
+                default: base = fetchWord(); index = useY ? Y : X; break;
+            }
+        }
+        if (read && ((base & 0xFF) + index) > 0xFF) ++cycles;
+        return (Word)(base + index);
+    }
+
+    void adc(Byte value) {
+        unsigned sum = A + value + (P & FC);
+        flag(FV, (~(A ^ value) & (A ^ sum) & 0x80) != 0);
+        flag(FC, sum > 0xFF);
+        A = (Byte)sum;
+        nz(A);
+    }
+
+    void compare(Byte reg, Byte value) {
+        flag(FC, reg >= value);
+        nz((Byte)(reg - value));
+    }
+
+    Byte shift(int aaa, Byte value) {
+        const Byte carry = P & FC;
+        switch (aaa) {
+            case 0: flag(FC, value & 0x80); value <<= 1; break;                        // ASL
+            case 1: flag(FC, value & 0x80); value = (Byte)(value << 1) | carry; break; // ROL
+            case 2: flag(FC, value & 1); value >>= 1; break;                           // LSR
+            default: flag(FC, value & 1); value = (value >> 1) | (carry << 7); break;  // ROR
+        }
+        nz(value);
+        return value;
+    }
+
+    void step() {
+        const Byte opcode = fetch();
+        cycles = CYCLES[opcode];
+        const int aaa = opcode >> 5, bbb = (opcode >> 2) & 7, cc = opcode & 3;
+
+        if ((opcode & 0x1F) == 0x10) { // branches: flag (aaa >> 1) compared with aaa & 1
+            static const Byte flags[4] = { FN, FV, FC, FZ };
+            const Word target = (Word)(PC + 1 + (int8_t)mem[PC]);
+            ++PC;
+            if (((P & flags[aaa >> 1]) != 0) == (aaa & 1)) {
+                cycles += ((target ^ PC) & 0xFF00) ? 2 : 1;
+                PC = target;
+            }
+            return;
+        }
+        switch (opcode) {
+            case 0x00: { Word ret = PC + 1; push(ret >> 8); push(ret & 0xFF); push(P | FB | FU); P |= FI;
+                         PC = mem[0xFFFE] | (mem[0xFFFF] << 8); return; }
+            case 0x20: { Word target = fetchWord(); Word ret = PC - 1; push(ret >> 8); push(ret & 0xFF); PC = target; return; }
+            case 0x40: { P = (pull() & ~FB) | FU; Byte lo = pull(); PC = lo | (pull() << 8); return; }
+            case 0x60: { Byte lo = pull(); PC = (Word)((lo | (pull() << 8)) + 1); return; }
+            case 0x4C: PC = fetchWord(); return;
+            case 0x6C: { Word ptr = fetchWord(); PC = mem[ptr] | (mem[(ptr & 0xFF00) | (Byte)(ptr + 1)] << 8); return; }
+            case 0x08: push(P | FB | FU); return;
+            case 0x28: P = (pull() & ~FB) | FU; return;
+            case 0x48: push(A); return;
+            case 0x68: A = pull(); nz(A); return;
+            case 0x88: nz(--Y); return;
+            case 0xA8: Y = A; nz(Y); return;
+            case 0xC8: nz(++Y); return;
+            case 0xE8: nz(++X); return;
+            case 0x18: flag(FC, false); return;
+            case 0x38: flag(FC, true); return;
+            case 0x58: flag(FI, false); return;
+            case 0x78: flag(FI, true); return;
+            case 0x98: A = Y; nz(A); return;
+            case 0xB8: flag(FV, false); return;
+            case 0xD8: flag(FD, false); return;
+            case 0xF8: flag(FD, true); return;
+            case 0x8A: A = X; nz(A); return;
+            case 0x9A: SP = X; return;
+            case 0xAA: X = A; nz(X); return;
+            case 0xBA: X = SP; nz(X); return;
+            case 0xCA: nz(--X); return;
+            case 0xEA: return;
+        }
+
+        if (cc == 1) {
+            const Byte value = bbb == 2 ? fetch() : 0;
+            const Word ea = bbb == 2 ? 0 : address(bbb, cc, false, aaa != 4);
+            const Byte operand = bbb == 2 ? value : aaa == 4 ? 0 : mem[ea];
+            switch (aaa) {
+                case 0: A |= operand; nz(A); break;
+                case 1: A &= operand; nz(A); break;
+                case 2: A ^= operand; nz(A); break;
+                case 3: adc(operand); break;
+                case 4: mem[ea] = A; break;
+                case 5: A = operand; nz(A); break;
+                case 6: compare(A, operand); break;
+                default: adc(~operand); break;
+            }
+        } else if (cc == 2) {
+            const bool useY = aaa == 4 || aaa == 5; // STX, LDX
+            if (bbb == 2) { A = shift(aaa, A); return; }
+            if (bbb == 0) { X = fetch(); nz(X); return; } // LDX #
+            const Word ea = address(bbb, cc, useY, aaa == 5);
+            switch (aaa) {
+                case 4: mem[ea] = X; break;
+                case 5: X = mem[ea]; nz(X); break;
+                case 6: nz(--mem[ea]); break;
+                case 7: nz(++mem[ea]); break;
+                default: mem[ea] = shift(aaa, mem[ea]); break;
+            }
+        } else {
+            const Byte operand = bbb == 0 ? fetch() : 0;
+            const Word ea = bbb == 0 ? 0 : address(bbb, cc, false, aaa == 5);
+            switch (aaa) {
+                case 1: { Byte m = mem[ea]; flag(FZ, (A & m) == 0); flag(FN, m & 0x80); flag(FV, m & 0x40); break; }
+                case 4: mem[ea] = Y; break;
+                case 5: Y = bbb == 0 ? operand : mem[ea]; nz(Y); break;
+                case 6: compare(Y, bbb == 0 ? operand : mem[ea]); break;
+                default: compare(X, bbb == 0 ? operand : mem[ea]); break;
+            }
+        }
+    }
+};
+
+int failures = 0;
+
+void fail(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void fail(const char* format, ...) {
+    if (++failures > 20) return;
+    va_list args;
+    va_start(args, format);
+    std::printf("  FAIL ");
+    std::vprintf(format, args);
+    std::printf("\n");
+    va_end(args);
+}
+
+std::string describe(const cpu& c) {
+    char text[64];
+    std::snprintf(text, sizeof(text), "PC=%04X SP=%02X A=%02X X=%02X Y=%02X P=%02X", c.PC, c.SP, c.A, c.X, c.Y, c.P);
+    return text;
+}
+
+std::string describe(const Reference& r) {
+    char text[64];
+    std::snprintf(text, sizeof(text), "PC=%04X SP=%02X A=%02X X=%02X Y=%02X P=%02X", r.PC, r.SP, r.A, r.X, r.Y, r.P);
+    return text;
+}
+
+void checkOpcodes() {
+    std::mt19937 rng(6502);
+    std::unique_ptr<Reference> ref(new Reference());
+    int tested = 0;
+    for (int opcode = 0; opcode < 256; ++opcode) {
+        const bool documented = CYCLES[opcode] != 0;
+        if (documented != (std::strcmp(cpu::mnemonic((Byte)opcode), "UNK") != 0)) {
+            fail("%02X: %s in the cpu's table", opcode, documented ? "missing" : "unexpected");
+            continue;
+        }
+        if (!documented) continue;
+        if (cpu::baseCycles((Byte)opcode) != CYCLES[opcode]) {
+            fail("%02X %s: %d base cycles, expected %d", opcode, cpu::mnemonic((Byte)opcode),
+                 cpu::baseCycles((Byte)opcode), CYCLES[opcode]);
+        }
+        ++tested;
+
+        cpu c;
+        for (int a = 0; a < 0x10000; ++a) {
+            ref->mem[a] = (Byte)rng();
+            c.poke((Word)a, ref->mem[a]);
+        }
+        const bool arithmetic = (opcode & 0x63) == 0x61; // ADC, SBC: binary only
+        bool ok = true;
+        for (int i = 0; i < CASES_PER_OPCODE && ok; ++i) {
+            // Small index registers and operands near page ends reach the
+            // wrap-around and page-cross cases often.
+            const Word pc = (Word)((rng() & 1) ? rng() : (rng() & 0xFF00) | (0xFD + rng() % 3));
+            Byte bytes[3] = { (Byte)opcode, (Byte)rng(), (Byte)rng() };
+            if (rng() % 4 == 0) bytes[1] = (Byte)(0xF0 + rng() % 16);
+            for (int k = 0; k < 3; ++k) {
+                ref->mem[(Word)(pc + k)] = bytes[k];
+                c.poke((Word)(pc + k), bytes[k]);
+            }
+            ref->PC = c.PC = pc;
+            ref->SP = c.SP = (Byte)rng();
+            ref->A = c.A = (Byte)rng();
+            ref->X = c.X = (rng() & 1) ? (Byte)rng() : (Byte)(rng() % 4);
+            ref->Y = c.Y = (rng() & 1) ? (Byte)rng() : (Byte)(rng() % 4);
+            ref->P = c.P = (Byte)((rng() | FU) & ~(arithmetic ? FD : 0));
+
+            const uint64_t before = c.cycles;
+            c.execute();
+            ref->step();
+            const unsigned spent = (unsigned)(c.cycles - before);
+            if (c.PC != ref->PC || c.SP != ref->SP || c.A != ref->A || c.X != ref->X || c.Y != ref->Y || c.P != ref->P ||
+                spent != ref->cycles) {
+                fail("%02X %s at $%04X: got %s, %u cycles; expected %s, %u cycles",
+                     opcode, cpu::disassemble(pc, bytes[0], bytes[1], bytes[2]).c_str(), pc, describe(c).c_str(),
+                     spent, describe(*ref).c_str(), ref->cycles);
+                ok = false;
+            }
+        }
+        for (int a = 0; a < 0x10000 && ok; ++a) {
+            if (c.peek((Word)a) != ref->mem[a]) {
+                fail("%02X %s: memory at $%04X is %02X, expected %02X", opcode, cpu::mnemonic((Byte)opcode), a,
+                     c.peek((Word)a), ref->mem[a]);
+                ok = false;
+            }
+        }
+    }
+    std::printf("opcodes: %d documented opcodes, %d cases each, against the reference model\n", tested, CASES_PER_OPCODE);
+}
+
+// A random program at $0600 of documented opcodes with operands kept in
+// RAM below the code and every branch, JMP and JSR landing on an
+// instruction. BRK and the IRQ vector lead back to the start, so the program
+// keeps running whatever it does.
+std::vector<Byte> randomProgram(std::mt19937& rng) {
+    std::vector<Byte> opcodes;
+    for (int op = 0; op < 256; ++op) {
+        if (!CYCLES[op] || op == 0x6C || op == 0x40 || op == 0x60) continue; // no jumps through data
+        if (op == 0x81 || op == 0x91) continue; // nor stores through random pointers into the code
+        opcodes.push_back((Byte)op);
+    }
+    std::vector<Byte> ops;
+    std::vector<Word> starts;
+    Word pc = 0x0600;
+    while (pc < 0x0600 + 480) {
+        ops.push_back(opcodes[rng() % opcodes.size()]);
+        starts.push_back(pc);
+        pc += cpu::instructionLength(ops.back());
+    }
+    ops.push_back(0x4C); // JMP $0600
+    starts.push_back(pc);
+
+    std::vector<Byte> code;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const Byte op = ops[i];
+        code.push_back(op);
+        if (i + 1 == ops.size()) {
+            code.push_back(0x00);
+            code.push_back(0x06);
+        } else if (op == 0x20 || op == 0x4C) {
+            const Word target = starts[rng() % starts.size()];
+            code.push_back(target & 0xFF);
+            code.push_back(target >> 8);
+        } else if (cpu::addressingMode(op) == cpu::Relative) {
+            const int next = starts[i] + 2;
+            int offset = (int)starts[rng() % starts.size()] - next;
+            if (offset < -128 || offset > 127) offset = 0;
+            code.push_back((Byte)offset);
+        } else if (cpu::instructionLength(op) == 2) {
+            code.push_back((Byte)rng());
+        } else if (cpu::instructionLength(op) == 3) {
+            code.push_back((Byte)rng());
+            code.push_back((Byte)(0x02 + rng() % 3)); // $0200-$04FF, indexed up to $05FE
+        }
+    }
+    return code;
+}
+
+enum Engine { Interpreter, Blocks, Compiled, Traced, ENGINES };
+const char* const ENGINE_NAMES[ENGINES] = { "interpreter", "block cache", "JIT", "tracer" };
+
+void checkEngines() {
+    std::mt19937 rng(1977);
+    const bool jit = cpu::jitSupported();
+    uint64_t slices = 0;
+    for (int p = 0; p < PROGRAMS; ++p) {
+        const std::vector<Byte> program = randomProgram(rng);
+        cpu reference;
+        cpu engines[3];
+        cpu* all[4] = { &reference, &engines[0], &engines[1], &engines[2] };
+        for (int m = 0; m < 4; ++m) {
+            all[m]->loadAt0600AndSetReset(program);
+            all[m]->poke(0xFFFE, 0x00);
+            all[m]->poke(0xFFFF, 0x06);
+            all[m]->reset();
+        }
+        engines[Interpreter].setBlockCacheEnabled(false);
+        engines[Compiled].setJitEnabled(true);
+        const int count = jit ? 3 : 2;
+
+        uint64_t steps = 0;
+        for (int s = 0; s < 300; ++s, ++slices) {
+            const uint64_t budget = 1 + rng() % 2000;
+            const uint64_t target = reference.cycles + budget;
+            while (reference.cycles < target) {
+                reference.execute();
+                ++steps;
+            }
+            for (int e = 0; e < count; ++e) {
+                cpu& c = engines[e];
+                c.run(budget);
+                // Translated blocks that exit early still count whole.
+                if (c.PC != reference.PC || c.SP != reference.SP || c.A != reference.A || c.X != reference.X ||
+                    c.Y != reference.Y || c.P != reference.P || c.cycles != reference.cycles ||
+                    (e != Compiled && c.instructions != steps)) {
+                    fail("program %d slice %d, %s: %s at cycle %llu after %llu instructions; execute(): %s at cycle %llu "
+                         "after %llu", p, s, ENGINE_NAMES[e], describe(c).c_str(), (unsigned long long)c.cycles,
+                         (unsigned long long)c.instructions, describe(reference).c_str(),
+                         (unsigned long long)reference.cycles, (unsigned long long)steps);
+                    return;
+                }
+            }
+        }
+        for (int e = 0; e < count; ++e) {
+            for (int a = 0; a < 0x10000; ++a) {
+                if (engines[e].peek((Word)a) != reference.peek((Word)a)) {
+                    fail("program %d: engine %d memory at $%04X differs", p, e, a);
+                    return;
+                }
+            }
+        }
+    }
+    std::printf("engines: %d random programs, %llu slices, interpreter, block cache%s against execute()\n", PROGRAMS,
+                (unsigned long long)slices, jit ? " and JIT" : "");
+}
+
+// IRQ and BRK enter here: BRK restarts the program, an IRQ counts itself at
+// $0840 and reads the timer at $FD to acknowledge it, on every entry or,
+// with mask 1, only every other one so the held line re-enters at RTI. A is
+// kept at $0842, out of reach of the programs' stores.
+const Word IRQ_HANDLER = 0x0800;
+const Word NMI_HANDLER = 0x0820;    // counts at $0841
+const Byte ACK_MASK_OPERAND = 0x10; // offset of AND #mask in irqHandler
+const std::vector<Byte> irqHandler = {
+    0x8D, 0x42, 0x08,       // STA $0842
+    0x68, 0x48,             // PLA, PHA: the pushed P
+    0x29, 0x10, 0xD0, 0x10, // AND #B, BNE brk
+    0xEE, 0x40, 0x08,       // INC $0840
+    0xAD, 0x40, 0x08,       // LDA $0840
+    0x29, 0x00, 0xD0, 0x02, // AND #mask, BNE +2
+    0xA5, 0xFD,             // LDA $FD
+    0xAD, 0x42, 0x08,       // LDA $0842
+    0x40,                   // RTI
+    0x4C, 0x00, 0x06        // brk: JMP $0600
+};
+const std::vector<Byte> nmiHandler = { 0xEE, 0x41, 0x08, 0x40 }; // INC $0841, RTI
+
+// A machine with a timer on IRQ line 0, periodic NMIs, line 1 held by the
+// host for a while every holdPeriod cycles, and a decoy NMI scheduled at
+// each NMI and cancelled by the next hold if it has not fired yet.
+struct InterruptMachine {
+    cpu c;
+    TimerDevice timer;
+    uint64_t nmiPeriod, holdPeriod, holdLength;
+    uint64_t decoy;
+
+    InterruptMachine(const std::vector<Byte>& program, uint32_t timerPeriod, Byte ackMask, uint64_t nmiPeriod,
+                     uint64_t holdPeriod, uint64_t holdLength)
+        : timer(c, timerPeriod), nmiPeriod(nmiPeriod), holdPeriod(holdPeriod), holdLength(holdLength), decoy(0) {
+        c.loadAt0600AndSetReset(program);
+        for (size_t i = 0; i < irqHandler.size(); ++i) c.poke((Word)(IRQ_HANDLER + i), irqHandler[i]);
+        for (size_t i = 0; i < nmiHandler.size(); ++i) c.poke((Word)(NMI_HANDLER + i), nmiHandler[i]);
+        c.poke(IRQ_HANDLER + ACK_MASK_OPERAND, ackMask);
+        c.poke(0xFFFA, NMI_HANDLER & 0xFF);
+        c.poke(0xFFFB, NMI_HANDLER >> 8);
+        c.poke(0xFFFE, IRQ_HANDLER & 0xFF);
+        c.poke(0xFFFF, IRQ_HANDLER >> 8);
+        c.reset();
+        c.setFlag(I, false);
+        c.attachDevice(timer.device());
+        timer.start();
+        if (nmiPeriod) c.schedule(nmiPeriod, [this]() { nmiTick(this->nmiPeriod); });
+        if (holdPeriod) c.schedule(holdPeriod, [this]() { hold(this->holdPeriod); });
+    }
+
+    void nmiTick(uint64_t due) {
+        c.nmi();
+        decoy = c.schedule(due + nmiPeriod / 2, [this]() { c.nmi(); });
+        const uint64_t next = due + nmiPeriod;
+        c.schedule(next, [this, next]() { nmiTick(next); });
+    }
+
+    void hold(uint64_t due) {
+        if (decoy) c.cancelEvent(decoy);
+        decoy = 0;
+        c.setIrq(1, true);
+        c.schedule(due + holdLength, [this]() { c.setIrq(1, false); });
+        const uint64_t next = due + holdPeriod;
+        c.schedule(next, [this, next]() { hold(next); });
+    }
+};
+
+// Random programs with a timer IRQ, NMIs and a held line, run through each
+// engine in slices must match run(1) stepped in the interpreter: interrupts
+// taken at the same instruction boundary, and CLI, PLP and RTI ending the
+// slice when they unmask a pending IRQ.
+void checkInterrupts() {
+    std::mt19937 rng(1983);
+    const bool jit = cpu::jitSupported();
+    const std::string tracePath = "/tmp/functional_test." + std::to_string(getpid()) + ".trc";
+    uint64_t slices = 0, irqs = 0, nmis = 0;
+    for (int p = 0; p < INTERRUPT_PROGRAMS; ++p) {
+        const std::vector<Byte> program = randomProgram(rng);
+        const uint32_t timerPeriod = 20 + rng() % 400;
+        const Byte ackMask = rng() & 1;
+        const uint64_t nmiPeriod = rng() % 3 ? 100 + rng() % 3000 : 0;
+        const uint64_t holdPeriod = rng() % 2 ? 500 + rng() % 5000 : 0;
+        const uint64_t holdLength = 20 + rng() % 300;
+        Tracer tracer(tracePath); // outlives the machine it traces
+        std::unique_ptr<InterruptMachine> machines[ENGINES + 1];
+        for (int m = 0; m <= ENGINES; ++m) {
+            machines[m].reset(new InterruptMachine(program, timerPeriod, ackMask, nmiPeriod, holdPeriod, holdLength));
+        }
+        cpu& reference = machines[ENGINES]->c;
+        reference.setBlockCacheEnabled(false);
+        machines[Interpreter]->c.setBlockCacheEnabled(false);
+        machines[Compiled]->c.setJitEnabled(true);
+        machines[Traced]->c.setTracer(&tracer);
+
+        for (int s = 0; s < 100; ++s, ++slices) {
+            const uint64_t target = reference.cycles + 1 + rng() % 5000;
+            while (reference.cycles < target) reference.run(1);
+            for (int e = 0; e < ENGINES; ++e) {
+                if (e == Compiled && !jit) continue;
+                cpu& c = machines[e]->c;
+                c.run(target - c.cycles);
+                if (c.PC != reference.PC || c.SP != reference.SP || c.A != reference.A || c.X != reference.X ||
+                    c.Y != reference.Y || c.P != reference.P || c.cycles != reference.cycles) {
+                    fail("interrupts, program %d slice %d, %s: %s at cycle %llu; run(1): %s at cycle %llu", p, s,
+                         ENGINE_NAMES[e], describe(c).c_str(), (unsigned long long)c.cycles,
+                         describe(reference).c_str(), (unsigned long long)reference.cycles);
+                    return;
+                }
+            }
+        }
+        for (int e = 0; e < ENGINES; ++e) {
+            if (e == Compiled && !jit) continue;
+            for (int a = 0; a < 0x10000; ++a) {
+                if (machines[e]->c.peek((Word)a) != reference.peek((Word)a)) {
+                    fail("interrupts, program %d: %s memory at $%04X differs", p, ENGINE_NAMES[e], a);
+                    return;
+                }
+            }
+        }
+        irqs += reference.peek(0x0840);
+        nmis += reference.peek(0x0841);
+    }
+    std::remove(tracePath.c_str());
+    if (!irqs || !nmis) fail("interrupts: no IRQ (%llu) or NMI (%llu) was taken", (unsigned long long)irqs,
+                             (unsigned long long)nmis);
+    std::printf("interrupts: %d random programs, %llu slices with timer IRQ, NMIs and a held line, interpreter, block "
+                "cache%s and tracer against run(1)\n", INTERRUPT_PROGRAMS, (unsigned long long)slices,
+                jit ? ", JIT" : "");
+}
+
+// ROM[:LOAD[:START[:SUCCESS]]], hex addresses.
+void runRom(const std::string& spec) {
+    std::string fields[4] = { "", "0000", "0400", "3469" };
+    size_t start = 0;
+    for (int f = 0; f < 4 && start <= spec.size(); ++f) {
+        const size_t colon = spec.find(':', start);
+        fields[f] = spec.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+        if (colon == std::string::npos) break;
+        start = colon + 1;
+    }
+    const Word load = (Word)std::strtoul(fields[1].c_str(), nullptr, 16);
+    const Word entry = (Word)std::strtoul(fields[2].c_str(), nullptr, 16);
+    const Word success = (Word)std::strtoul(fields[3].c_str(), nullptr, 16);
+
+    RomOptions options;
+    options.loadAddress = load;
+    std::string error;
+    std::shared_ptr<const RomImage> image = openRom(fields[0], options, error);
+    if (!image) {
+        fail("%s", error.c_str());
+        return;
+    }
+    cpu c;
+    c.loadImage(*image);
+    c.reset();
+    c.PC = entry;
+    while (c.cycles < ROM_CYCLE_LIMIT) {
+        c.run(100000);
+        const Word pc = c.PC;
+        c.execute();
+        if (c.PC == pc) break;
+    }
+    if (c.PC == success) {
+        std::printf("rom: %s passed, %llu cycles\n", fields[0].c_str(), (unsigned long long)c.cycles);
+    } else if (c.cycles >= ROM_CYCLE_LIMIT) {
+        fail("%s: no trap within %llu cycles, %s", fields[0].c_str(), (unsigned long long)ROM_CYCLE_LIMIT,
+             describe(c).c_str());
+    } else {
+        fail("%s: trapped at $%04X (success is $%04X), %s", fields[0].c_str(), c.PC, success, describe(c).c_str());
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    checkOpcodes();
+    checkEngines();
+    checkInterrupts();
+    for (int i = 1; i < argc; ++i) runRom(argv[i]);
+    if (failures) {
+        std::printf("%d failure%s\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+    std::printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Headless capture test, run by `make test`: with the encoder stuck on a
+// full pipe and every slot queued, a frame that changes the screen must not
+// be lost; the last image in the stream is the final screen. A stream the
+// disk can't take fails finish(). Exits with status 1 if anything fails.
+#include "headless.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const int SCALE = 1;
+const uint64_t CYCLES_PER_FRAME = 1000;
+const uint64_t FIRST = 2000; // frames the first capture is repeated for: more than a write block
+const int CAPTURES = 48;     // more than the encoder has slots
+
+} // namespace
+
+int main() {
+    const std::string path = "/tmp/headless_test." + std::to_string(getpid()) + ".rgb";
+    if (mkfifo(path.c_str(), 0600) != 0) {
+        std::perror(path.c_str());
+        return 1;
+    }
+    // Open the reading end first so the frontend's open does not block,
+    // then leave it unread: the encoder stalls once the pipe is full.
+    const int reader = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    HeadlessFrontend fe(path, SCALE, CYCLES_PER_FRAME, 60);
+    if (reader < 0 || !fe.init()) {
+        std::perror(path.c_str());
+        unlink(path.c_str());
+        return 1;
+    }
+    fcntl(reader, F_SETFL, 0);
+
+    Frame frame;
+    std::memset(&frame, 0, sizeof(frame));
+    frame.dirtyRows = 1;
+    for (int i = 0; i < CAPTURES; ++i) {
+        std::memset(frame.pixels, 1 + i % 15, sizeof(frame.pixels));
+        frame.pixels[i] = 0; // every capture differs
+        frame.cycles = (FIRST + i) * CYCLES_PER_FRAME;
+        fe.draw_if_changed(frame);
+    }
+
+    std::vector<Byte> stream;
+    std::thread drain([&]() {
+        Byte buffer[1 << 16];
+        ssize_t n;
+        while ((n = read(reader, buffer, sizeof(buffer))) > 0) stream.insert(stream.end(), buffer, buffer + n);
+    });
+    fe.finish(frame.cycles);
+    drain.join();
+    close(reader);
+    unlink(path.c_str());
+
+    const size_t frameSize = (size_t)ScreenDevice::W * ScreenDevice::H * 3 * SCALE * SCALE;
+    const size_t frames = FIRST + CAPTURES;
+    int failures = 0;
+    if (!fe.droppedFrames()) {
+        std::printf("FAIL: no frame was dropped, the encoder never stalled\n");
+        ++failures;
+    }
+    if (stream.size() != frames * frameSize) {
+        std::printf("FAIL: %zu bytes, expected %zu frames of %zu\n", stream.size(), frames, frameSize);
+        ++failures;
+    } else {
+        const Byte* last = stream.data() + stream.size() - frameSize;
+        for (int p = 0; p < ScreenDevice::W * ScreenDevice::H; ++p) {
+            Byte rgb[3];
+            ScreenDevice::color(frame.pixels[p], rgb);
+            if (std::memcmp(last + p * 3, rgb, 3) != 0) {
+                std::printf("FAIL: pixel %d of the last frame is not the final screen\n", p);
+                ++failures;
+                break;
+            }
+        }
+    }
+
+    // Every write to /dev/full fails with ENOSPC.
+    HeadlessFrontend full("/dev/full", SCALE, CYCLES_PER_FRAME, 60);
+    if (full.init()) {
+        full.draw_if_changed(frame);
+        if (full.finish(frame.cycles)) {
+            std::printf("FAIL: finish() succeeded on /dev/full\n");
+            ++failures;
+        }
+    }
+    if (failures) return 1;
+    std::printf("headless: all passed, %llu frames dropped\n", (unsigned long long)fe.droppedFrames());
+    return 0;
+}
@@ -0,0 +1,220 @@
+// ROM loader tests, run by `make test`: placement and vectors for raw, Intel
+// HEX and segment images, malformed files, page sharing and mapping, ROM
+// segments and their page alignment, and the parsed image cache. Exits with
+// status 1 if anything fails.
+#include "cpu.h"
+#include "loader.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void fail(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void fail(const char* format, ...) {
+    ++failures;
+    std::printf("FAIL: ");
+    va_list args;
+    va_start(args, format);
+    std::vprintf(format, args);
+    va_end(args);
+    std::printf("\n");
+}
+
+#define CHECK(condition) \
+    do { if (!(condition)) fail("%s:%d: %s", __FILE__, __LINE__, #condition); } while (0)
+
+const std::string base = "/tmp/loader_test." + std::to_string(getpid());
+
+std::string write(const std::string& suffix, const std::string& contents) {
+    const std::string path = base + suffix;
+    std::ofstream(path, std::ios::binary) << contents;
+    return path;
+}
+
+std::shared_ptr<const RomImage> load(const std::string& path, RomOptions options = RomOptions()) {
+    std::string error;
+    std::shared_ptr<const RomImage> image = openRom(path, options, error);
+    if (!image) fail("%s", error.c_str());
+    return image;
+}
+
+std::shared_ptr<const RomImage> parse(const std::string& text, std::string& error) {
+    return parseRom(reinterpret_cast<const Byte*>(text.data()), text.size(), RomOptions(), error);
+}
+
+Word resetVector(const cpu& c) { return c.peek(0xFFFC) | (c.peek(0xFFFD) << 8); }
+
+void raw() {
+    // Small images go to $0600 and start there, like the built-in program.
+    std::shared_ptr<const RomImage> image = load(write(".bin", std::string("\xA9\x01\x00", 3)));
+    if (!image) return;
+    CHECK(image->format == RomRaw);
+    cpu c;
+    c.loadImage(*image);
+    CHECK(c.peek(0x0600) == 0xA9 && c.peek(0x0601) == 0x01);
+    CHECK(resetVector(c) == 0x0600);
+    CHECK(c.privatePages() == 0);
+
+    // A 64 KiB image fills memory from $0000, vectors included, and every
+    // page is a view of the file.
+    std::string memory(0x10000, '\0');
+    for (size_t a = 0; a < memory.size(); ++a) memory[a] = (char)(a ^ (a >> 8));
+    memory[0xFFFC] = 0x34;
+    memory[0xFFFD] = 0x12;
+    image = load(write(".bin", memory));
+    if (!image) return;
+    CHECK(image->mappedPages == 256);
+    cpu full;
+    full.loadImage(*image);
+    full.reset();
+    CHECK(full.PC == 0x1234);
+    CHECK(full.peek(0x8001) == (Byte)(0x8001 ^ 0x80));
+
+    // An explicit load address; the pages it only partly covers are copied.
+    RomOptions options;
+    options.loadAddress = 0xC010;
+    image = load(write(".bin", std::string(0x200, '\x42')), options);
+    if (!image) return;
+    CHECK(image->mappedPages == 1);
+    cpu at;
+    at.loadImage(*image);
+    CHECK(at.peek(0xC00F) == 0 && at.peek(0xC010) == 0x42 && at.peek(0xC20F) == 0x42 && at.peek(0xC210) == 0);
+    CHECK(resetVector(at) == 0xC010);
+
+    std::string error;
+    options.loadAddress = 0xFF00;
+    CHECK(!openRom(write(".bin", std::string(0x101, '\0')), options, error));
+}
+
+void hex() {
+    // Two records at $0300 and $0310, a gap, and a start address record.
+    std::string error;
+    std::shared_ptr<const RomImage> image = parse(":10030000000102030405060708090A0B0C0D0E0F75\r\n"
+                                                  ":0403100010111213A3\n"
+                                                  ":0400000500000310E4\n"
+                                                  ":00000001FF\n", error);
+    if (!image) {
+        fail("hex: %s", error.c_str());
+        return;
+    }
+    CHECK(image->format == RomIntelHex);
+    CHECK(image->segments.size() == 2 && image->segments[0].address == 0x0300 && image->segments[0].length == 0x14);
+    cpu c;
+    c.loadImage(*image);
+    CHECK(c.peek(0x030F) == 0x0F && c.peek(0x0313) == 0x13 && c.peek(0x0314) == 0);
+    CHECK(resetVector(c) == 0x0310);
+
+    CHECK(!parse(":0403100010111213A4\n:00000001FF\n", error) && error.find("checksum") != std::string::npos);
+    CHECK(!parse(":0403100010111213A3\n", error) && error.find("end-of-file") != std::string::npos);
+    CHECK(!parse(":020000040001F9\n:01000000EA15\n:00000001FF\n", error)); // data at $10000
+    CHECK(!parse(":04031000101112\n:00000001FF\n", error) && error.find("line 1") != std::string::npos);
+}
+
+void segments() {
+    // Two segments, one of them ROM, written out and read back through the
+    // cache with header vectors.
+    std::string error;
+    std::shared_ptr<const RomImage> hexImage = parse(":0406000001020304EC\n"
+                                                     ":20E00000000000000000000000000000000000000000000000000000000000000000000000\n"
+                                                     ":00000001FF\n", error);
+    if (!hexImage) {
+        fail("segments: %s", error.c_str());
+        return;
+    }
+    RomImage rom = *hexImage;
+    rom.segments[1].rom = true;
+    rom.segments[1].length = 0x100; // ROM is mapped by the page
+    std::ostringstream out;
+    CHECK(writeSegments(out, rom, 0x0600, 0xE000, 0xE010));
+    std::shared_ptr<const RomImage> image = load(write(".seg", out.str()));
+    if (!image) return;
+    CHECK(image->format == RomSegments);
+    cpu c;
+    c.loadImage(*image);
+    c.reset();
+    CHECK(c.PC == 0x0600 && c.peek(0x0603) == 0x04);
+    CHECK((c.peek(0xFFFE) | c.peek(0xFFFF) << 8) == 0xE000 && (c.peek(0xFFFA) | c.peek(0xFFFB) << 8) == 0xE010);
+    c.write(0xE000, 0x55); // ROM
+    c.write(0x0600, 0x55);
+    CHECK(c.peek(0xE000) == 0 && c.peek(0x0600) == 0x55);
+
+    CHECK(!parse(std::string("6502SEGS\x02\x00", 10) + std::string(8, '\0'), error));
+
+    // A ROM segment that ends partway through a page is not written, a file
+    // with one is rejected, and loading one by hand leaves its page RAM.
+    RomImage partial = *hexImage;
+    partial.segments[1].rom = true;
+    std::ostringstream refused;
+    CHECK(!writeSegments(refused, partial) && refused.str().empty());
+    std::ostringstream written;
+    CHECK(writeSegments(written, *hexImage));
+    std::string file = written.str();
+    file[8 + 2 + 2 * 3 + 2 + 12 + 2] = 1; // second entry's flags: ROM
+    CHECK(!parse(file, error) && error.find("page boundary") != std::string::npos);
+    cpu ram;
+    ram.loadImage(partial);
+    ram.write(0xE000, 0x55);
+    ram.write(0xE020, 0x66);
+    CHECK(ram.peek(0xE000) == 0x55 && ram.peek(0xE020) == 0x66);
+}
+
+void sharing() {
+    const std::string path = write(".bin", std::string(0x300, '\x11'));
+    std::shared_ptr<const RomImage> image = load(path);
+    if (!image) return;
+
+    // Fresh machines share the image; one that has written a page gets
+    // only the image's bytes copied in.
+    cpu a, b;
+    a.loadImage(*image);
+    b.poke(0xFF00, 0x77);
+    b.loadImage(*image);
+    CHECK(a.privatePages() == 0);
+    CHECK(b.peek(0xFF00) == 0x77 && resetVector(b) == 0x0600 && b.peek(0x0600) == 0x11 && b.peek(0x08FF) == 0x11);
+    a.poke(0x0600, 0x22);
+    cpu fresh;
+    fresh.loadImage(*image);
+    CHECK(fresh.peek(0x0600) == 0x11);
+
+    // Cached while the file is unchanged; a new file renamed over it is
+    // parsed again.
+    const size_t entries = romCacheSize();
+    CHECK(load(path) == image);
+    CHECK(romCacheSize() == entries);
+    const std::string replacement = write(".new", std::string(0x300, '\x33'));
+    std::rename(replacement.c_str(), path.c_str());
+    std::shared_ptr<const RomImage> reloaded = load(path);
+    CHECK(reloaded && reloaded != image && reloaded->pages[0x06]->bytes[0] == 0x33);
+    CHECK(image->pages[0x06]->bytes[0] == 0x11); // still mapped from the old file
+    clearRomCache();
+    CHECK(romCacheSize() == 0);
+
+    std::string error;
+    CHECK(!openRom(base + ".missing", RomOptions(), error) && !error.empty());
+}
+
+} // namespace
+
+int main() {
+    raw();
+    hex();
+    segments();
+    sharing();
+    const char* const suffixes[] = { ".bin", ".seg", ".new" };
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) std::remove((base + suffixes[i]).c_str());
+    if (failures) {
+        std::printf("%d failure%s\n", failures, failures == 1 ? "" : "s");
+        return 1;
+    }
+    std::printf("loader: all passed\n");
+    return 0;
+}
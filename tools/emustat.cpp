@@ -0,0 +1,77 @@
+// Shows live rates from a running emulator's telemetry segment:
+//
+//   emustat NAME [SECONDS]     sample every SECONDS (default 1) until the
+//                              emulator exits
+//
+// NAME is what was given to `emu --telemetry`.
+#include "telemetry.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+struct Sample {
+    uint64_t at;
+    uint64_t instructions, cycles, unknownOpcodes, frames, frameNanos, droppedFrames, presented, presentNanos;
+};
+
+static Sample take(const TelemetryCounters& t) {
+    Sample s;
+    s.at = Telemetry::nanos();
+    s.instructions = t.instructions.load(std::memory_order_relaxed);
+    s.cycles = t.cycles.load(std::memory_order_relaxed);
+    s.unknownOpcodes = t.unknownOpcodes.load(std::memory_order_relaxed);
+    s.frames = t.frames.load(std::memory_order_relaxed);
+    s.frameNanos = t.frameNanos.load(std::memory_order_relaxed);
+    s.droppedFrames = t.droppedFrames.load(std::memory_order_relaxed);
+    s.presented = t.presented.load(std::memory_order_relaxed);
+    s.presentNanos = t.presentNanos.load(std::memory_order_relaxed);
+    return s;
+}
+
+// Per-second rate; a counter that went backwards (cycles after a rewind)
+// reads as zero.
+static double rate(uint64_t now, uint64_t before, double seconds) {
+    return now >= before ? (now - before) / seconds : 0.0;
+}
+
+// Mean of an accumulated duration over `count` new events, in milliseconds.
+static double mean(uint64_t nanos, uint64_t nanosBefore, uint64_t count, uint64_t countBefore) {
+    return count > countBefore ? (nanos - nanosBefore) / 1e6 / (count - countBefore) : 0.0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::fprintf(stderr, "usage: emustat NAME [SECONDS]\n");
+        return 2;
+    }
+    double interval = argc == 3 ? std::atof(argv[2]) : 1.0;
+    if (interval <= 0) interval = 1.0;
+
+    Telemetry telemetry(argv[1], Telemetry::Attach);
+    if (!telemetry.ok()) {
+        std::fprintf(stderr, "No telemetry segment %s\n", argv[1]);
+        return 1;
+    }
+    const TelemetryCounters& t = telemetry.get();
+    const pid_t pid = (pid_t)t.pid;
+
+    std::printf("%8s %8s %7s %9s %9s %9s %8s %8s\n", "MIPS", "MHz", "fps", "cyc/frame", "frame ms", "present", "dropped",
+                "unknown");
+    Sample last = take(t);
+    while (kill(pid, 0) == 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+        Sample now = take(t);
+        const double seconds = (now.at - last.at) / 1e9;
+        std::printf("%8.2f %8.3f %7.1f %9llu %9.3f %9.3f %8llu %8llu\n", rate(now.instructions, last.instructions, seconds) / 1e6,
+                    rate(now.cycles, last.cycles, seconds) / 1e6, rate(now.frames, last.frames, seconds),
+                    (unsigned long long)t.lastFrameCycles.load(std::memory_order_relaxed),
+                    mean(now.frameNanos, last.frameNanos, now.frames, last.frames),
+                    mean(now.presentNanos, last.presentNanos, now.presented, last.presented),
+                    (unsigned long long)now.droppedFrames, (unsigned long long)now.unknownOpcodes);
+        std::fflush(stdout);
+        last = now;
+    }
+    return 0;
+}
@@ -0,0 +1,569 @@
+// Translates a 6502 program into C++ for runRecompiled() (recompiled.h):
+//
+//   recompile ROM NAME OUT.cpp [ORIGIN]
+//
+// ROM is a raw binary loaded at ORIGIN (hex, default 0600), or `snake` for
+// the built-in snake image. Code is found by following branch, JMP and JSR
+// targets from ORIGIN; bytes never reached stay data. The output defines
+// `extern const RecompiledRom NAME`.
+//
+// Each basic block becomes a labelled run of C++ statements working on local
+// copies of the registers, with a guard in front that leaves when the block
+// might not fit the cycle budget. Branches, JMP and JSR jump straight to
+// their target's label; RTS goes through a switch over every block start.
+// JMP indirect, BRK, RTI, PLP, CLI and undefined opcodes are left to the
+// interpreter, as is anything outside the image.
+#include "cpu.h"
+#include "snake.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Insn {
+    Word pc;
+    Byte opcode;
+    Byte lo, hi;  // operand bytes as in memory
+    Word operand; // immediate, address, or branch target
+    Byte length;
+};
+
+std::string hex(unsigned value, int digits) {
+    char text[8];
+    std::snprintf(text, sizeof(text), "%0*X", digits, value);
+    return text;
+}
+
+std::string lit(Word value) { return "0x" + hex(value, 4); }
+std::string label(Word pc) { return "L" + hex(pc, 4); }
+
+class Translator {
+public:
+    Translator(const std::vector<Byte>& image, Word origin) : image(image), origin(origin) {}
+
+    void discover();
+    std::string emit(const std::string& name);
+
+    size_t instructions() const { return code.size(); }
+    size_t blocks() const { return leaders.size(); }
+
+private:
+    const std::vector<Byte>& image;
+    const Word origin;
+    std::map<Word, Insn> code;
+    std::set<Word> leaders;
+
+    std::string body;
+    bool usesA, usesM, usesS;
+
+    bool inImage(Word address, unsigned length = 1) const {
+        return address >= origin && (unsigned)(address - origin) + length <= image.size();
+    }
+    bool translated(Word pc) const { return code.count(pc) != 0; }
+    std::string name(const Insn& in) const { return cpu::mnemonic(in.opcode); }
+    bool leftToInterpreter(const Insn& in) const;
+    bool isRead(const Insn& in) const;
+    unsigned maxCycles(const Insn& in) const;
+    std::vector<Insn> countdown(Word leader) const;
+    void skipCountdown(const std::vector<Insn>& loop);
+
+    std::string indent = "    ";
+    void line(const std::string& text) { body += indent + text + "\n"; }
+    void exitTo(Word pc, const char* result = "Leave");
+    void jumpTo(Word pc);
+    std::string address(const Insn& in, bool penalty);
+    void store(const Insn& in, const std::string& where, const std::string& value);
+    void push(const std::string& value);
+    std::string readOperand(const Insn& in);
+    void modify(const Insn& in, const std::string& op);
+    void translate(const Insn& in);
+};
+
+bool Translator::leftToInterpreter(const Insn& in) const {
+    const std::string n = name(in);
+    return (n == "JMP" && cpu::addressingMode(in.opcode) == cpu::Indirect) || n == "BRK" || n == "RTI" ||
+           n == "PLP" || n == "CLI" || n == "UNK";
+}
+
+bool Translator::isRead(const Insn& in) const {
+    static const char* const reads[] = { "LDA", "LDX", "LDY", "ADC", "SBC", "AND", "ORA", "EOR", "CMP", "CPX", "CPY", "BIT" };
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); ++i) {
+        if (name(in) == reads[i]) return true;
+    }
+    return false;
+}
+
+// Worst case, for the block guard: a page-crossing indexed read or a taken
+// branch to another page.
+unsigned Translator::maxCycles(const Insn& in) const {
+    if (leftToInterpreter(in)) return 0;
+    unsigned cycles = cpu::baseCycles(in.opcode);
+    cpu::AddressingMode mode = cpu::addressingMode(in.opcode);
+    if (mode == cpu::Relative) cycles += 2;
+    else if (isRead(in) && (mode == cpu::AbsoluteX || mode == cpu::AbsoluteY || mode == cpu::IndirectY)) cycles += 1;
+    return cycles;
+}
+
+// The block at `leader` when it is a delay loop cpu::skipSpin() would
+// fast-forward: NOPs and flag sets, then DEX, DEY, INX or INY and a BNE back
+// to the start. Empty otherwise.
+std::vector<Insn> Translator::countdown(Word leader) const {
+    std::vector<Insn> loop;
+    for (std::map<Word, Insn>::const_iterator it = code.find(leader); it != code.end(); ++it) {
+        if (it->first != leader && (leaders.count(it->first) || it->first != loop.back().pc + loop.back().length)) break;
+        loop.push_back(it->second);
+        if (cpu::addressingMode(it->second.opcode) == cpu::Relative) break;
+    }
+    const size_t count = loop.size();
+    if (count < 2 || loop[count - 1].opcode != 0xD0 || loop[count - 1].operand != leader) return std::vector<Insn>();
+    switch (loop[count - 2].opcode) {
+        case 0xCA: case 0x88: case 0xE8: case 0xC8: break; // DEX, DEY, INX, INY
+        default: return std::vector<Insn>();
+    }
+    for (size_t i = 0; i + 2 < count; ++i) {
+        switch (loop[i].opcode) {
+            case 0xEA: case 0x18: case 0x38: case 0xD8: case 0xF8: case 0xB8: break; // NOP, flag sets
+            default: return std::vector<Insn>();
+        }
+    }
+    return loop;
+}
+
+// Skips the whole iterations of a countdown loop that end before `end`,
+// leaving the last one to run normally, exactly as cpu::skipSpin() does.
+void Translator::skipCountdown(const std::vector<Insn>& loop) {
+    const Insn& branch = loop.back();
+    unsigned spent = 1 + (((branch.operand ^ (branch.pc + 2)) & 0xFF00) ? 1 : 0);
+    for (size_t i = 0; i < loop.size(); ++i) spent += cpu::baseCycles(loop[i].opcode);
+    const Byte step = loop[loop.size() - 2].opcode;
+    const bool down = step == 0xCA || step == 0x88;
+    const std::string counter = (step == 0xCA || step == 0xE8) ? "X" : "Y";
+
+    line("// Countdown loop: whole iterations are skipped, as cpu::skipSpin() does.");
+    line("if (cyc < end) {");
+    indent += "    ";
+    line("uint64_t skip = (end - cyc - 1) / " + std::to_string(spent) + ";");
+    line("const uint64_t left = " + (down ? counter : "(Byte)-" + counter) + " ? " +
+         (down ? counter : "(Byte)-" + counter) + " : 256;");
+    line("if (skip > left - 1) skip = left - 1;");
+    line("if (skip) {");
+    indent += "    ";
+    for (size_t i = 0; i + 2 < loop.size(); ++i) {
+        switch (loop[i].opcode) {
+            case 0x18: line("fc = 0;"); break;
+            case 0x38: line("fc = 1;"); break;
+            case 0xD8: line("rest &= ~D;"); break;
+            case 0xF8: line("rest |= D;"); break;
+            case 0xB8: line("fv = 0;"); break;
+        }
+    }
+    line(counter + (down ? " -= " : " += ") + "(Byte)skip;");
+    line("zr = nr = " + counter + ";");
+    line("cyc += skip * " + std::to_string(spent) + ";");
+    line("ins += skip * " + std::to_string(loop.size()) + ";");
+    indent.resize(8);
+    line("}");
+    indent.resize(4);
+    line("}");
+}
+
+// Recursive descent from the origin. Every instruction that control can
+// reach other than by falling through starts a block.
+void Translator::discover() {
+    std::vector<Word> work(1, origin);
+    leaders.insert(origin);
+    while (!work.empty()) {
+        Word pc = work.back();
+        work.pop_back();
+        if (translated(pc) || !inImage(pc)) continue;
+        Byte opcode = image[pc - origin];
+        const Byte length = cpu::instructionLength(opcode);
+        if (!inImage(pc, length)) continue;
+        const Byte lo = length > 1 ? image[pc - origin + 1] : 0;
+        const Byte hi = length > 2 ? image[pc - origin + 2] : 0;
+        const Word next = pc + length;
+        Insn in = { pc, opcode, lo, hi, (Word)(lo | (hi << 8)), length };
+        if (cpu::addressingMode(opcode) == cpu::Relative) in.operand = next + (int8_t)lo;
+        code[pc] = in;
+
+        const std::string n = name(in);
+        if (leftToInterpreter(in)) {
+            if (n == "PLP" || n == "CLI") {
+                leaders.insert(next);
+                work.push_back(next);
+            }
+        } else if (cpu::addressingMode(opcode) == cpu::Relative) {
+            leaders.insert(in.operand);
+            leaders.insert(next);
+            work.push_back(in.operand);
+            work.push_back(next);
+        } else if (n == "JMP") {
+            leaders.insert(in.operand);
+            work.push_back(in.operand);
+        } else if (n == "JSR") {
+            leaders.insert(in.operand);
+            leaders.insert(next); // where RTS comes back to
+            work.push_back(in.operand);
+            work.push_back(next);
+        } else if (n != "RTS") {
+            work.push_back(next);
+        }
+    }
+    // Targets outside the image, or in the middle of nothing decodable.
+    for (std::set<Word>::iterator it = leaders.begin(); it != leaders.end();) {
+        if (translated(*it)) ++it;
+        else leaders.erase(it++);
+    }
+    // Overlapping decodes: a fall-through that is not emitted next needs a
+    // label to jump to.
+    for (std::map<Word, Insn>::const_iterator it = code.begin(); it != code.end(); ++it) {
+        const Word next = it->first + it->second.length;
+        std::map<Word, Insn>::const_iterator following = it;
+        ++following;
+        if (translated(next) && (following == code.end() || following->first != next)) leaders.insert(next);
+    }
+}
+
+void Translator::exitTo(Word pc, const char* result) {
+    line("pc = " + lit(pc) + ";");
+    if (std::strcmp(result, "Leave") != 0) line(std::string("result = RecompiledRom::") + result + ";");
+    line("goto out;");
+}
+
+void Translator::jumpTo(Word pc) {
+    if (translated(pc)) line("goto " + label(pc) + ";");
+    else exitTo(pc);
+}
+
+// The effective address as an expression: a constant where the mode allows,
+// otherwise computed into `a`.
+std::string Translator::address(const Insn& in, bool penalty) {
+    const Word op = in.operand;
+    switch (cpu::addressingMode(in.opcode)) {
+        case cpu::ZeroPage:
+        case cpu::Absolute:
+            return lit(op);
+        case cpu::ZeroPageX:
+            usesA = true;
+            line("a = (Byte)(" + lit(op) + " + X);");
+            return "a";
+        case cpu::ZeroPageY:
+            usesA = true;
+            line("a = (Byte)(" + lit(op) + " + Y);");
+            return "a";
+        case cpu::AbsoluteX:
+        case cpu::AbsoluteY: {
+            const char* index = cpu::addressingMode(in.opcode) == cpu::AbsoluteX ? "X" : "Y";
+            usesA = true;
+            if (penalty) line("cyc += (0x" + hex(op & 0xFF, 2) + " + " + index + ") >> 8;");
+            line("a = (Word)(" + lit(op) + " + " + index + ");");
+            return "a";
+        }
+        case cpu::IndirectX:
+            usesA = true;
+            line("a = c.read((Byte)(" + lit(op) + " + X)) | (c.read((Byte)(" + lit(op) + " + X + 1)) << 8);");
+            return "a";
+        case cpu::IndirectY:
+            usesA = usesM = true;
+            line("m = c.read(" + lit(op) + ");");
+            if (penalty) line("cyc += (m + Y) >> 8;");
+            line("a = (Word)((m | (c.read((Byte)(" + lit(op) + " + 1)) << 8)) + Y);");
+            return "a";
+        default:
+            return "0";
+    }
+}
+
+// A write that may land in the image ends translated execution after the
+// instruction, so stale code is never run.
+void Translator::store(const Insn& in, const std::string& where, const std::string& value) {
+    line("c.write(" + where + ", " + value + ");");
+    const Word next = in.pc + in.length;
+    if (where == "a") {
+        line("if ((Word)(a - " + lit(origin) + ") < " + lit((Word)image.size()) + ") {");
+        indent += "    ";
+        exitTo(next, "Modified");
+        indent.resize(4);
+        line("}");
+    } else if (inImage((Word)std::strtoul(where.c_str(), nullptr, 16))) {
+        exitTo(next, "Modified");
+    }
+}
+
+// The image never covers the stack page (see main), so pushes need no check.
+void Translator::push(const std::string& value) {
+    line("c.write(0x0100 + SP, " + value + ");");
+    line("--SP;");
+}
+
+std::string Translator::readOperand(const Insn& in) {
+    switch (cpu::addressingMode(in.opcode)) {
+        case cpu::Immediate:
+            return "0x" + hex(in.operand & 0xFF, 2);
+        case cpu::Accumulator:
+            return "A";
+        default:
+            usesM = true;
+            line("m = c.read(" + address(in, true) + ");");
+            return "m";
+    }
+}
+
+// Read-modify-write on A or memory; `op` transforms `m` (or A).
+void Translator::modify(const Insn& in, const std::string& op) {
+    if (cpu::addressingMode(in.opcode) == cpu::Accumulator) {
+        std::string text = op;
+        for (size_t at; (at = text.find("@")) != std::string::npos;) text.replace(at, 1, "A");
+        line(text);
+        line("zr = nr = A;");
+        return;
+    }
+    usesM = true;
+    std::string where = address(in, false);
+    line("m = c.read(" + where + ");");
+    std::string text = op;
+    for (size_t at; (at = text.find("@")) != std::string::npos;) text.replace(at, 1, "m");
+    line(text);
+    line("zr = nr = m;");
+    store(in, where, "m");
+}
+
+void Translator::translate(const Insn& in) {
+    body += "    // $" + hex(in.pc, 4) + "  " + cpu::disassemble(in.pc, in.opcode, in.lo, in.hi) + "\n";
+    const std::string n = name(in);
+    const Word next = in.pc + in.length;
+    const cpu::AddressingMode mode = cpu::addressingMode(in.opcode);
+    if (leftToInterpreter(in)) {
+        exitTo(in.pc);
+        return;
+    }
+    line("cyc += " + std::to_string((unsigned)cpu::baseCycles(in.opcode)) + ";");
+    line("++ins;");
+
+    if (n == "LDA" || n == "LDX" || n == "LDY") {
+        const std::string r = n.substr(2);
+        line(r + " = " + readOperand(in) + ";");
+        line("zr = nr = " + r + ";");
+    } else if (n == "STA" || n == "STX" || n == "STY") {
+        store(in, address(in, false), n.substr(2));
+    } else if (n == "ADC" || n == "SBC") {
+        usesM = usesS = true;
+        std::string v = readOperand(in);
+        line(n == "SBC" ? "m = (Byte)~" + v + ";" : "m = " + v + ";");
+        line("s = A + m + fc;");
+        line("fv = (~(A ^ m) & (A ^ s) & 0x80) >> 1;");
+        line("fc = s >> 8;");
+        line("A = (Byte)s;");
+        line("zr = nr = A;");
+    } else if (n == "AND" || n == "ORA" || n == "EOR") {
+        const char* op = n == "AND" ? "&" : n == "ORA" ? "|" : "^";
+        line(std::string("A ") + op + "= " + readOperand(in) + ";");
+        line("zr = nr = A;");
+    } else if (n == "CMP" || n == "CPX" || n == "CPY") {
+        const std::string r = n == "CMP" ? "A" : n.substr(2);
+        std::string v = readOperand(in);
+        line("fc = " + r + " >= " + v + ";");
+        line("zr = nr = (Byte)(" + r + " - " + v + ");");
+    } else if (n == "BIT") {
+        std::string v = readOperand(in);
+        line("zr = A & " + v + ";");
+        line("nr = " + v + ";");
+        line("fv = " + v + " & 0x40;");
+    } else if (n == "INC") {
+        modify(in, "++@;");
+    } else if (n == "DEC") {
+        modify(in, "--@;");
+    } else if (n == "ASL") {
+        modify(in, "fc = @ >> 7; @ = (Byte)(@ << 1);");
+    } else if (n == "LSR") {
+        modify(in, "fc = @ & 1; @ >>= 1;");
+    } else if (n == "ROL") {
+        usesS = true;
+        modify(in, "s = fc; fc = @ >> 7; @ = (Byte)((@ << 1) | s);");
+    } else if (n == "ROR") {
+        usesS = true;
+        modify(in, "s = fc; fc = @ & 1; @ = (Byte)((@ >> 1) | (s << 7));");
+    } else if (n == "INX" || n == "INY" || n == "DEX" || n == "DEY") {
+        const std::string r = n.substr(2);
+        line((n[0] == 'I' ? "++" : "--") + r + ";");
+        line("zr = nr = " + r + ";");
+    } else if (n == "TAX" || n == "TAY" || n == "TXA" || n == "TYA" || n == "TSX") {
+        const std::string from = n == "TSX" ? "SP" : n.substr(1, 1), to = n.substr(2);
+        line(to + " = " + from + ";");
+        line("zr = nr = " + to + ";");
+    } else if (n == "TXS") {
+        line("SP = X;");
+    } else if (n == "PHA") {
+        push("A");
+    } else if (n == "PHP") {
+        push("(Byte)(rest | fc | fv | (zr ? 0 : Z) | (nr & N) | B | U)");
+    } else if (n == "PLA") {
+        line("++SP;");
+        line("A = c.read(0x0100 + SP);");
+        line("zr = nr = A;");
+    } else if (n == "CLC" || n == "SEC") {
+        line(std::string("fc = ") + (n == "SEC" ? "1;" : "0;"));
+    } else if (n == "CLV") {
+        line("fv = 0;");
+    } else if (n == "CLD") {
+        line("rest &= ~D;");
+    } else if (n == "SED") {
+        line("rest |= D;");
+    } else if (n == "SEI") {
+        line("rest |= I;");
+    } else if (n == "NOP") {
+    } else if (n == "JMP") {
+        jumpTo(in.operand);
+        return;
+    } else if (n == "JSR") {
+        const Word ret = in.pc + 2;
+        push("0x" + hex(ret >> 8, 2));
+        push("0x" + hex(ret & 0xFF, 2));
+        jumpTo(in.operand);
+        return;
+    } else if (n == "RTS") {
+        usesA = true;
+        line("++SP;");
+        line("a = c.read(0x0100 + SP);");
+        line("++SP;");
+        line("a |= c.read(0x0100 + SP) << 8;");
+        line("pc = (Word)(a + 1);");
+        line("goto dispatch;");
+        return;
+    } else if (mode == cpu::Relative) {
+        const char* condition = n == "BCC" ? "!fc" : n == "BCS" ? "fc" : n == "BEQ" ? "!zr" : n == "BNE" ? "zr"
+                              : n == "BMI" ? "nr & 0x80" : n == "BPL" ? "!(nr & 0x80)" : n == "BVC" ? "!fv" : "fv";
+        const unsigned taken = ((in.operand ^ next) & 0xFF00) ? 2 : 1;
+        line(std::string("if (") + condition + ") {");
+        indent += "    ";
+        line("cyc += " + std::to_string(taken) + ";");
+        jumpTo(in.operand);
+        indent.resize(4);
+        line("}");
+    }
+}
+
+std::string Translator::emit(const std::string& romName) {
+    body.clear();
+    usesA = usesM = usesS = false;
+
+    // Block guards, in address order.
+    std::map<Word, unsigned> guard;
+    Word leader = 0;
+    bool open = false;
+    for (std::map<Word, Insn>::const_iterator it = code.begin(); it != code.end(); ++it) {
+        const Insn& in = it->second;
+        if (leaders.count(in.pc)) {
+            leader = in.pc;
+            open = true;
+            guard[leader] = 0;
+        }
+        if (!open) continue;
+        guard[leader] += maxCycles(in);
+        const std::string n = name(in);
+        if (leftToInterpreter(in) || n == "JMP" || n == "JSR" || n == "RTS") open = false;
+        std::map<Word, Insn>::const_iterator following = it;
+        ++following;
+        if (following == code.end() || following->first != in.pc + in.length) open = false;
+    }
+
+    for (std::map<Word, Insn>::const_iterator it = code.begin(); it != code.end(); ++it) {
+        const Insn& in = it->second;
+        if (leaders.count(in.pc)) {
+            body += label(in.pc) + ":\n";
+            const std::vector<Insn> loop = countdown(in.pc);
+            if (!loop.empty()) skipCountdown(loop);
+            line("if (end - cyc < " + std::to_string(guard[in.pc]) + ") {");
+            indent += "    ";
+            exitTo(in.pc, "Budget");
+            indent.resize(4);
+            line("}");
+        }
+        translate(in);
+
+        // Fall through to whatever follows in memory, if it was not emitted next.
+        const std::string n = name(in);
+        if (leftToInterpreter(in) || n == "JMP" || n == "JSR" || n == "RTS") continue;
+        const Word next = in.pc + in.length;
+        std::map<Word, Insn>::const_iterator following = it;
+        ++following;
+        if (following != code.end() && following->first == next) continue;
+        jumpTo(next);
+    }
+
+    std::string out;
+    out += "// Generated by tools/recompile: " + std::to_string(image.size()) + " bytes at $" + hex(origin, 4) + ", " +
+           std::to_string(code.size()) + " instructions in " + std::to_string(leaders.size()) + " blocks. Do not edit.\n";
+    out += "#include \"recompiled.h\"\n\n";
+    out += "static const Byte image[] = {";
+    for (size_t i = 0; i < image.size(); ++i) out += std::string(i % 16 ? " " : "\n    ") + "0x" + hex(image[i], 2) + ",";
+    out += "\n};\n\n";
+    out += "static RecompiledRom::Exit run(cpu& c, uint64_t end) {\n";
+    out += "    Byte A = c.A, X = c.X, Y = c.Y, SP = c.SP;\n";
+    out += "    Byte fc = c.P & C, fv = c.P & V, rest = c.P & (I | D | B | U);\n";
+    out += "    Byte zr = (c.P & Z) ? 0 : 1, nr = c.P & N; // lazy Z and N, as in cpu\n";
+    out += "    uint64_t cyc = c.cycles, ins = 0;\n";
+    out += "    Word pc = c.PC;\n";
+    if (usesA) out += "    Word a;\n";
+    if (usesM) out += "    Byte m;\n";
+    if (usesS) out += "    unsigned s;\n";
+    out += "    RecompiledRom::Exit result = RecompiledRom::Leave;\n\n";
+    out += "dispatch:\n    switch (pc) {\n";
+    for (std::set<Word>::const_iterator it = leaders.begin(); it != leaders.end(); ++it) {
+        out += "        case " + lit(*it) + ": goto " + label(*it) + ";\n";
+    }
+    out += "        default: goto out;\n    }\n\n";
+    out += body;
+    out += "\nout:\n";
+    out += "    c.A = A;\n    c.X = X;\n    c.Y = Y;\n    c.SP = SP;\n";
+    out += "    c.P = rest | fc | fv | (zr ? 0 : Z) | (nr & N);\n";
+    out += "    c.PC = pc;\n    c.cycles = cyc;\n    c.instructions += ins;\n";
+    out += "    return result;\n}\n\n";
+    out += "extern const RecompiledRom " + romName + " = { \"" + romName + "\", " + lit(origin) + ", " +
+           lit((Word)image.size()) + ", image, run };\n";
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 4 || argc > 5) {
+        std::fprintf(stderr, "usage: recompile ROM|snake NAME OUT.cpp [ORIGIN]\n");
+        return 2;
+    }
+    Word origin = argc == 5 ? (Word)std::strtoul(argv[4], nullptr, 16) : 0x0600;
+    std::vector<Byte> image;
+    if (std::string(argv[1]) == "snake") {
+        image = snakeGame();
+    } else {
+        std::ifstream in(argv[1], std::ios::binary);
+        image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (!in.eof() && !in) image.clear();
+    }
+    if (image.empty() || origin + image.size() > 0x10000) {
+        std::fprintf(stderr, "Cannot load %s at $%04X\n", argv[1], origin);
+        return 1;
+    }
+    if (origin < 0x0200 && origin + image.size() > 0x0100) {
+        std::fprintf(stderr, "%s at $%04X overlaps the stack page\n", argv[1], origin);
+        return 1;
+    }
+
+    Translator translator(image, origin);
+    translator.discover();
+    std::ofstream out(argv[3]);
+    out << translator.emit(argv[2]);
+    if (!out) {
+        std::fprintf(stderr, "Cannot write %s\n", argv[3]);
+        return 1;
+    }
+    std::printf("%s: %zu instructions in %zu blocks\n", argv[2], translator.instructions(), translator.blocks());
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Queries an execution trace written by Tracer without loading it:
+//
+//   tracequery FILE info
+//   tracequery FILE last-write ADDR       last instruction that stored to ADDR
+//   tracequery FILE before PC [N]         the N (default 100) instructions
+//                                         leading up to the last visit of PC
+//
+// Chunks are decoded newest first and the search stops at the first hit.
+#include "trace.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static void print(const TraceStep& s) {
+    std::string text = cpu::disassemble(s.pc, s.opcode, s.operand[0], s.operand[1]);
+    std::printf("#%-10llu cyc %-12llu %04X  %-16s A=%02X X=%02X Y=%02X SP=%02X P=%02X",
+                (unsigned long long)s.index, (unsigned long long)s.cycle, s.pc, text.c_str(),
+                s.A, s.X, s.Y, s.SP, s.P);
+    for (int i = 0; i < s.writeCount; ++i) std::printf("  [%04X]=%02X", s.writeAddress[i], s.writeValue[i]);
+    std::printf("\n");
+}
+
+static bool parseWord(const char* text, Word& value) {
+    char* end = nullptr;
+    unsigned long v = std::strtoul(text[0] == '$' ? text + 1 : text, &end, 16);
+    if (!*text || *end || v > 0xFFFF) return false;
+    value = (Word)v;
+    return true;
+}
+
+static int lastWrite(const TraceReader& trace, Word address) {
+    std::vector<TraceStep> steps;
+    for (size_t c = trace.chunkCount(); c-- > 0;) {
+        if (!trace.decode(c, steps)) continue;
+        for (size_t i = steps.size(); i-- > 0;) {
+            for (int w = 0; w < steps[i].writeCount; ++w) {
+                if (steps[i].writeAddress[w] == address) {
+                    print(steps[i]);
+                    return 0;
+                }
+            }
+        }
+    }
+    std::printf("$%04X is never written\n", address);
+    return 1;
+}
+
+static int before(const TraceReader& trace, Word pc, size_t count) {
+    std::vector<TraceStep> steps, previous;
+    for (size_t c = trace.chunkCount(); c-- > 0;) {
+        if (!trace.decode(c, steps)) continue;
+        for (size_t i = steps.size(); i-- > 0;) {
+            if (steps[i].pc != pc) continue;
+            // The window may reach back into older chunks.
+            std::vector<TraceStep> window(steps.begin(), steps.begin() + i + 1);
+            for (size_t older = c; window.size() < count + 1 && older-- > 0;) {
+                if (!trace.decode(older, previous)) break;
+                window.insert(window.begin(), previous.begin(), previous.end());
+            }
+            size_t first = window.size() > count + 1 ? window.size() - count - 1 : 0;
+            for (size_t k = first; k < window.size(); ++k) print(window[k]);
+            return 0;
+        }
+    }
+    std::printf("PC $%04X is never executed\n", pc);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s FILE info | last-write ADDR | before PC [N]\n", argv[0]);
+        return 2;
+    }
+    TraceReader trace;
+    if (!trace.open(argv[1])) {
+        std::fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 2;
+    }
+    std::string command = argv[2];
+    Word value = 0;
+    if (command == "info") {
+        std::printf("%zu chunks, %llu instructions\n", trace.chunkCount(), (unsigned long long)trace.instructionCount());
+        return 0;
+    }
+    if (command == "last-write" && argc >= 4 && parseWord(argv[3], value)) return lastWrite(trace, value);
+    if (command == "before" && argc >= 4 && parseWord(argv[3], value)) {
+        size_t count = argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : 100;
+        return before(trace, value, count);
+    }
+    std::fprintf(stderr, "bad command\n");
+    return 2;
+}